@@ -649,6 +649,520 @@ dt_rep_aggr_class_count_ffunc
 PG_FUNCTION_INFO_V1(dt_rep_aggr_class_count_ffunc);
 
 
+/*
+ * A node of the tree being pruned. Tree pruning loads the whole tree into
+ * an array of these nodes sorted by node ID.
+ *
+ * Child nodes are always created with larger IDs than all existing nodes.
+ * Hence, walking the sorted array backwards visits every node after all of
+ * its descendants (post-order), and walking it forwards visits every node
+ * after all of its ancestors.
+ *
+ *  id                  The ID of the node.
+ *  pos                 The position of the node in the input arrays.
+ *  parent              The index of the parent node, or -1 for a root.
+ *  has_children        Whether the node has child nodes.
+ *  all_children_leaf   Whether all child nodes are leaves (after pruning).
+ *  num_child_errors    The number of child nodes with a non-NULL error.
+ *  child_errors        The sum of the errors of the child nodes (EBP).
+ *  action              0: the node is kept as is; -1: the node is removed;
+ *                      > 0: the children are removed and the node becomes
+ *                      a leaf. For REP, the value is the new class.
+ */
+typedef struct
+{
+	int32       id;
+	int         pos;
+	int         parent;
+	bool        has_children;
+	bool        all_children_leaf;
+	int         num_child_errors;
+	float8      child_errors;
+	int32       action;
+} DtPruneNode;
+
+
+/*
+ * @brief Compare two tree nodes by their IDs. It is used by qsort.
+ */
+static
+int
+dt_prune_node_cmp
+	(
+	const void *lhs,
+	const void *rhs
+	)
+{
+	int32 lhs_id = ((const DtPruneNode *)lhs)->id;
+	int32 rhs_id = ((const DtPruneNode *)rhs)->id;
+
+	return lhs_id < rhs_id ? -1 : (lhs_id > rhs_id ? 1 : 0);
+}
+
+
+/*
+ * @brief Find a node with the given ID by binary search.
+ *
+ * @param nodes     The nodes sorted by ID.
+ * @param num_nodes The number of nodes.
+ * @param id        The ID of the node to be found.
+ *
+ * @return The index of the node, or -1 if there is no such node.
+ *
+ */
+static
+int
+dt_prune_find_node
+	(
+	DtPruneNode *nodes,
+	int          num_nodes,
+	int32        id
+	)
+{
+	int low  = 0;
+	int high = num_nodes - 1;
+
+	while (low <= high)
+	{
+		int mid = low + (high - low) / 2;
+
+		if (nodes[mid].id == id)
+			return mid;
+		else if (nodes[mid].id < id)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	return -1;
+}
+
+
+/*
+ * @brief Get the elements of a one-dimensional array without NULL values.
+ *
+ * @param array     The array.
+ * @param elmtype   The OID of the element type.
+ * @param elmlen    The length of the element type.
+ * @param elmalign  The alignment of the element type.
+ * @param nelems    The number of elements will be returned through it.
+ *
+ * @return The elements of the array.
+ *
+ */
+static
+Datum *
+dt_prune_get_elems
+	(
+	ArrayType  *array,
+	Oid         elmtype,
+	int         elmlen,
+	char        elmalign,
+	int        *nelems
+	)
+{
+	Datum      *elems = NULL;
+
+	dt_check_error_value
+		(
+			ARR_NDIM(array) == 1,
+			"invalid array dimension: %d. "
+			"The dimension of the array must be equal to 1",
+			ARR_NDIM(array)
+		);
+
+	dt_check_error
+		(
+			!ARR_HASNULL(array),
+			"tree pruning cannot accept arrays with NULL values"
+		);
+
+	deconstruct_array(array, elmtype, elmlen, true, elmalign,
+					  &elems, NULL, nelems);
+
+	return elems;
+}
+
+
+/*
+ * @brief Load a tree into an array of nodes sorted by ID and link each node
+ *        to its parent.
+ *
+ * @param pg_ids        The IDs of the nodes.
+ * @param pg_parent_ids The IDs of the parent nodes. 0 means no parent.
+ * @param num_nodes     The number of nodes will be returned through it.
+ *
+ * @return The sorted nodes.
+ *
+ */
+static
+DtPruneNode *
+dt_prune_load_tree
+	(
+	ArrayType  *pg_ids,
+	ArrayType  *pg_parent_ids,
+	int        *num_nodes
+	)
+{
+	int          num_parents = 0;
+	Datum       *ids         = dt_prune_get_elems
+								(pg_ids, INT4OID, 4, 'i', num_nodes);
+	Datum       *parent_ids  = dt_prune_get_elems
+								(pg_parent_ids, INT4OID, 4, 'i', &num_parents);
+	DtPruneNode *nodes       = NULL;
+
+	dt_check_error
+		(
+			*num_nodes == num_parents,
+			"the number of node IDs and parent IDs must be the same"
+		);
+
+	nodes = palloc0(sizeof(DtPruneNode) * (*num_nodes));
+	for (int i = 0; i < *num_nodes; ++i)
+	{
+		nodes[i].id                 = DatumGetInt32(ids[i]);
+		nodes[i].pos                = i;
+		nodes[i].all_children_leaf  = true;
+	}
+
+	qsort(nodes, *num_nodes, sizeof(DtPruneNode), dt_prune_node_cmp);
+
+	for (int i = 0; i < *num_nodes; ++i)
+	{
+		int32 parent_id = DatumGetInt32(parent_ids[nodes[i].pos]);
+
+		dt_check_error_value
+			(
+				i == 0 || nodes[i - 1].id != nodes[i].id,
+				"duplicated tree node ID: %d",
+				nodes[i].id
+			);
+
+		nodes[i].parent = parent_id == 0 ?
+			-1 : dt_prune_find_node(nodes, *num_nodes, parent_id);
+
+		dt_check_error_value
+			(
+				parent_id == 0 ||
+				(nodes[i].parent >= 0 && parent_id < nodes[i].id),
+				"invalid parent ID of tree node %d",
+				nodes[i].id
+			);
+
+		if (nodes[i].parent >= 0)
+			nodes[nodes[i].parent].has_children = true;
+	}
+
+	return nodes;
+}
+
+
+/*
+ * @brief Remove the descendants of the pruned nodes, and return the action
+ *        of each node in the order of the input arrays.
+ *
+ * @param nodes     The nodes sorted by ID.
+ * @param num_nodes The number of nodes.
+ *
+ * @return The array of actions. See DtPruneNode for their meanings.
+ *
+ */
+static
+ArrayType *
+dt_prune_get_actions
+	(
+	DtPruneNode *nodes,
+	int          num_nodes
+	)
+{
+	Datum *actions = palloc(sizeof(Datum) * num_nodes);
+
+	/* parents are visited before their children */
+	for (int i = 0; i < num_nodes; ++i)
+	{
+		if (nodes[i].parent >= 0 && nodes[nodes[i].parent].action != 0)
+			nodes[i].action = -1;
+
+		actions[nodes[i].pos] = Int32GetDatum(nodes[i].action);
+	}
+
+	return construct_array(actions, num_nodes, INT4OID, 4, true, 'i');
+}
+
+
+/*
+ * @brief Prune a tree with Error Based Pruning (EBP) in memory.
+ *        Bottom up, the children of a node are removed if all of them are
+ *        leaves and the node's own estimated errors are smaller than the sum
+ *        of theirs. The estimated errors are those computed by
+ *        dt_ebp_calc_errors when the tree was grown.
+ *
+ * @param ids           The IDs of all the tree nodes.
+ * @param parent_ids    The IDs of the parent nodes.
+ * @param ebp_coeffs    The estimated errors of the nodes. NULL values are
+ *                      ignored in the same way as sum() does.
+ *
+ * @return An array with the action for each node, in the order of the input.
+ *         -1 means removing the node, 1 means turning it into a leaf.
+ *
+ */
+Datum
+dt_ebp_prune_tree
+	(
+	PG_FUNCTION_ARGS
+	)
+{
+	int          num_nodes   = 0;
+	int          num_coeffs  = 0;
+	DtPruneNode *nodes       = dt_prune_load_tree
+								(
+									PG_GETARG_ARRAYTYPE_P(0),
+									PG_GETARG_ARRAYTYPE_P(1),
+									&num_nodes
+								);
+	ArrayType   *pg_coeffs   = PG_GETARG_ARRAYTYPE_P(2);
+	Datum       *coeffs      = NULL;
+	bool        *coeff_nulls = NULL;
+
+	dt_check_error
+		(
+			ARR_NDIM(pg_coeffs) == 1,
+			"the dimension of the ebp_coeff array must be equal to 1"
+		);
+
+	deconstruct_array(pg_coeffs, FLOAT8OID, sizeof(float8),
+					  true, 'd', &coeffs, &coeff_nulls, &num_coeffs);
+
+	dt_check_error
+		(
+			num_nodes == num_coeffs,
+			"the number of node IDs and ebp_coeffs must be the same"
+		);
+
+	/* children are visited before their parents */
+	for (int i = num_nodes - 1; i >= 0; --i)
+	{
+		DtPruneNode *node    = &nodes[i];
+		bool         is_leaf = !node->has_children;
+		bool         is_null = coeff_nulls[node->pos];
+		float8       coeff   = is_null ? 0 : DatumGetFloat8(coeffs[node->pos]);
+
+		if (!is_leaf && node->all_children_leaf && !is_null &&
+			node->num_child_errors > 0 && coeff < node->child_errors)
+		{
+			node->action = 1;
+			is_leaf      = true;
+		}
+
+		if (node->parent >= 0)
+		{
+			DtPruneNode *parent = &nodes[node->parent];
+
+			if (!is_null)
+			{
+				parent->child_errors += coeff;
+				++parent->num_child_errors;
+			}
+
+			if (!is_leaf)
+				parent->all_children_leaf = false;
+		}
+	}
+
+	PG_RETURN_ARRAYTYPE_P(dt_prune_get_actions(nodes, num_nodes));
+}
+PG_FUNCTION_INFO_V1(dt_ebp_prune_tree);
+
+
+/*
+ * @brief Prune a tree with Reduced Error Pruning (REP) in memory.
+ *        The validation set is passed in as class counts per parent of the
+ *        node each record is classified to. Bottom up, the children of a 
+ *        node are removed if all of them are leaves and predicting the
+ *        majority class at the node misclassifies no more records. The
+ *        records then move up to the parent of the new leaf.
+ *
+ * @param ids                   The IDs of all the tree nodes.
+ * @param parent_ids            The IDs of the parent nodes.
+ * @param rec_parent_ids        For each group of validation records, the ID
+ *                              of the parent of the node they reach.
+ * @param original_classes      The real class of the records in a group.
+ * @param classified_classes    The predicted class of the records in a group.
+ * @param rec_counts            The number of records in a group.
+ * @param max_num_of_classes    The total number of distinct class values.
+ *
+ * @return An array with the action for each node, in the order of the input.
+ *         -1 means removing the node, a positive value means turning it into
+ *         a leaf of that class.
+ *
+ */
+Datum
+dt_rep_prune_tree
+	(
+	PG_FUNCTION_ARGS
+	)
+{
+	int          num_nodes          = 0;
+	int          num_groups         = 0;
+	int          num_elems          = 0;
+	DtPruneNode *nodes              = dt_prune_load_tree
+										(
+											PG_GETARG_ARRAYTYPE_P(0),
+											PG_GETARG_ARRAYTYPE_P(1),
+											&num_nodes
+										);
+	Datum       *rec_parent_ids     = dt_prune_get_elems
+										(
+											PG_GETARG_ARRAYTYPE_P(2),
+											INT4OID, 4, 'i', &num_groups
+										);
+	Datum       *original_classes   = NULL;
+	Datum       *classified_classes = NULL;
+	Datum       *rec_counts         = NULL;
+	int          max_num_of_classes = PG_GETARG_INT32(6);
+	int          width              = max_num_of_classes + 1;
+	int64       *class_count        = NULL;
+
+	dt_check_error_value
+		(
+			max_num_of_classes >= 2,
+			"invalid value: %d. "
+			"The number of classes must be greater than or equal to 2",
+			max_num_of_classes
+		);
+
+	original_classes    = dt_prune_get_elems
+							(
+								PG_GETARG_ARRAYTYPE_P(3),
+								INT4OID, 4, 'i', &num_elems
+							);
+	dt_check_error
+		(
+			num_elems == num_groups,
+			"the number of parent IDs and classes must be the same"
+		);
+
+	classified_classes  = dt_prune_get_elems
+							(
+								PG_GETARG_ARRAYTYPE_P(4),
+								INT4OID, 4, 'i', &num_elems
+							);
+	dt_check_error
+		(
+			num_elems == num_groups,
+			"the number of parent IDs and classes must be the same"
+		);
+
+	rec_counts          = dt_prune_get_elems
+							(
+								PG_GETARG_ARRAYTYPE_P(5),
+								INT8OID, 8, 'd', &num_elems
+							);
+	dt_check_error
+		(
+			num_elems == num_groups,
+			"the number of parent IDs and counts must be the same"
+		);
+
+	/*
+	 * The class count array of each node has the same layout as the state
+	 * of __rep_aggr_class_count:
+	 * [0]: the total number of mis-classified samples
+	 * [i]: the number of samples belonging to the ith class
+	 */
+	class_count = palloc0(sizeof(int64) * width * num_nodes);
+	for (int i = 0; i < num_groups; ++i)
+	{
+		int     original_class   = DatumGetInt32(original_classes[i]);
+		int     classified_class = DatumGetInt32(classified_classes[i]);
+		int64   count            = DatumGetInt64(rec_counts[i]);
+		int     node             = dt_prune_find_node
+									(
+										nodes,
+										num_nodes,
+										DatumGetInt32(rec_parent_ids[i])
+									);
+
+		dt_check_error_value
+			(
+				original_class > 0 && original_class <= max_num_of_classes,
+				"invalid real class value: %d. "
+				"It must be in range from 1 to the number of classes",
+				original_class
+			);
+
+		dt_check_error_value
+			(
+				classified_class > 0 && classified_class <= max_num_of_classes,
+				"invalid classified class value: %d. "
+				"It must be in range from 1 to the number of classes",
+				classified_class
+			);
+
+		/* the records classified to a root have no parent to be pruned */
+		if (node < 0)
+			continue;
+
+		if (original_class != classified_class)
+			class_count[node * width] += count;
+		class_count[node * width + original_class] += count;
+	}
+
+	/* children are visited before their parents */
+	for (int i = num_nodes - 1; i >= 0; --i)
+	{
+		DtPruneNode *node    = &nodes[i];
+		int64       *counts  = class_count + i * width;
+		bool         is_leaf = !node->has_children;
+
+		if (!is_leaf && node->all_children_leaf)
+		{
+			int64   max     = counts[1];
+			int64   sum     = max;
+			int     maxid   = 1;
+
+			for (int j = 2; j < width; ++j)
+			{
+				if (max < counts[j])
+				{
+					max   = counts[j];
+					maxid = j;
+				}
+
+				sum += counts[j];
+			}
+
+			/*
+			 * Only nodes reached by validation records are pruned, and only
+			 * if pruning does not increase the number of mis-classified
+			 * records.
+			 */
+			if (sum > 0 && counts[0] - (sum - max) >= 0)
+			{
+				node->action = maxid;
+				is_leaf      = true;
+
+				/* the records are now classified to maxid by the new leaf */
+				if (node->parent >= 0)
+				{
+					int64 *parent_counts = class_count + node->parent * width;
+
+					parent_counts[0] += sum - max;
+					for (int j = 1; j < width; ++j)
+						parent_counts[j] += counts[j];
+				}
+			}
+		}
+
+		if (!is_leaf && node->parent >= 0)
+			nodes[node->parent].all_children_leaf = false;
+	}
+
+	PG_RETURN_ARRAYTYPE_P(dt_prune_get_actions(nodes, num_nodes));
+}
+PG_FUNCTION_INFO_V1(dt_rep_prune_tree);
+
+
 /*
  * 	Calculating Split Criteria Values (SCVs for short) is a major
  * 	step for growing a decision tree. While the formulas for different
@@ -1742,72 +2256,90 @@ PG_FUNCTION_INFO_V1(dt_scv_aggr_ffunc);
 
 
 /*
- * @brief The function samples a set of integer values between low and high.
- *        The sample method is 'sample with replacement', which means a sample
- *        could be chosen multiple times.
+ * @brief Mix the bits of a 64-bit value (the finalizer of SplitMix64).
+ *        Consecutive inputs are mapped to uncorrelated outputs.
  *
- * @param sample_size     Number of records to be sampled.
- * @param low             Low limit of sampled values.
- * @param high            High limit of sampled values.
- * @param seed            Seed for random number.
+ * @param x     The value to be mixed.
  *
- * @return A set of integer values sampled randomly between [low, high].
+ * @return The mixed value.
  *
  */
-Datum
-dt_sample_within_range
+static
+uint64
+dt_mix64
 	(
-	PG_FUNCTION_ARGS
+	uint64 x
 	)
 {
-    FuncCallContext     *funcctx 	= NULL;
-    int64               call_cntr	= 0;
-    int64               max_calls	= 0;
+	x += UINT64CONST(0x9E3779B97F4A7C15);
+	x  = (x ^ (x >> 30)) * UINT64CONST(0xBF58476D1CE4E5B9);
+	x  = (x ^ (x >> 27)) * UINT64CONST(0x94D049BB133111EB);
+	return x ^ (x >> 31);
+}
 
-    /* stuff done only on the first call of the function */
-    if (SRF_IS_FIRSTCALL())
-    {
-        MemoryContext   oldcontext;
 
-        /* create a function context for cross-call persistence */
-        funcctx = SRF_FIRSTCALL_INIT();
+/*
+ * @brief The function computes the bootstrap weight of a record for a tree.
+ *        Sampling n records with replacement assigns each record a
+ *        Binomial(n, 1/n) weight, which is Poisson(1) for large n. Hence,
+ *        we draw the weight from Poisson(rate) directly, where rate is the
+ *        sampling percentage. The draw is a deterministic function of the
+ *        record ID, the tree ID and the seed, so no sample needs to be
+ *        materialized before training, and every segment computes the
+ *        weights of its own records independently.
+ *
+ * @param id        The ID of the record.
+ * @param tid       The ID of the tree.
+ * @param seed      The seed shared by all the trees of one training.
+ * @param rate      The expected weight of a record, i.e., the sampling
+ *                  percentage.
+ *
+ * @return The number of times the record is sampled for the tree.
+ *
+ */
+Datum
+dt_poisson_weight
+	(
+	PG_FUNCTION_ARGS
+	)
+{
+	int64       id          = PG_GETARG_INT64(0);
+	int32       tid         = PG_GETARG_INT32(1);
+	int32       seed        = PG_GETARG_INT32(2);
+	float8      rate        = PG_GETARG_FLOAT8(3);
+	uint64      hash        = 0;
+	float8      rand_num    = 0;
+	float8      prob        = 0;
+	float8      cdf         = 0;
+	int32       weight      = 0;
 
-        /* switch to memory context appropriate for multiple function calls */
-        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
-        int64  low = PG_GETARG_INT64(1);
-        int64 high = PG_GETARG_INT64(2);
+	dt_check_error_value
+		(
+			rate > 0 && rate <= 100,
+			"invalid sampling percentage: %lf. "
+			"It must be in range (0, 100]",
+			rate
+		);
 
-		dt_check_error
-			(
-				low<=high && low>=0,
-				"The low margin must not be greater than the high margin. "
-           		"And negative numbers are not accepted"
-			);
+	hash = dt_mix64((uint64)id);
+	hash = dt_mix64(hash ^ (((uint64)(uint32)tid << 32) | (uint32)seed));
 
-        /* total number of samples to be returned */
-        funcctx->max_calls = PG_GETARG_INT64(0);
-        MemoryContextSwitchTo(oldcontext);
-    }
+	/* the 53 high bits make a uniform double in [0, 1) */
+	rand_num = (hash >> 11) * (1.0 / (float8)(UINT64CONST(1) << 53));
 
-    /* stuff done on every call of the function */
-    funcctx   = SRF_PERCALL_SETUP();
-    call_cntr = funcctx->call_cntr;
-    max_calls = funcctx->max_calls;
- 
-    /* when there is more records to return */
-    if (call_cntr < max_calls)
-    {
-        int64       low			= PG_GETARG_INT64(1);
-        int64       high		= PG_GETARG_INT64(2);
-        float8      rand_num	= (random()/(float8)(RAND_MAX+1.0));
-        int64       selection	= (int64)(rand_num*(high-low+1)+low);
-        SRF_RETURN_NEXT(funcctx, Int64GetDatum(selection));
-    }
+	/* inversion of the Poisson CDF */
+	prob = exp(-rate);
+	cdf  = prob;
+	while (rand_num >= cdf && prob > 0)
+	{
+		weight++;
+		prob *= rate / weight;
+		cdf  += prob;
+	}
 
-    /* when there is no more records left */
-    SRF_RETURN_DONE(funcctx);
+	PG_RETURN_INT32(weight);
 }
-PG_FUNCTION_INFO_V1(dt_sample_within_range);
+PG_FUNCTION_INFO_V1(dt_poisson_weight);
 
 
 /*
@@ -1,8 +1,13 @@
 #include <postgres.h>
-#include <nodes/memnodes.h>
 #include <utils/builtins.h>
 #include <utils/memutils.h>
 #include <math.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8) \
+        || defined(__clang__))
+#define KMEANS_HAVE_AVX2
+#include <immintrin.h>
+#endif
 #include "../../../svec/src/pg_gp/sparse_vector.h"
 #include "../../../svec/src/pg_gp/operators.h"
 
@@ -43,65 +48,324 @@ get_svec_array_elms(ArrayType *inArrayType, Datum **outSvecArr, int *outLen)
 }
 
 
+typedef double (*SvecMetricFn)(SvecType *, SvecType *);
+
+/*
+ * The svec distance kernels walk both RLE streams directly and allocate
+ * nothing, so they are called here without going through the fmgr.
+ */
 static
 inline
-PGFunction
-get_metric_fn(KMeansMetric inMetric)
+SvecMetricFn
+get_svec_metric_fn(KMeansMetric inMetric)
 {
-    PGFunction metrics[] = {
-            svec_svec_l1norm,
-            svec_svec_l2norm,
-            svec_svec_angle,
-            svec_svec_tanimoto_distance
+    SvecMetricFn metrics[] = {
+            svec_svec_l1dist_internal,
+            svec_svec_l2dist_internal,
+            svec_svec_angle_internal,
+            svec_svec_tanimoto_distance_internal
         };
     
-    if (inMetric < 1 || inMetric > sizeof(metrics)/sizeof(PGFunction))
+    if (inMetric < 1 || inMetric > sizeof(metrics)/sizeof(SvecMetricFn))
         ereport(ERROR,
                 (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                  errmsg("invalid metric")));
     return metrics[inMetric - 1];
 }
 
+/*
+ * Canopy index
+ *
+ * Canopy seeding compares points against all canopy centers found so far.
+ * To keep this fast when thousands of canopies are produced, centers are
+ * indexed by their distances to a few pivots, which are simply the first
+ * centers. For a metric, |d(p, pivot) - d(c, pivot)| <= d(p, c), so center c
+ * can only be closer to point p than the threshold if all its pivot distances
+ * are within the threshold of those of p. Centers are kept sorted by their
+ * distance to the first pivot, which turns the candidates into a range found
+ * by binary search. The other pivots filter that range further before any
+ * distance between p and a center is computed.
+ *
+ * Tanimoto distance does not satisfy the triangle inequality, so for it the
+ * index is a plain linear scan.
+ */
+#define CANOPY_NUM_PIVOTS 4
+
+/* Absorbs rounding errors when comparing pivot distance bounds */
+#define CANOPY_SLACK(d) (1e-9 * (1. + fabs(d)))
+
+typedef struct {
+    SvecMetricFn    metric_fn;
+    bool            prune;          /* metric obeys the triangle inequality */
+    int             num_centers;
+    int             capacity;
+    SvecType      **centers;
+    float8         *pivot_dists;    /* CANOPY_NUM_PIVOTS per center */
+    int            *order;          /* centers sorted by distance to pivot 0 */
+} CanopyIndex;
+
 static
-inline
-double
-compute_metric(PGFunction inMetricFn, MemoryContext inMemContext, Datum inVec1,
-    Datum inVec2) {
-    
-    float8          distance;
+void
+canopy_index_init(CanopyIndex *outIndex, KMeansMetric inMetric, int inCapacity)
+{
+    outIndex->metric_fn = get_svec_metric_fn(inMetric);
+    outIndex->prune = (inMetric != TANIMOTO);
+    outIndex->num_centers = 0;
+    outIndex->capacity = Max(inCapacity, 16);
+    outIndex->centers = (SvecType **)
+        palloc(sizeof(SvecType *) * outIndex->capacity);
+    outIndex->pivot_dists = (float8 *)
+        palloc(sizeof(float8) * CANOPY_NUM_PIVOTS * outIndex->capacity);
+    outIndex->order = (int *) palloc(sizeof(int) * outIndex->capacity);
+}
+
+/*
+ * Adds a center to the index. The index keeps the pointer, so the center
+ * must live at least as long as the index. Allocates in CurrentMemoryContext
+ * when growing.
+ */
+static
+void
+canopy_index_add(CanopyIndex *ioIndex, SvecType *inCenter)
+{
+    int     id = ioIndex->num_centers;
+    float8 *dists;
+    int     lo, hi;
+
+    if (id == ioIndex->capacity) {
+        ioIndex->capacity *= 2;
+        ioIndex->centers = (SvecType **) repalloc(ioIndex->centers,
+            sizeof(SvecType *) * ioIndex->capacity);
+        ioIndex->pivot_dists = (float8 *) repalloc(ioIndex->pivot_dists,
+            sizeof(float8) * CANOPY_NUM_PIVOTS * ioIndex->capacity);
+        ioIndex->order = (int *) repalloc(ioIndex->order,
+            sizeof(int) * ioIndex->capacity);
+    }
+    ioIndex->centers[id] = inCenter;
+    ioIndex->num_centers++;
+    if (!ioIndex->prune)
+        return;
+
+    /* distances to the existing pivots */
+    dists = ioIndex->pivot_dists + id * CANOPY_NUM_PIVOTS;
+    for (int k = 0; k < Min(id, CANOPY_NUM_PIVOTS); k++)
+        dists[k] = (*ioIndex->metric_fn)(inCenter, ioIndex->centers[k]);
+
+    /* a new pivot needs its distance to all (earlier) centers */
+    if (id < CANOPY_NUM_PIVOTS) {
+        dists[id] = 0.;
+        for (int j = 0; j < id; j++)
+            ioIndex->pivot_dists[j * CANOPY_NUM_PIVOTS + id] =
+                ioIndex->pivot_dists[id * CANOPY_NUM_PIVOTS + j];
+    }
+
+    /* insert into the order by distance to pivot 0 */
+    lo = 0;
+    hi = id;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ioIndex->pivot_dists[ioIndex->order[mid] * CANOPY_NUM_PIVOTS]
+                <= dists[0])
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    memmove(ioIndex->order + lo + 1, ioIndex->order + lo,
+        sizeof(int) * (id - lo));
+    ioIndex->order[lo] = id;
+}
+
+/*
+ * Finds the centers closer to inPoint than inThreshold. If outIds is NULL,
+ * stops at the first one and returns 1 if there is one, 0 otherwise. Else,
+ * stores the (0-based) ids of all close centers in outIds, in no particular
+ * order, and returns their number.
+ */
+static
+int
+canopy_index_search(CanopyIndex *inIndex, SvecType *inPoint,
+    float8 inThreshold, int *outIds)
+{
+    float8  pd[CANOPY_NUM_PIVOTS];
+    int     num_pivots = Min(inIndex->num_centers, CANOPY_NUM_PIVOTS);
+    int     num_found = 0;
+    int     lo, hi;
+
+    if (!inIndex->prune) {
+        for (int i = 0; i < inIndex->num_centers; i++) {
+            if ((*inIndex->metric_fn)(inPoint, inIndex->centers[i])
+                    < inThreshold) {
+                if (outIds == NULL)
+                    return 1;
+                outIds[num_found++] = i;
+            }
+        }
+        return num_found;
+    }
+
+    for (int k = 0; k < num_pivots; k++) {
+        pd[k] = (*inIndex->metric_fn)(inPoint, inIndex->centers[k]);
+        if (pd[k] < inThreshold) {
+            if (outIds == NULL)
+                return 1;
+            outIds[num_found++] = k;
+        }
+    }
+    if (inIndex->num_centers <= num_pivots)
+        return num_found;
+
+    /* first center whose distance to pivot 0 is in range */
+    lo = 0;
+    hi = inIndex->num_centers;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (inIndex->pivot_dists[inIndex->order[mid] * CANOPY_NUM_PIVOTS]
+                < pd[0] - inThreshold - CANOPY_SLACK(pd[0]))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (int i = lo; i < inIndex->num_centers; i++) {
+        int     c = inIndex->order[i];
+        float8 *dists = inIndex->pivot_dists + c * CANOPY_NUM_PIVOTS;
+        bool    candidate = true;
+
+        if (dists[0] > pd[0] + inThreshold + CANOPY_SLACK(pd[0]))
+            break;
+        if (c < num_pivots)
+            continue;
+        for (int k = 1; k < num_pivots; k++) {
+            if (fabs(pd[k] - dists[k]) > inThreshold + CANOPY_SLACK(pd[k])) {
+                candidate = false;
+                break;
+            }
+        }
+        if (candidate
+                && (*inIndex->metric_fn)(inPoint, inIndex->centers[c])
+                    < inThreshold) {
+            if (outIds == NULL)
+                return 1;
+            outIds[num_found++] = c;
+        }
+    }
+    return num_found;
+}
+
+/*
+ * Compares the contents of two svecs. The svec distance kernels store
+ * pointers into the StringInfo headers of their arguments (see
+ * sdata_from_svec()), so an svec that has been passed to them no longer has
+ * the same bytes as an identical copy. Only the dimension, the counts, the
+ * values, and the run lengths are compared.
+ */
+static
+bool
+svec_payload_equal(SvecType *inA, SvecType *inB)
+{
+    return inA->dimension == inB->dimension
+        && SVEC_UNIQUE_VALCNT(inA) == SVEC_UNIQUE_VALCNT(inB)
+        && SVEC_TOTAL_VALCNT(inA) == SVEC_TOTAL_VALCNT(inB)
+        && SVEC_DATA_SIZE(inA) == SVEC_DATA_SIZE(inB)
+        && SVEC_INDEX_SIZE(inA) == SVEC_INDEX_SIZE(inB)
+        && memcmp(SVEC_VALS_PTR(inA), SVEC_VALS_PTR(inB),
+            SVEC_DATA_SIZE(inA)) == 0
+        && memcmp(SVEC_INDEX_PTR(inA), SVEC_INDEX_PTR(inB),
+            SVEC_INDEX_SIZE(inA)) == 0;
+}
+
+/*
+ * Index over the canopies of an array, cached across calls in fn_extra.
+ * Everything is allocated in fn_mcxt. The centers either point into a copy
+ * of the whole array, or (for the growing transition state) are copied one
+ * by one.
+ */
+typedef struct {
+    CanopyIndex     index;
+    KMeansMetric    metric;
+    ArrayType      *array;      /* copy of the indexed array, or NULL */
+    Size            state_size; /* size of the transition state returned last */
+    Size            adopt_size; /* size of the transition state to index next */
+} CanopyCache;
+
+static
+CanopyCache *
+canopy_cache_build(FmgrInfo *flinfo, ArrayType *inArray, bool inCopyArray,
+    KMeansMetric inMetric)
+{
+    CanopyCache    *cache = (CanopyCache *) flinfo->fn_extra;
     MemoryContext   oldContext;
-    
-    oldContext = MemoryContextSwitchTo(inMemContext);
-    
-    distance = DatumGetFloat8(DirectFunctionCall2(inMetricFn, inVec1, inVec2));
-    
-#ifdef GP_VERSION_NUM
-    /*
-     * Once the direct function calls have leaked enough memory, let's do some
-     * garbage collection...
-     * The 50k bound here is arbitrary, and motivated by ResetExprContext()
-     * in execUtils.c
-     */
-    if(inMemContext->allBytesAlloc - inMemContext->allBytesFreed > 50000)
-        MemoryContextReset(inMemContext);
-#else
-    /* PostgreSQL does not have the allBytesAlloc and allBytesFreed fields */
-    MemoryContextReset(inMemContext);
-#endif
-    
-    MemoryContextSwitchTo(oldContext);    
-    return distance;
+    Datum          *canopies;
+    int             num_canopies;
+
+    oldContext = MemoryContextSwitchTo(flinfo->fn_mcxt);
+    if (cache != NULL) {
+        if (cache->array != NULL)
+            pfree(cache->array);
+        else
+            for (int i = 0; i < cache->index.num_centers; i++)
+                pfree(cache->index.centers[i]);
+        pfree(cache->index.centers);
+        pfree(cache->index.pivot_dists);
+        pfree(cache->index.order);
+    } else {
+        cache = (CanopyCache *) palloc(sizeof(CanopyCache));
+        flinfo->fn_extra = cache;
+    }
+    cache->metric = inMetric;
+    cache->state_size = 0;
+    cache->adopt_size = 0;
+
+    if (inCopyArray) {
+        cache->array = (ArrayType *) palloc(VARSIZE(inArray));
+        memcpy(cache->array, inArray, VARSIZE(inArray));
+        inArray = cache->array;
+    } else
+        cache->array = NULL;
+
+    get_svec_array_elms(inArray, &canopies, &num_canopies);
+    canopy_index_init(&cache->index, inMetric, num_canopies);
+    for (int i = 0; i < num_canopies; i++) {
+        SvecType *center = (SvecType *) DatumGetPointer(canopies[i]);
+
+        if (!inCopyArray) {
+            SvecType *copy = (SvecType *) palloc(VARSIZE(center));
+            memcpy(copy, center, VARSIZE(center));
+            center = copy;
+        }
+        canopy_index_add(&cache->index, center);
+    }
+    pfree(canopies);
+    MemoryContextSwitchTo(oldContext);
+    return cache;
+}
+
+/*
+ * Returns whether the centers of the cached index have the same contents as
+ * the elements of inArray, in the same order.
+ */
+static
+bool
+canopy_cache_matches(CanopyCache *inCache, ArrayType *inArray)
+{
+    Datum          *canopies;
+    int             num_canopies;
+    bool            equal;
+
+    get_svec_array_elms(inArray, &canopies, &num_canopies);
+    equal = (num_canopies == inCache->index.num_centers);
+    for (int i = 0; equal && i < num_canopies; i++)
+        equal = svec_payload_equal(inCache->index.centers[i],
+            (SvecType *) DatumGetPointer(canopies[i]));
+    pfree(canopies);
+    return equal;
 }
 
 static
-MemoryContext
-setup_mem_context_for_functional_calls() {
-    MemoryContext ctxt = AllocSetContextCreate(CurrentMemoryContext,
-        "kMeansMetricFnCalls",
-        ALLOCSET_DEFAULT_MINSIZE,
-        ALLOCSET_DEFAULT_INITSIZE,
-        ALLOCSET_DEFAULT_MAXSIZE);
-    return ctxt;
+int
+int_cmp(const void *inA, const void *inB)
+{
+    return *(const int *) inA - *(const int *) inB;
 }
 
 PG_FUNCTION_INFO_V1(internal_get_array_of_close_canopies);
@@ -109,32 +373,35 @@ Datum
 internal_get_array_of_close_canopies(PG_FUNCTION_ARGS)
 {
     SvecType       *svec;
-    Datum          *all_canopies;
-    int             num_all_canopies;
+    ArrayType      *all_canopies_arr;
     float8          threshold;
-    PGFunction      metric_fn;
+    KMeansMetric    metric;
+    CanopyCache    *cache;
     
     ArrayType      *close_canopies_arr;
     int4           *close_canopies;
     int             num_close_canopies;
     size_t          bytes;
-    MemoryContext   mem_context_for_function_calls;
     
     svec = PG_GETARG_SVECTYPE_P(verify_arg_nonnull(fcinfo, 0));
-    get_svec_array_elms(PG_GETARG_ARRAYTYPE_P(verify_arg_nonnull(fcinfo, 1)),
-        &all_canopies, &num_all_canopies);
+    all_canopies_arr = PG_GETARG_ARRAYTYPE_P(verify_arg_nonnull(fcinfo, 1));
     threshold = PG_GETARG_FLOAT8(verify_arg_nonnull(fcinfo, 2));
-    metric_fn = get_metric_fn(PG_GETARG_INT32(verify_arg_nonnull(fcinfo, 3)));
+    metric = PG_GETARG_INT32(verify_arg_nonnull(fcinfo, 3));
     
-    mem_context_for_function_calls = setup_mem_context_for_functional_calls();
-    close_canopies = (int4 *) palloc(sizeof(int4) * num_all_canopies);
-    num_close_canopies = 0;
-    for (int i = 0; i < num_all_canopies; i++) {
-        if (compute_metric(metric_fn, mem_context_for_function_calls,
-                PointerGetDatum(svec), all_canopies[i]) < threshold)
-            close_canopies[num_close_canopies++] = i + 1 /* lower bound */;
-    }
-    MemoryContextDelete(mem_context_for_function_calls);
+    /* The array of all canopies is the same for every point, so its index is
+     * only built once. We compare the contents because the array may be
+     * detoasted into a fresh copy on every call. */
+    cache = (CanopyCache *) fcinfo->flinfo->fn_extra;
+    if (cache == NULL || cache->metric != metric || cache->array == NULL
+        || VARSIZE(cache->array) != VARSIZE(all_canopies_arr)
+        || !canopy_cache_matches(cache, all_canopies_arr))
+        cache = canopy_cache_build(fcinfo->flinfo, all_canopies_arr, true,
+            metric);
+
+    close_canopies = (int4 *) palloc(sizeof(int4)
+        * Max(cache->index.num_centers, 1));
+    num_close_canopies = canopy_index_search(&cache->index, svec, threshold,
+        close_canopies);
 
     /* If we cannot find any close canopy, return NULL. Note that the result
      * we return will be passed to internal_kmeans_closest_centroid() and if the
@@ -143,6 +410,11 @@ internal_get_array_of_close_canopies(PG_FUNCTION_ARGS)
     if (num_close_canopies == 0)
         PG_RETURN_NULL();
 
+    /* the index reports canopies in no particular order */
+    qsort(close_canopies, num_close_canopies, sizeof(int4), int_cmp);
+    for (int i = 0; i < num_close_canopies; i++)
+        close_canopies[i] += 1 /* lower bound */;
+
     bytes = ARR_OVERHEAD_NONULLS(1) + sizeof(int4) * num_close_canopies;
     close_canopies_arr = (ArrayType *) palloc0(bytes);
     SET_VARSIZE(close_canopies_arr, bytes);
@@ -156,132 +428,274 @@ internal_get_array_of_close_canopies(PG_FUNCTION_ARGS)
     PG_RETURN_ARRAYTYPE_P(close_canopies_arr);
 }
 
-static float8 calc_l2norm_distance(float8* array1, float8* array2, int32 dimension)
+/*
+ * Dense distance kernels
+ *
+ * internal_kmeans_closest_centroid() is the inner loop of k-means. All its
+ * metrics reduce to three primitives over float8 arrays: the L1 distance, the
+ * squared L2 distance and the dot product. Each primitive has a portable
+ * version and, on x86 with GCC or Clang, an AVX2 version that is chosen at
+ * runtime if the CPU supports it. Both use several independent accumulators
+ * so that consecutive additions do not wait for each other.
+ */
+typedef float8 (*KMeansKernelFn)(const float8 *, const float8 *, int32);
+
+typedef struct {
+    KMeansKernelFn  l1dist;
+    KMeansKernelFn  l2dist_sq;
+    KMeansKernelFn  dot;
+} KMeansKernels;
+
+static
+float8
+portable_l1dist(const float8 *inX, const float8 *inY, int32 inLen)
 {
-    if( array1 == NULL || array2 == NULL )
-    {
-        elog(ERROR, "In %s, arrays should not be NULL", __FUNCTION__);
-    }
-    
-    float8 distance =0;
-    for(int index=0; index<dimension; index++)
-    {
-        float8 temp_val = array1[index]-array2[index];
-        distance += temp_val*temp_val;
+    float8  s0 = 0., s1 = 0., s2 = 0., s3 = 0.;
+    int32   i;
+
+    for (i = 0; i + 4 <= inLen; i += 4) {
+        s0 += fabs(inX[i] - inY[i]);
+        s1 += fabs(inX[i + 1] - inY[i + 1]);
+        s2 += fabs(inX[i + 2] - inY[i + 2]);
+        s3 += fabs(inX[i + 3] - inY[i + 3]);
     }
-    distance = sqrt(distance);
-    return distance;
+    for (; i < inLen; i++)
+        s0 += fabs(inX[i] - inY[i]);
+    return (s0 + s1) + (s2 + s3);
 }
 
-
-static float8 calc_l1norm_distance(float8* array1, float8* array2, int32 dimension)
+static
+float8
+portable_l2dist_sq(const float8 *inX, const float8 *inY, int32 inLen)
 {
-    if( array1 == NULL || array2 == NULL )
-    {
-        elog(ERROR, "In %s, arrays should not be NULL", __FUNCTION__);
+    float8  s0 = 0., s1 = 0., s2 = 0., s3 = 0.;
+    float8  d0, d1, d2, d3;
+    int32   i;
+
+    for (i = 0; i + 4 <= inLen; i += 4) {
+        d0 = inX[i] - inY[i];
+        d1 = inX[i + 1] - inY[i + 1];
+        d2 = inX[i + 2] - inY[i + 2];
+        d3 = inX[i + 3] - inY[i + 3];
+        s0 += d0 * d0;
+        s1 += d1 * d1;
+        s2 += d2 * d2;
+        s3 += d3 * d3;
     }
-    
-    float8 distance =0;
-    for(int index=0; index<dimension; index++)
-    {
-        float8 temp_val = array1[index]-array2[index];
-        distance += fabs(temp_val);
+    for (; i < inLen; i++) {
+        d0 = inX[i] - inY[i];
+        s0 += d0 * d0;
     }
-    return distance;
+    return (s0 + s1) + (s2 + s3);
 }
 
-
-static float8 calc_dot_product(float8* array1, float8* array2, int32 dimension)
+static
+float8
+portable_dot(const float8 *inX, const float8 *inY, int32 inLen)
 {
-    float8 val =0;
-    for(int index=0; index<dimension; index++)
-    {
-        val += array1[index]*array2[index];
+    float8  s0 = 0., s1 = 0., s2 = 0., s3 = 0.;
+    int32   i;
+
+    for (i = 0; i + 4 <= inLen; i += 4) {
+        s0 += inX[i] * inY[i];
+        s1 += inX[i + 1] * inY[i + 1];
+        s2 += inX[i + 2] * inY[i + 2];
+        s3 += inX[i + 3] * inY[i + 3];
     }
-    return val;
+    for (; i < inLen; i++)
+        s0 += inX[i] * inY[i];
+    return (s0 + s1) + (s2 + s3);
 }
 
-static float8 calc_l2norm_val(float8* array, int32 dimension)
+#ifdef KMEANS_HAVE_AVX2
+__attribute__((target("avx2")))
+static
+inline
+float8
+avx2_hsum(__m256d inSum)
 {
-    float8 val =0;
-    for(int index=0; index<dimension; index++)
-    {
-        val += array[index]*array[index];
-    }
-    return sqrt(val);
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(inSum),
+        _mm256_extractf128_pd(inSum, 1));
+
+    return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
 }
 
-static float8 calc_cosine_distance(float8* array1, float8* array2, int32 dimension)
+__attribute__((target("avx2")))
+static
+float8
+avx2_l1dist(const float8 *inX, const float8 *inY, int32 inLen)
 {
-    if( array1 == NULL || array2 == NULL )
-    {
-        elog(ERROR, "In %s, arrays should not be NULL", __FUNCTION__);
+    const __m256d   signMask = _mm256_set1_pd(-0.);
+    __m256d         s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    float8          sum;
+    int32           i;
+
+    for (i = 0; i + 8 <= inLen; i += 8) {
+        s0 = _mm256_add_pd(s0, _mm256_andnot_pd(signMask,
+            _mm256_sub_pd(_mm256_loadu_pd(inX + i), _mm256_loadu_pd(inY + i))));
+        s1 = _mm256_add_pd(s1, _mm256_andnot_pd(signMask,
+            _mm256_sub_pd(_mm256_loadu_pd(inX + i + 4),
+                _mm256_loadu_pd(inY + i + 4))));
     }
-    
-    float8 dot_product = calc_dot_product(array1, array2, dimension);
-    float8 array1_l2norm = calc_l2norm_val(array1, dimension);
-    float8 array2_l2norm = calc_l2norm_val(array2, dimension);
+    sum = avx2_hsum(_mm256_add_pd(s0, s1));
+    for (; i < inLen; i++)
+        sum += fabs(inX[i] - inY[i]);
+    return sum;
+}
 
-    float8 distance = dot_product/(array1_l2norm*array2_l2norm);
+__attribute__((target("avx2")))
+static
+float8
+avx2_l2dist_sq(const float8 *inX, const float8 *inY, int32 inLen)
+{
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    __m256d d0, d1;
+    float8  sum, d;
+    int32   i;
 
-    if (distance > 1.0) 
-    {
-        distance = 1.0;
+    for (i = 0; i + 8 <= inLen; i += 8) {
+        d0 = _mm256_sub_pd(_mm256_loadu_pd(inX + i), _mm256_loadu_pd(inY + i));
+        d1 = _mm256_sub_pd(_mm256_loadu_pd(inX + i + 4),
+            _mm256_loadu_pd(inY + i + 4));
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(d0, d0));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(d1, d1));
     }
-    else if (distance < -1.0) 
-    {
-        distance = -1.0;
+    sum = avx2_hsum(_mm256_add_pd(s0, s1));
+    for (; i < inLen; i++) {
+        d = inX[i] - inY[i];
+        sum += d * d;
     }
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static
+float8
+avx2_dot(const float8 *inX, const float8 *inY, int32 inLen)
+{
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    float8  sum;
+    int32   i;
 
-    return acos(distance);
+    for (i = 0; i + 8 <= inLen; i += 8) {
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(inX + i),
+            _mm256_loadu_pd(inY + i)));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(inX + i + 4),
+            _mm256_loadu_pd(inY + i + 4)));
+    }
+    sum = avx2_hsum(_mm256_add_pd(s0, s1));
+    for (; i < inLen; i++)
+        sum += inX[i] * inY[i];
+    return sum;
 }
+#endif /* KMEANS_HAVE_AVX2 */
+
+static
+const KMeansKernels *
+get_kmeans_kernels(void)
+{
+    static const KMeansKernels portable = {
+        portable_l1dist, portable_l2dist_sq, portable_dot
+    };
+#ifdef KMEANS_HAVE_AVX2
+    static const KMeansKernels avx2 = {
+        avx2_l1dist, avx2_l2dist_sq, avx2_dot
+    };
 
+    if (__builtin_cpu_supports("avx2"))
+        return &avx2;
+#endif
+    return &portable;
+}
 
-static float8 calc_tanimoto_distance(float8* array1, float8* array2, int32 dimension)
+/*
+ * State of internal_kmeans_closest_centroid() kept in fn_extra. During one
+ * k-means iteration, the function is called for every point with the same
+ * centroids, so the centroid norms needed by the cosine and tanimoto metrics
+ * are computed only once. A copy of the centroids tells whether they are
+ * still valid. Comparing it is much cheaper than recomputing the norms.
+ */
+typedef struct {
+    const KMeansKernels *kernels;
+    KMeansMetric    metric;
+    int             len;            /* number of elements of centroids */
+    float8         *centroids;      /* NULL if the metric needs no norms */
+    float8         *norms;
+} CentroidCache;
+
+static
+CentroidCache *
+get_centroid_cache(FmgrInfo *flinfo, KMeansMetric inMetric,
+    const float8 *inCentroids, int inNumCentroids, int inDimension)
 {
-    if( array1 == NULL || array2 == NULL )
-    {
-        elog(ERROR, "In %s, arrays should not be NULL", __FUNCTION__);
-    }
-    
-    float8 dot_product = calc_dot_product(array1, array2, dimension);
-    float8 array1_l2norm = calc_l2norm_val(array1, dimension);
-    float8 array2_l2norm = calc_l2norm_val(array2, dimension);
-    
-    float8 denominator = array1_l2norm*array1_l2norm+
-        array2_l2norm*array2_l2norm-dot_product;
-    float8 distance = dot_product/denominator;
+    CentroidCache  *cache = (CentroidCache *) flinfo->fn_extra;
+    int             len = inNumCentroids * inDimension;
 
-    if (distance > 1.0) 
-    {
-        distance = 1.0;
+    if (cache == NULL) {
+        cache = (CentroidCache *)
+            MemoryContextAllocZero(flinfo->fn_mcxt, sizeof(CentroidCache));
+        cache->kernels = get_kmeans_kernels();
+        flinfo->fn_extra = cache;
     }
-    else if (distance < 0) 
-    {
-        distance = 0;
+    if (inMetric != COSINE && inMetric != TANIMOTO) {
+        cache->metric = inMetric;
+        return cache;
     }
+    if (cache->metric == inMetric && cache->centroids != NULL
+            && cache->len == len
+            && memcmp(cache->centroids, inCentroids, sizeof(float8) * len) == 0)
+        return cache;
 
-    return 1. - distance;
+    if (cache->centroids != NULL) {
+        pfree(cache->centroids);
+        pfree(cache->norms);
+    }
+    cache->metric = inMetric;
+    cache->len = len;
+    cache->centroids = (float8 *)
+        MemoryContextAlloc(flinfo->fn_mcxt, sizeof(float8) * len);
+    memcpy(cache->centroids, inCentroids, sizeof(float8) * len);
+    cache->norms = (float8 *)
+        MemoryContextAlloc(flinfo->fn_mcxt, sizeof(float8) * inNumCentroids);
+    for (int i = 0; i < inNumCentroids; i++) {
+        const float8 *centroid = inCentroids + i * inDimension;
+
+        cache->norms[i] = sqrt(
+            (*cache->kernels->dot)(centroid, centroid, inDimension));
+    }
+    return cache;
 }
 
-typedef float8  (*MetricFunc)(float8*, float8*, int32);
+/*
+ * Distance between a point and centroid cid, up to a strictly increasing
+ * transformation: Only the closest centroid is of interest, so the square
+ * root of the L2 distance and the arc cosine of the cosine distance are
+ * skipped.
+ */
 static
 inline
-MetricFunc
-get_metric_fn_for_array(KMeansMetric inMetric)
+float8
+centroid_distance(const CentroidCache *inCache, const float8 *inCentroid,
+    int inCid, const float8 *inPoint, float8 inPointNorm, int32 inDimension)
 {
-    MetricFunc metrics[] = {
-            calc_l1norm_distance,
-            calc_l2norm_distance,
-            calc_cosine_distance,
-            calc_tanimoto_distance
-        };
-    
-    if (inMetric < 1 || inMetric > sizeof(metrics)/sizeof(PGFunction))
-        ereport(ERROR,
-                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                 errmsg("invalid metric")));
-    return metrics[inMetric - 1];
+    const KMeansKernels *kernels = inCache->kernels;
+    float8          dot, norm, similarity;
+
+    switch (inCache->metric) {
+        case L1NORM:
+            return (*kernels->l1dist)(inCentroid, inPoint, inDimension);
+        case L2NORM:
+            return (*kernels->l2dist_sq)(inCentroid, inPoint, inDimension);
+        case COSINE:
+            dot = (*kernels->dot)(inCentroid, inPoint, inDimension);
+            similarity = dot / (inCache->norms[inCid] * inPointNorm);
+            return -Max(-1., Min(1., similarity));
+        default: /* TANIMOTO */
+            dot = (*kernels->dot)(inCentroid, inPoint, inDimension);
+            norm = inCache->norms[inCid];
+            similarity = dot / (norm * norm + inPointNorm * inPointNorm - dot);
+            return 1. - Max(0., Min(1., similarity));
+    }
 }
 
 PG_FUNCTION_INFO_V1(internal_kmeans_closest_centroid);
@@ -293,6 +707,8 @@ internal_kmeans_closest_centroid(PG_FUNCTION_ARGS) {
     float8          distance, min_distance = INFINITY;
     int             closest_centroid = 0;
     int             cid;
+    CentroidCache  *cache;
+    float8          point_norm = 0.;
 
     point_array = PG_GETARG_ARRAYTYPE_P(verify_arg_nonnull(fcinfo, 0));
     float8* c_point_array = (float8 *)ARR_DATA_PTR(point_array);
@@ -370,13 +786,24 @@ internal_kmeans_closest_centroid(PG_FUNCTION_ARGS) {
                     centroids_array_len, array_length)));
     }
 
+    if (dist_metric < L1NORM || dist_metric > TANIMOTO)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("invalid metric")));
+    cache = get_centroid_cache(fcinfo->flinfo, dist_metric,
+        c_centroids_array, centroids_array_len / dimension,
+        dimension);
+    if (dist_metric == COSINE || dist_metric == TANIMOTO)
+        point_norm = sqrt((*cache->kernels->dot)(c_point_array, c_point_array,
+            dimension));
+
     for (int i = 0; i< num_of_centroids; i++) 
     {
         cid = indirect ? canopy_ids[i] - ARR_LBOUND(canopy_ids_arr)[0] : i;
-	    double * centroid = c_centroids_array+cid*dimension;
+        double * centroid = c_centroids_array+cid*dimension;
         
-        MetricFunc func = get_metric_fn_for_array(dist_metric);
-        distance = (*func)(centroid, c_point_array, dimension);
+        distance = centroid_distance(cache, centroid, cid, c_point_array,
+            point_norm, dimension);
 
         if (distance < min_distance) {
             closest_centroid = cid;
@@ -396,7 +823,6 @@ internal_kmeans_agg_centroid_trans(PG_FUNCTION_ARGS) {
     int32           dimension;
     int32           num_of_centroids;
     int32           centroid_index;
-    bool            rebuild_array = false;
     int32           expected_array_len;
     
     float8          *c_array = NULL;
@@ -452,8 +878,16 @@ internal_kmeans_agg_centroid_trans(PG_FUNCTION_ARGS) {
 
     if (PG_ARGISNULL(0))
     {
-        c_array = palloc0(expected_array_len*sizeof(float8));
-        rebuild_array = true;
+        /* Allocate the (zeroed) state array once and fill it in place */
+        int bytes = ARR_OVERHEAD_NONULLS(1)
+            + sizeof(float8) * expected_array_len;
+
+        array = (ArrayType *) palloc0(bytes);
+        SET_VARSIZE(array, bytes);
+        ARR_ELEMTYPE(array) = FLOAT8OID;
+        ARR_NDIM(array) = 1;
+        ARR_DIMS(array)[0] = expected_array_len;
+        ARR_LBOUND(array)[0] = 1;
     }
     else
     {
@@ -475,9 +909,8 @@ internal_kmeans_agg_centroid_trans(PG_FUNCTION_ARGS) {
                         format_procedure(fcinfo->flinfo->fn_oid), 
                         expected_array_len, array_length)));
         }
-        c_array = (float8 *)ARR_DATA_PTR(array);
     }
-    
+    c_array = (float8 *)ARR_DATA_PTR(array);
     
     float8 * data_ptr = c_array+(centroid_index-1)*dimension;
     for(int index=0; index<dimension; index++)
@@ -485,19 +918,6 @@ internal_kmeans_agg_centroid_trans(PG_FUNCTION_ARGS) {
         data_ptr[index] = c_cent_array[index];
     }
     
-    if (rebuild_array)
-    {
-        /* construct a new array to keep the aggr states. */
-        array =
-        	construct_array(
-        		(Datum *)c_array,
-                expected_array_len,
-                FLOAT8OID,
-                sizeof(float8),
-                true,
-                'd'
-                );
-    }
     PG_RETURN_ARRAYTYPE_P(array);
 }
 
@@ -547,33 +967,64 @@ PG_FUNCTION_INFO_V1(internal_kmeans_canopy_transition);
 Datum
 internal_kmeans_canopy_transition(PG_FUNCTION_ARGS) {
     ArrayType      *canopies_arr;
-    Datum          *canopies;
+    ArrayType      *result;
     int             num_canopies;
     SvecType       *point;
-    PGFunction      metric_fn;
+    KMeansMetric    metric;
     float8          threshold;
-
-    MemoryContext   mem_context_for_function_calls;
+    CanopyCache    *cache;
+    bool            indexed;
+    bool            found;
     
     canopies_arr = PG_GETARG_ARRAYTYPE_P(verify_arg_nonnull(fcinfo, 0));
-    get_svec_array_elms(canopies_arr, &canopies, &num_canopies);
     point = PG_GETARG_SVECTYPE_P(verify_arg_nonnull(fcinfo, 1));
-    metric_fn = get_metric_fn(PG_GETARG_INT32(verify_arg_nonnull(fcinfo, 2)));
+    metric = PG_GETARG_INT32(verify_arg_nonnull(fcinfo, 2));
     threshold = PG_GETARG_FLOAT8(verify_arg_nonnull(fcinfo, 3));
-    
-    mem_context_for_function_calls = setup_mem_context_for_functional_calls();
-    for (int i = 0; i < num_canopies; i++) {
-        if (compute_metric(metric_fn, mem_context_for_function_calls,
-            PointerGetDatum(point), canopies[i]) < threshold)
-            PG_RETURN_ARRAYTYPE_P(canopies_arr);
+    num_canopies = (ARR_NDIM(canopies_arr) == 0)
+        ? 0 : ARR_DIMS(canopies_arr)[0];
+
+    /*
+     * The index over the canopies lives in fn_extra and grows along with the
+     * transition state. It is valid if we are handed back the state we
+     * returned last. The executor copies a new state into the aggregate
+     * context, so we cannot go by its address. Instead, every center of the
+     * state must equal the indexed one, which is much cheaper than computing
+     * the distances to them. Otherwise, e.g., when several groups alternate,
+     * a state is only indexed if it comes back on the next call; until then
+     * we fall back to a linear scan.
+     */
+    cache = (CanopyCache *) fcinfo->flinfo->fn_extra;
+    indexed = cache != NULL && cache->metric == metric
+        && cache->state_size == VARSIZE(canopies_arr)
+        && cache->index.num_centers == num_canopies
+        && canopy_cache_matches(cache, canopies_arr);
+    if (!indexed
+        && (cache == NULL || cache->adopt_size == VARSIZE(canopies_arr))) {
+        cache = canopy_cache_build(fcinfo->flinfo, canopies_arr, false,
+            metric);
+        indexed = true;
     }
-    MemoryContextDelete(mem_context_for_function_calls);
-    
-    int idx = (ARR_NDIM(canopies_arr) == 0)
-        ? 1
-        : ARR_LBOUND(canopies_arr)[0] + ARR_DIMS(canopies_arr)[0];
-    return PointerGetDatum(
-        array_set(
+
+    found = false;
+    if (indexed)
+        found = canopy_index_search(&cache->index, point, threshold, NULL);
+    else {
+        SvecMetricFn    metric_fn = get_svec_metric_fn(metric);
+        Datum          *canopies;
+
+        get_svec_array_elms(canopies_arr, &canopies, &num_canopies);
+        for (int i = 0; i < num_canopies && !found; i++)
+            found = (*metric_fn)(point,
+                (SvecType *) DatumGetPointer(canopies[i])) < threshold;
+    }
+
+    if (found)
+        result = canopies_arr;
+    else {
+        int idx = (ARR_NDIM(canopies_arr) == 0)
+            ? 1
+            : ARR_LBOUND(canopies_arr)[0] + ARR_DIMS(canopies_arr)[0];
+        result = array_set(
             canopies_arr, /* array: the initial array object (mustn't be NULL) */
             1, /* nSubscripts: number of subscripts supplied */
             &idx, /* indx[]: the subscript values */
@@ -582,8 +1033,25 @@ internal_kmeans_canopy_transition(PG_FUNCTION_ARGS) {
             -1, /* arraytyplen: pg_type.typlen for the array type */
             -1, /* elmlen: pg_type.typlen for the array's element type */
             false, /* elmbyval: pg_type.typbyval for the array's element type */
-            'd') /* elmalign: pg_type.typalign for the array's element type */
-        );
+            'd'); /* elmalign: pg_type.typalign for the array's element type */
+
+        if (indexed) {
+            MemoryContext   oldContext;
+            SvecType       *copy;
+
+            oldContext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+            copy = (SvecType *) palloc(VARSIZE(point));
+            memcpy(copy, point, VARSIZE(point));
+            canopy_index_add(&cache->index, copy);
+            MemoryContextSwitchTo(oldContext);
+        }
+    }
+
+    if (indexed)
+        cache->state_size = VARSIZE(result);
+    else
+        cache->adopt_size = VARSIZE(result);
+    PG_RETURN_ARRAYTYPE_P(result);
 }
 
 PG_FUNCTION_INFO_V1(internal_remove_close_canopies);
@@ -592,36 +1060,29 @@ internal_remove_close_canopies(PG_FUNCTION_ARGS) {
     ArrayType      *all_canopies_arr;
     Datum          *all_canopies;
     int             num_all_canopies;
-    PGFunction      metric_fn;
     float8          threshold;
     
     Datum          *close_canopies;
     int             num_close_canopies;
-    bool            addIndexI;
-    MemoryContext   mem_context_for_function_calls;
+    CanopyIndex     index;
 
     all_canopies_arr = PG_GETARG_ARRAYTYPE_P(verify_arg_nonnull(fcinfo, 0));
     get_svec_array_elms(all_canopies_arr, &all_canopies, &num_all_canopies);
-    metric_fn = get_metric_fn(PG_GETARG_INT32(verify_arg_nonnull(fcinfo, 1)));
+    canopy_index_init(&index,
+        PG_GETARG_INT32(verify_arg_nonnull(fcinfo, 1)), num_all_canopies);
     threshold = PG_GETARG_FLOAT8(verify_arg_nonnull(fcinfo, 2));
     
-    mem_context_for_function_calls = setup_mem_context_for_functional_calls();
+    /* Greedily keep every canopy that is not close to one kept before */
     close_canopies = (Datum *) palloc(sizeof(Datum) * num_all_canopies);
     num_close_canopies = 0;
     for (int i = 0; i < num_all_canopies; i++) {
-        addIndexI = true;
-        for (int j = 0; j < num_close_canopies; j++) {
-            if (compute_metric(metric_fn, mem_context_for_function_calls,
-                all_canopies[i], close_canopies[j]) < threshold) {
-                
-                addIndexI = false;
-                break;
-            }
-        }
-        if (addIndexI)
+        SvecType *canopy = (SvecType *) DatumGetPointer(all_canopies[i]);
+
+        if (!canopy_index_search(&index, canopy, threshold, NULL)) {
+            canopy_index_add(&index, canopy);
             close_canopies[num_close_canopies++] = all_canopies[i];
+        }
     }
-    MemoryContextDelete(mem_context_for_function_calls);
     
     PG_RETURN_ARRAYTYPE_P(
         construct_array(
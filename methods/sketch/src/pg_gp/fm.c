@@ -17,7 +17,10 @@
  *
  * The FM sketch technique works poorly with small inputs, so we
  * explicitly count the first 12K distinct values in a main-memory
- * data structure before switching over to sketching.
+ * data structure before switching over to sketching.  That structure is a
+ * hashset of the 64-bit hashes of the values, and the sketch is driven by
+ * the same hashes, so each value is hashed once and the switch-over replays
+ * the hashes rather than the values.
  *
  * See the paper mentioned below
  * for detailed explanation, formulae, and pseudocode.
@@ -30,18 +33,19 @@
 #include <utils/elog.h>
 #include <utils/builtins.h>
 #include <utils/lsyscache.h>
-#include <libpq/md5.h>
 #include <nodes/execnodes.h>
 #include <fmgr.h>
 #include <ctype.h>
 #include "sketch_support.h"
-#include "sortasort.h"
+#include "hashset.h"
 
 #ifndef NO_PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
 #endif
 
 #define NMAP 256
+/*! number of hash bits that choose one of the NMAP bitmaps */
+#define FM_INDEX_BITS 8
 #define FMSKETCH_SZ (VARHDRSZ + NMAP*(MD5_HASHLEN_BITS)/CHAR_BIT)
 
 /*!
@@ -51,11 +55,10 @@ PG_MODULE_MAGIC;
 #define MINVALS 1024*12
 
 /*!
- * initial size for a sortasort: we'll guess at 8 bytes per datum.
- * sortasort will grow dynamically if we guessed too low
+ * initial number of slots of the hashset; it doubles whenever it gets half
+ * full, up to the first power of two that holds MINVALS at that load
  */
-#define SORTASORT_INITIAL_STORAGE  sizeof(sortasort) + MINVALS*sizeof(uint32) + \
-    8*MINVALS
+#define HASHSET_INITIAL_CAPACITY 256
 
 typedef enum {SMALL, BIG} fmstatus;
 
@@ -66,7 +69,7 @@ typedef enum {SMALL, BIG} fmstatus;
  * because FM sketches work poorly on small numbers of values,
  * our transval can be in one of two modes.
  * for "SMALL" numbers of values (<=MINVALS), the storage array
- * is a "sortasort" data structure containing an array of input values.
+ * is a "hashset" data structure containing the hashes of the input values.
  * for "BIG" datasets (>MINVAL), it is an array of FM sketch bitmaps.
  * \endinternal
  */
@@ -97,28 +100,9 @@ typedef struct {
     char storage[];
 } fmtransval;
 
-/* check whter the contents in  fmtransval::storage is safe for sortasort */
-void check_sortasort(sortasort *st, size_t st_size) {
-    size_t left_len = st_size;
-
-    if (left_len < sizeof(sortasort)) {
-        elog(ERROR, "invalid transition state for fmsketch");
-    }
-    left_len -= sizeof(sortasort);
-
-    if (st->num_vals > st->capacity || st->storage_cur > st->storage_sz) {
-        elog(ERROR, "invalid transition state for fmsketch");
-    }
-
-    if (left_len < st->capacity*sizeof(st->storage_cur) + st->storage_sz) {
-        elog(ERROR, "invalid transition state for fmsketch");
-    }
-}
-
 /* check whether the contents in the bytea is safe for a fmtransval */
 void check_fmtransval(bytea * storage) {
     fmtransval * fmt = NULL;
-    sortasort *st = NULL;
     int16 typLen = 0;
     bool typByVal = false;
     if (VARSIZE(storage) < VARHDRSZ + sizeof(fmtransval)) {
@@ -148,14 +132,8 @@ void check_fmtransval(bytea * storage) {
     }
 
     if (SMALL == fmt->status) {
-        if (VARSIZE(storage) < VARHDRSZ + sizeof(fmtransval) + sizeof(sortasort)) {
-            elog(ERROR, "invalid transition state for fmsketch");
-        }
-        st = (sortasort *)fmt->storage;
-        if (fmt->typLen != st->typLen || fmt->typByVal != (bool)st->typByVal) {
-            elog(ERROR, "invalid transition state for fmsketch");
-        }
-        check_sortasort(st, VARSIZE(storage) - VARHDRSZ - sizeof(fmtransval));
+        check_hashset((hashset *)fmt->storage,
+                      VARSIZE(storage) - VARHDRSZ - sizeof(fmtransval));
     }
     else {
         if (VARSIZE(storage) < 2*VARHDRSZ + sizeof(fmtransval)) {
@@ -167,13 +145,13 @@ void check_fmtransval(bytea * storage) {
     }
 }
 
-Datum __fmsketch_trans_c(bytea *, Datum);
+Datum __fmsketch_trans_c(bytea *, uint64);
 Datum __fmsketch_count_distinct_c(bytea *);
 Datum __fmsketch_trans(PG_FUNCTION_ARGS);
 Datum __fmsketch_count_distinct(PG_FUNCTION_ARGS);
 Datum __fmsketch_merge(PG_FUNCTION_ARGS);
 void big_or(bytea *bitmap1, bytea *bitmap2, bytea *out);
-bytea *fmsketch_sortasort_insert(bytea *, Datum, size_t);
+bytea *fmsketch_hashset_insert(bytea *, uint64);
 bytea *fm_new(fmtransval *);
 
 PG_FUNCTION_INFO_V1(__fmsketch_trans);
@@ -188,6 +166,7 @@ Datum __fmsketch_trans(PG_FUNCTION_ARGS)
     bool        typIsVarlena;
     Datum       retval;
     Datum       inval;
+    uint64      hash;
 
     if (!OidIsValid(element_type))
         elog(ERROR, "could not determine data type of input");
@@ -213,12 +192,12 @@ Datum __fmsketch_trans(PG_FUNCTION_ARGS)
         inval = PG_GETARG_DATUM(1);
 
         /*
-         * if this is the first call, initialize transval to hold a sortasort
+         * if this is the first call, initialize transval to hold a hashset
          * on the first call, we should have the empty string (if the agg was declared properly!)
          */
         if (VARSIZE(transblob) <= VARHDRSZ) {
             size_t blobsz = VARHDRSZ + sizeof(fmtransval) +
-                            SORTASORT_INITIAL_STORAGE;
+                            HASHSET_SZ(HASHSET_INITIAL_CAPACITY);
 
             transblob = (bytea *)palloc0(blobsz);
             SET_VARSIZE(transblob, blobsz);
@@ -229,11 +208,8 @@ Datum __fmsketch_trans(PG_FUNCTION_ARGS)
             getTypeOutputInfo(element_type, &funcOid, &typIsVarlena);
             get_typlenbyval(element_type, &(transval->typLen), &(transval->typByVal));
             transval->status = SMALL;
-            sortasort_init((sortasort *)transval->storage,
-                           MINVALS,
-                           SORTASORT_INITIAL_STORAGE,
-                           transval->typLen,
-                           transval->typByVal);
+            hashset_init((hashset *)transval->storage,
+                         HASHSET_INITIAL_CAPACITY);
         }
         else {
             check_fmtransval(transblob);
@@ -244,42 +220,52 @@ Datum __fmsketch_trans(PG_FUNCTION_ARGS)
             }
         }
 
+        /* every value is hashed exactly once, whatever the mode */
+        hash = sketch_hash_datum(inval, transval->typLen, transval->typByVal);
+
         /*
-         * if we've seen < MINVALS distinct values, place datum into the sortasort
-         * XXXX Would be cleaner to try the sortasort insert and if it fails, then continue.
+         * if we've seen < MINVALS distinct values, place the hash into the hashset
          */
         if (transval->status == SMALL
-            && ((sortasort *)(transval->storage))->num_vals <
+            && ((hashset *)(transval->storage))->num_vals <
             MINVALS) {
-            int len = ExtractDatumLen(inval, transval->typLen, transval->typByVal, -1);
-
             retval =
-                PointerGetDatum(fmsketch_sortasort_insert(
-                                    transblob,
-                                    inval, len));
+                PointerGetDatum(fmsketch_hashset_insert(transblob, hash));
             PG_RETURN_DATUM(retval);
         }
 
         /*
-         * if we've seen exactly MINVALS distinct values, create FM bitmaps
-         * and load the contents of the sortasort into the FM sketch
+         * a value we have already seen leaves a full hashset as it is, so
+         * that up to MINVALS distinct values are counted exactly
+         */
+        else if (transval->status == SMALL
+                 && hashset_contains((hashset *)(transval->storage), hash)) {
+            PG_RETURN_DATUM(PointerGetDatum(transblob));
+        }
+
+        /*
+         * if we've seen exactly MINVALS distinct values and this one is new,
+         * create FM bitmaps and load the contents of the hashset into the FM
+         * sketch
          */
         else if (transval->status == SMALL
-                 && ((sortasort *)(transval->storage))->num_vals ==
+                 && ((hashset *)(transval->storage))->num_vals ==
                  MINVALS) {
-            int        i;
-            sortasort  *s = (sortasort *)(transval->storage);
+            uint32     i, n;
+            hashset    *s = (hashset *)(transval->storage);
             bytea      *newblob = fm_new(transval);
+            uint64     *hashes = (uint64 *)palloc(s->num_vals * sizeof(uint64));
 
             transval = (fmtransval *)VARDATA(newblob);
 
             /*
              * "catch up" on the past as if we were doing FM from the beginning:
-             * apply the FM sketching algorithm to each value previously stored in the sortasort
+             * apply the FM sketching algorithm to each hash previously stored in the hashset
              */
-            for (i = 0; i < MINVALS; i++)
-                __fmsketch_trans_c(newblob,
-                                   PointerExtractDatum(sortasort_getval(s,i), s->typByVal));
+            n = hashset_values(s, hashes);
+            for (i = 0; i < n; i++)
+                __fmsketch_trans_c(newblob, hashes[i]);
+            pfree(hashes);
 
             /*
              * XXXX would like to pfree the old transblob, but the memory allocator doesn't like it
@@ -300,7 +286,7 @@ Datum __fmsketch_trans(PG_FUNCTION_ARGS)
                 "FM sketch failed internal sanity check");
 
         /* Apply FM algorithm to this datum */
-        retval = __fmsketch_trans_c(transblob, inval);
+        retval = __fmsketch_trans_c(transblob, hash);
         PG_RETURN_DATUM(retval);
     }
     else PG_RETURN_NULL();
@@ -331,44 +317,58 @@ bytea *fm_new(fmtransval *template)
     return(newblob);
 }
 
+/*!
+ * \param w a non-zero 64-bit word
+ * \returns the number of trailing zero bits of the word
+ */
+static inline int fm_ctz64(uint64 w)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(w);
+#else
+    int n = 0;
+
+    while (!(w & 1)) {
+        w >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
 /*!
  * Main logic of Flajolet and Martin's sketching algorithm.
- * For each call, we get an md5 hash of the value passed in.
- * First we use the hash as a random number to choose one of
- * the NMAP bitmaps at random to update.
- * Then we find the position "rmost" of the rightmost 1 bit in the hashed value.
+ * For each call, we get a 64-bit hash of the value.
+ * First we use the top FM_INDEX_BITS bits of the hash as a random number to
+ * choose one of the NMAP bitmaps at random to update.
+ * Then we find the position "rmost" of the rightmost 1 bit in the remaining
+ * bits of the hash.
  * We then turn on the "rmost"-th bit FROM THE LEFT in the chosen bitmap.
  * \param transblob the transition value packed into a bytea
- * \param input a textual representation of the value to hash
+ * \param hash the 64-bit hash of the value
  */
-Datum __fmsketch_trans_c(bytea *transblob, Datum indat)
+Datum __fmsketch_trans_c(bytea *transblob, uint64 hash)
 {
     fmtransval * transval = (fmtransval *) VARDATA(transblob);
     bytea *      bitmaps = (bytea *)transval->storage;
     uint64       index;
-    uint8 *      c;
+    uint64       rest;
     int          rmost;
-    // char        *hex;
-    bytea       *hashed;
-
-    hashed = sketch_md5_bytea(indat, transval->typOid);
-    c = (uint8 *)VARDATA(hashed);
-    // hex = text_to_cstring((bytea *)DatumGetPointer(DirectFunctionCall2(binary_encode, PointerGetDatum(hashed),
-    //                       CStringGetTextDatum("hex"))));
-    // elog(NOTICE, "md5(%s), len %d: %s", text_to_cstring((bytea *)PointerGetDatum(indat)),
-    //      VARSIZE((bytea *)PointerGetDatum(indat)), hex);
 
     /*
      * During the insertion we insert each element
      * in one bitmap only (a la Flajolet pseudocode, page 16).
-     * Choose the bitmap by taking the 64 high-order bits worth of hash value mod NMAP
+     * Choose the bitmap by the high-order bits of the hash value.
      */
-    index = (*(uint64 *)c) % NMAP;
+    index = hash >> (64 - FM_INDEX_BITS);
 
     /*
-     * Find index of the rightmost non-0 bit.  Turn on that bit (from left!) in the sketch.
+     * Find index of the rightmost non-0 bit among the other bits.  Turn on
+     * that bit (from left!) in the sketch.  An all-zero remainder, which has
+     * probability 2^-56, counts as the position past its last bit.
      */
-    rmost = rightmost_one(c, 1, MD5_HASHLEN_BITS, 0);
+    rest = hash & ((UINT64CONST(1) << (64 - FM_INDEX_BITS)) - 1);
+    rmost = rest ? fm_ctz64(rest) : 64 - FM_INDEX_BITS;
 
     /*
      * last argument must be the index of the bit position from the right.
@@ -394,9 +394,9 @@ Datum __fmsketch_count_distinct(PG_FUNCTION_ARGS)
     check_fmtransval(PG_GETARG_BYTEA_P(0));
     transval = (fmtransval *)VARDATA((PG_GETARG_BYTEA_P(0)));
 
-    /* if status is not BIG then get count from sortasort */
+    /* if status is not BIG then get count from hashset */
     if (transval->status == SMALL)
-        return ((sortasort *)(transval->storage))->num_vals;
+        return ((hashset *)(transval->storage))->num_vals;
     /* else get count via fm */
     else if (transval->status != BIG) {
         elog(ERROR, "FM transval neither SMALL nor BIG");
@@ -441,7 +441,7 @@ PG_FUNCTION_INFO_V1(__fmsketch_merge);
  * Greenplum "prefunc": a function to merge 2 transvals computed at different machines.
  * For simple FM, this is trivial: just OR together the two arrays of bitmaps.
  * But we have to deal with cases where one or both transval is SMALL: i.e. it
- * holds a sortasort, not an FM sketch.
+ * holds a hashset, not an FM sketch.
  *
  * XXX  TESTING: Ensure we exercise all branches!
  */
@@ -450,10 +450,11 @@ Datum __fmsketch_merge(PG_FUNCTION_ARGS)
     bytea *     transblob1 = (bytea *)PG_GETARG_BYTEA_P(0);
     bytea *     transblob2 = (bytea *)PG_GETARG_BYTEA_P(1);
     fmtransval *transval1, *transval2;
-    sortasort * s1, *s2;
-    sortasort * sortashort, *sortabig;
+    hashset *   s1, *s2;
+    hashset *   setshort, *setbig;
     bytea *     tblob_big, *tblob_small;
-    uint32      i;
+    uint64 *    hashes;
+    uint32      i, n;
 
     /* deal with the case where one or both items is the initial value of '' */
     if (VARSIZE(transblob1) == VARHDRSZ) {
@@ -483,32 +484,25 @@ Datum __fmsketch_merge(PG_FUNCTION_ARGS)
         PG_RETURN_DATUM(PointerGetDatum(tblob_big));
     }
     else if (transval1->status == SMALL && transval2->status == SMALL) {
-        s1 = (sortasort *)(transval1->storage);
-        s2 = (sortasort *)(transval2->storage);
+        s1 = (hashset *)(transval1->storage);
+        s2 = (hashset *)(transval2->storage);
         tblob_big =
             (s1->num_vals > s2->num_vals) ? transblob1 : transblob2;
         tblob_small =
             (s1->num_vals > s2->num_vals) ? transblob2 : transblob1;
-        sortashort =
-            (sortasort *)(((fmtransval *)((fmtransval *)VARDATA(tblob_small)))->storage);
-        sortabig = (sortasort *)(((fmtransval *)((fmtransval *)VARDATA(tblob_big)))->storage);
-        if (sortabig->num_vals + sortashort->num_vals <=
-            sortabig->capacity) {
+        setshort =
+            (hashset *)(((fmtransval *)((fmtransval *)VARDATA(tblob_small)))->storage);
+        setbig = (hashset *)(((fmtransval *)((fmtransval *)VARDATA(tblob_big)))->storage);
+        if (setbig->num_vals + setshort->num_vals <= MINVALS) {
             /*
-             * we have room in sortabig
-             * one could imagine a more efficient (merge-based) sortasort merge,
-             * but for now we just copy the values from the smaller sortasort into
-             * the bigger one.
+             * the union is still SMALL: copy the hashes from the smaller
+             * hashset into the bigger one.
              */
-            for (i = 0; i < sortashort->num_vals; i++) {
-                Datum the_val = PointerExtractDatum(sortasort_getval(sortashort,i),
-                                                    transval1->typByVal);
-                int the_len = ExtractDatumLen(the_val, transval1->typLen,
-                                              transval1->typByVal, -1);
-                tblob_big = fmsketch_sortasort_insert(tblob_big,
-                                                      the_val,
-                                                      the_len);
-            }
+            hashes = (uint64 *)palloc(setshort->num_vals * sizeof(uint64));
+            n = hashset_values(setshort, hashes);
+            for (i = 0; i < n; i++)
+                tblob_big = fmsketch_hashset_insert(tblob_big, hashes[i]);
+            pfree(hashes);
             PG_RETURN_DATUM(PointerGetDatum(tblob_big));
         }
         /* else drop through. */
@@ -525,18 +519,20 @@ Datum __fmsketch_merge(PG_FUNCTION_ARGS)
             (transval1->status == BIG) ? transblob1 : transblob2;
 
     if (transval1->status == SMALL) {
-        s1 = (sortasort *)(transval1->storage);
-        for(i = 0; i < s1->num_vals; i++) {
-            __fmsketch_trans_c(tblob_big, PointerExtractDatum(sortasort_getval(s1,i),
-                                                              transval1->typByVal));
-        }
+        s1 = (hashset *)(transval1->storage);
+        hashes = (uint64 *)palloc(s1->num_vals * sizeof(uint64));
+        n = hashset_values(s1, hashes);
+        for (i = 0; i < n; i++)
+            __fmsketch_trans_c(tblob_big, hashes[i]);
+        pfree(hashes);
     }
     if (transval2->status == SMALL) {
-        s2 = (sortasort *)(transval2->storage);
-        for(i = 0; i < s2->num_vals; i++) {
-            __fmsketch_trans_c(tblob_big, PointerExtractDatum(sortasort_getval(s2,i),
-                                                              transval1->typByVal));
-        }
+        s2 = (hashset *)(transval2->storage);
+        hashes = (uint64 *)palloc(s2->num_vals * sizeof(uint64));
+        n = hashset_values(s2, hashes);
+        for (i = 0; i < n; i++)
+            __fmsketch_trans_c(tblob_big, hashes[i]);
+        pfree(hashes);
     }
     PG_RETURN_DATUM(PointerGetDatum(tblob_big));
 }
@@ -566,55 +562,35 @@ void big_or(bytea *bitmap1, bytea *bitmap2, bytea *out)
 }
 
 /*!
- * wrapper for insertion into a sortasort. calls sortasort_try_insert and if that fails it
- * makes more space for insertion (double or more the size) and tries again.
+ * wrapper for insertion into a hashset. if the hashset is getting full, it
+ * is first copied into a new transition value with twice the slots.
  * \param transblob the current transition value packed into a bytea
- * \param dat the Datum to be inserted
+ * \param hash the hash of the value to be inserted
  */
-bytea *fmsketch_sortasort_insert(bytea *transblob, Datum dat, size_t len)
+bytea *fmsketch_hashset_insert(bytea *transblob, uint64 hash)
 {
     fmtransval *transval = (fmtransval *)VARDATA(transblob);
-    sortasort *s_in =
-        (sortasort *)(transval->storage);
-    bytea *    newblob;
-    bool       success = FALSE;
-    size_t     new_storage_sz;
-    size_t     newsize;
-
-    if (s_in->num_vals >= s_in->capacity)
-        elog(ERROR, "attempt to insert into full sortasort");
-
-    success = sortasort_try_insert(s_in, dat, transval->typLen);
-    if (success < 0)
-        elog(ERROR, "insufficient directory capacity in sortasort");
+    hashset    *s_in = (hashset *)(transval->storage);
+    hashset    *s_new;
+    bytea      *newblob;
+    size_t      newsize;
 
-    if (success == TRUE) return (transblob);
-
-    /* XXX  THIS WHILE LOOP WILL SUCCEED THE FIRST TRY ... REMOVE IT. */
-    while (!success) {
+    if (HASHSET_NEEDS_GROW(s_in)) {
         /*
-         * else insufficient space
-         * allocate a fmtransval with double-big storage area plus room for v
-         * should work 2nd time around the loop.
-         * we can't use repalloc because it fails trying to free the old transblob
+         * we can't use repalloc because it fails trying to free the old
+         * transblob.  The old blobs add up to less than the final one.
          */
-
-        new_storage_sz = s_in->storage_sz*2 + len;
-        /* XXX THIS POINTER ARITHMETIC SHOULD BE HIDDEN BY A MACRO IN THE SORTASORT LIBRARY! */
-        newsize = VARHDRSZ + sizeof(fmtransval) + sizeof(sortasort)
-                  + s_in->capacity*sizeof(s_in->dir[0]) +
-                  new_storage_sz;
+        newsize = VARHDRSZ + sizeof(fmtransval) + HASHSET_SZ(2 * s_in->capacity);
         newblob = (bytea *)palloc(newsize);
-        memcpy(newblob, transblob, VARSIZE(transblob));
         SET_VARSIZE(newblob, newsize);
-        s_in = (sortasort *)((fmtransval *)VARDATA(newblob))->storage;
-        s_in->storage_sz = new_storage_sz;
-        /*
-         * Can't figure out how to make pfree happy with transblob
-         * pfree(transblob);
-         */
+        memcpy(VARDATA(newblob), transval, sizeof(fmtransval));
+        s_new = (hashset *)((fmtransval *)VARDATA(newblob))->storage;
+        hashset_init(s_new, 2 * s_in->capacity);
+        hashset_copy(s_new, s_in);
         transblob = newblob;
-        success = sortasort_try_insert(s_in, dat, transval->typLen);
+        s_in = s_new;
     }
+
+    hashset_insert(s_in, hash);
     return(transblob);
 }
@@ -0,0 +1,152 @@
+/*!
+ * \file hashset.c
+ *
+ * \brief hashset implementation
+ */
+
+/*!
+ * A "hashset" is a pre-marshalled set of 64-bit hashes of values, used to
+ * count small numbers of distinct values exactly (up to hash collisions).
+ * Values are identified by their hash alone, so an insertion is a single
+ * probe sequence of word comparisons: there is no sorting, and values are
+ * neither stored nor compared byte by byte.
+ *
+ * The table is probed linearly from the low bits of the hash.  Callers keep
+ * the load factor at or below one half (see HASHSET_NEEDS_GROW) by copying
+ * the set into a larger one.
+ */
+#include <postgres.h>
+#include <fmgr.h>
+#include "hashset.h"
+
+/*!
+ * given a pre-allocated hashset, set up its metadata
+ * \param s a pre-allocated hashset of HASHSET_SZ(capacity) bytes
+ * \param capacity number of slots, a power of two
+ */
+void hashset_init(hashset *s, uint32 capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+        elog(ERROR, "hashset capacity %u is not a power of two", capacity);
+    s->num_vals = 0;
+    s->capacity = capacity;
+    s->has_zero = 0;
+    s->reserved = 0;
+    memset(s->slots, 0, capacity * sizeof(uint64));
+}
+
+/*!
+ * insert a hash into a hashset that has room for it
+ * \param s a hashset
+ * \param hash the hash of a value
+ * \returns true if the hash was added, false if it was already there
+ */
+bool hashset_insert(hashset *s, uint64 hash)
+{
+    uint32 mask = s->capacity - 1;
+    uint32 pos = (uint32)hash & mask;
+    uint32 probes;
+
+    if (hash == 0) {
+        if (s->has_zero)
+            return false;
+        s->has_zero = 1;
+        s->num_vals++;
+        return true;
+    }
+
+    for (probes = 0; probes < s->capacity; probes++) {
+        if (s->slots[pos] == 0) {
+            s->slots[pos] = hash;
+            s->num_vals++;
+            return true;
+        }
+        if (s->slots[pos] == hash)
+            return false;
+        pos = (pos + 1) & mask;
+    }
+    elog(ERROR, "attempt to insert into full hashset");
+    return false;
+}
+
+/*!
+ * look up a hash in a hashset
+ * \param s a hashset
+ * \param hash the hash of a value
+ * \returns true if the hash is in the set
+ */
+bool hashset_contains(const hashset *s, uint64 hash)
+{
+    uint32 mask = s->capacity - 1;
+    uint32 pos = (uint32)hash & mask;
+    uint32 probes;
+
+    if (hash == 0)
+        return s->has_zero != 0;
+
+    for (probes = 0; probes < s->capacity; probes++) {
+        if (s->slots[pos] == 0)
+            return false;
+        if (s->slots[pos] == hash)
+            return true;
+        pos = (pos + 1) & mask;
+    }
+    return false;
+}
+
+/*!
+ * copy a hashset into an initialized, empty hashset of at least as many slots
+ * \param dst the target hashset
+ * \param src the source hashset
+ */
+void hashset_copy(hashset *dst, const hashset *src)
+{
+    uint32 i;
+
+    if (dst->num_vals != 0 || dst->capacity < src->capacity)
+        elog(ERROR, "attempt to copy a hashset into a smaller one");
+    if (dst->capacity == src->capacity) {
+        memcpy(dst, src, HASHSET_SZ(src->capacity));
+        return;
+    }
+    dst->has_zero = src->has_zero;
+    dst->num_vals = src->has_zero ? 1 : 0;
+    for (i = 0; i < src->capacity; i++)
+        if (src->slots[i] != 0)
+            hashset_insert(dst, src->slots[i]);
+}
+
+/*!
+ * list the hashes of a hashset
+ * \param s a hashset
+ * \param out array of at least <c>num_vals</c> elements receiving the hashes
+ * \returns the number of hashes
+ */
+uint32 hashset_values(const hashset *s, uint64 *out)
+{
+    uint32 i, n = 0;
+
+    if (s->has_zero)
+        out[n++] = 0;
+    for (i = 0; i < s->capacity && n < s->num_vals; i++)
+        if (s->slots[i] != 0)
+            out[n++] = s->slots[i];
+    if (n != s->num_vals)
+        elog(ERROR, "invalid hashset");
+    return n;
+}
+
+/*!
+ * check whether the contents of a buffer are safe for a hashset
+ * \param s pointer to the buffer
+ * \param size size of the buffer
+ */
+void check_hashset(const hashset *s, size_t size)
+{
+    if (size < sizeof(hashset)
+        || s->capacity == 0 || (s->capacity & (s->capacity - 1)) != 0
+        || size < HASHSET_SZ(s->capacity)
+        || s->num_vals >= s->capacity
+        || s->has_zero > 1)
+        elog(ERROR, "invalid hashset");
+}
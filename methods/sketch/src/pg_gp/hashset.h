@@ -0,0 +1,39 @@
+/*!
+ * \file hashset.h
+ *
+ * \brief header file for the hashset data structure
+ */
+#ifndef HASHSET_H
+#define HASHSET_H
+
+/*!
+ * \internal
+ * \brief a pre-marshalled set of 64-bit hashes
+ *
+ * A hashset is a flat open-addressed hash table (linear probing) of value
+ * hashes, intended for insert and enumeration only, and network
+ * transmission as a single byte-string.  A slot holding 0 is empty, so the
+ * hash 0 is recorded by a separate flag.
+ * \endinternal
+ */
+typedef struct {
+    uint32 num_vals;    /*! number of hashes in the set */
+    uint32 capacity;    /*! number of slots, a power of two */
+    uint32 has_zero;    /*! whether the hash 0 is in the set */
+    uint32 reserved;
+    uint64 slots[];     /*! the hash table */
+} hashset;
+
+/*! size of a hashset with the given number of slots */
+#define HASHSET_SZ(capacity) (sizeof(hashset) + (size_t)(capacity) * sizeof(uint64))
+/*! whether one more insertion would push the load factor above one half */
+#define HASHSET_NEEDS_GROW(s) (2 * ((s)->num_vals + 1) > (s)->capacity)
+
+void   hashset_init(hashset *s, uint32 capacity);
+bool   hashset_insert(hashset *s, uint64 hash);
+bool   hashset_contains(const hashset *s, uint64 hash);
+void   hashset_copy(hashset *dst, const hashset *src);
+uint32 hashset_values(const hashset *s, uint64 *out);
+void   check_hashset(const hashset *s, size_t size);
+
+#endif /* HASHSET_H */
@@ -0,0 +1,680 @@
+/*!
+ * \file hll.c
+ *
+ * \brief HyperLogLog++ sketch implementation
+ */
+/*!
+ * \implementation
+ * A HyperLogLog sketch splits a 64-bit hash of each value into a register
+ * index (the first p bits) and a remainder.  Each of the m = 2^p registers
+ * keeps the maximum, over all values hashed to it, of the position of the
+ * first 1 bit in the remainder.  The distribution of the register values
+ * reveals the number of distinct values; see [1].
+ *
+ * Following HyperLogLog++ [2], small cardinalities are handled by a sparse
+ * representation: a list of (index, value) pairs at the much higher precision
+ * of 25 bits, encoded in one uint32 each.  New pairs are appended to an
+ * unsorted buffer that is sorted and merged into the list when it fills up.
+ * Once the list would take more space than the dense registers, the sketch is
+ * converted to one byte per register.
+ *
+ * Instead of the empirical bias correction tables of [2], the estimate is
+ * computed with the improved estimator of Ertl [3], which corrects the bias of
+ * the raw HyperLogLog estimate analytically for the whole range of
+ * cardinalities and can be applied to the sparse representation (as a sketch
+ * of precision 25) as well.
+ *
+ * Sketches are plain bytea values that do not depend on the type of the
+ * hashed values.  Two sketches are combined by taking register-wise maxima,
+ * after folding the sketch of higher precision down to the lower one, so
+ * sketches can be stored and rolled up later (e.g., daily sketches into
+ * monthly distinct counts).
+ *
+ * [1] P. Flajolet, E. Fusy, O. Gandouet, F. Meunier. HyperLogLog: the analysis
+ *     of a near-optimal cardinality estimation algorithm. AofA 2007.
+ * [2] S. Heule, M. Nunkesser, A. Hall. HyperLogLog in Practice: Algorithmic
+ *     Engineering of a State of The Art Cardinality Estimation Algorithm.
+ *     EDBT 2013.
+ * [3] O. Ertl. New cardinality estimation algorithms for HyperLogLog
+ *     sketches. arXiv:1702.01284, 2017.
+ */
+
+#include <postgres.h>
+#include <utils/array.h>
+#include <utils/elog.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <nodes/execnodes.h>
+#include <fmgr.h>
+#include <math.h>
+#include "sketch_support.h"
+#include "hll.h"
+
+/*! precision of the sparse representation */
+#define HLL_SPARSE_PRECISION 25
+/*! initial number of entries of a sparse sketch */
+#define HLL_SPARSE_INITIAL 64
+
+#define HLL_VERSION 1
+
+typedef enum {HLL_SPARSE = 1, HLL_DENSE = 2} hllformat;
+
+/*!
+ * \internal
+ * \brief HyperLogLog++ sketch, stored in a bytea
+ *
+ * In SPARSE format, <c>data</c> holds <c>capacity</c> uint32 slots: the first
+ * <c>num_sorted</c> entries are sorted by index with one entry per index,
+ * the following <c>num_buffered</c> entries are unsorted.  An entry holds the
+ * index at HLL_SPARSE_PRECISION in its upper bits and the register value in
+ * its lowest 6 bits.
+ * In DENSE format, <c>data</c> holds one byte per register.
+ * \endinternal
+ */
+typedef struct {
+    uint8  version;
+    uint8  format;
+    uint8  precision;
+    uint8  reserved;
+    uint32 num_sorted;
+    uint32 num_buffered;
+    uint32 capacity;
+    uint8  data[];
+} hllsketch;
+
+#define HLL_REGISTERS(p)        ((uint32)1 << (p))
+#define HLL_SPARSE_ENTRIES(sk)  ((uint32 *)(sk)->data)
+#define HLL_SPARSE_SZ(n)        (VARHDRSZ + sizeof(hllsketch) + (n)*sizeof(uint32))
+#define HLL_DENSE_SZ(p)         (VARHDRSZ + sizeof(hllsketch) + HLL_REGISTERS(p))
+/*! a sparse sketch is converted once its list outgrows the dense registers */
+#define HLL_SPARSE_THRESHOLD(p) (HLL_REGISTERS(p) / sizeof(uint32))
+#define HLL_SPARSE_MAX_CAPACITY(p) \
+    (HLL_SPARSE_THRESHOLD(p) + HLL_SPARSE_THRESHOLD(p) / 4)
+
+#define HLL_ENTRY_INDEX(e)  ((e) >> 6)
+#define HLL_ENTRY_VALUE(e)  ((e) & 0x3F)
+
+/*! alpha_infinity = 1 / (2 ln 2) */
+#define HLL_ALPHA_INF 0.721347520444481703680
+
+/*!
+ * \param w a 64-bit word
+ * \returns the number of leading zero bits of a non-zero word
+ */
+static inline int hll_clz64(uint64 w)
+{
+#if defined(__GNUC__)
+    return __builtin_clzll(w);
+#else
+    int n = 0;
+
+    while (!(w & (UINT64CONST(1) << 63))) {
+        w <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/*!
+ * Split a hash into a register index and value at precision p.  The value
+ * is one plus the number of leading zeros of the 64-p bits after the index.
+ */
+static inline void hll_split_hash(uint64 hash, int p, uint32 *idx, uint8 *val)
+{
+    uint64 w = hash << p;
+
+    *idx = (uint32)(hash >> (64 - p));
+    *val = w ? hll_clz64(w) + 1 : 64 - p + 1;
+}
+
+/*!
+ * Convert a non-empty register at precision <c>from</c> to the register it
+ * contributes to at the lower precision <c>to</c>.  The index bits dropped
+ * become the leading bits of the remainder.
+ */
+static inline void hll_fold(uint32 *idx, uint8 *val, int from, int to)
+{
+    int    d = from - to;
+    uint32 low = *idx & ((1U << d) - 1);
+
+    *idx >>= d;
+    if (low)
+        *val = hll_clz64((uint64)low << (64 - d)) + 1;
+    else
+        *val += d;
+}
+
+/* check whether the contents of the bytea is safe for an hllsketch */
+void check_hllsketch(bytea *blob)
+{
+    hllsketch *sk;
+
+    if (VARSIZE(blob) < VARHDRSZ + sizeof(hllsketch))
+        elog(ERROR, "invalid hyperloglog sketch");
+    sk = (hllsketch *)VARDATA(blob);
+    if (sk->version != HLL_VERSION
+        || sk->precision < HLL_MIN_PRECISION
+        || sk->precision > HLL_MAX_PRECISION)
+        elog(ERROR, "invalid hyperloglog sketch");
+
+    if (sk->format == HLL_SPARSE) {
+        if ((uint64)sk->num_sorted + sk->num_buffered > sk->capacity
+            || VARSIZE(blob) < HLL_SPARSE_SZ((uint64)sk->capacity))
+            elog(ERROR, "invalid hyperloglog sketch");
+    }
+    else if (sk->format == HLL_DENSE) {
+        if (VARSIZE(blob) != HLL_DENSE_SZ(sk->precision))
+            elog(ERROR, "invalid hyperloglog sketch");
+    }
+    else
+        elog(ERROR, "invalid hyperloglog sketch");
+}
+
+/*!
+ * allocate an empty sparse sketch
+ * \param precision log2 of the number of dense registers
+ * \param capacity number of entries to make room for
+ */
+bytea *hll_new_sparse(int precision, uint32 capacity)
+{
+    bytea     *blob = (bytea *)palloc0(HLL_SPARSE_SZ(capacity));
+    hllsketch *sk = (hllsketch *)VARDATA(blob);
+
+    SET_VARSIZE(blob, HLL_SPARSE_SZ(capacity));
+    sk->version = HLL_VERSION;
+    sk->format = HLL_SPARSE;
+    sk->precision = precision;
+    sk->capacity = capacity;
+    return blob;
+}
+
+/*!
+ * allocate an empty dense sketch
+ * \param precision log2 of the number of registers
+ */
+bytea *hll_new_dense(int precision)
+{
+    bytea     *blob = (bytea *)palloc0(HLL_DENSE_SZ(precision));
+    hllsketch *sk = (hllsketch *)VARDATA(blob);
+
+    SET_VARSIZE(blob, HLL_DENSE_SZ(precision));
+    sk->version = HLL_VERSION;
+    sk->format = HLL_DENSE;
+    sk->precision = precision;
+    return blob;
+}
+
+/*!
+ * support function for sorting sparse entries
+ */
+static int hll_entry_cmp(const void *i, const void *j)
+{
+    uint32 a = *(const uint32 *)i;
+    uint32 b = *(const uint32 *)j;
+
+    return (a > b) - (a < b);
+}
+
+/*!
+ * remove duplicate indexes from sorted entries, keeping the largest value.
+ * \returns the new number of entries
+ */
+static uint32 hll_dedupe(uint32 *entries, uint32 n)
+{
+    uint32 i, out = 0;
+
+    for (i = 0; i < n; i++) {
+        if (out > 0
+            && HLL_ENTRY_INDEX(entries[out - 1]) == HLL_ENTRY_INDEX(entries[i]))
+            /* sorted, so the later entry has the larger value */
+            entries[out - 1] = entries[i];
+        else
+            entries[out++] = entries[i];
+    }
+    return out;
+}
+
+/*!
+ * sort the buffered entries of a sparse sketch and merge them into the
+ * sorted list
+ */
+static void hll_sparse_flush(hllsketch *sk)
+{
+    uint32 *entries = HLL_SPARSE_ENTRIES(sk);
+    uint32 *buf = entries + sk->num_sorted;
+    uint32 *merged;
+    uint32  nbuf, i, j, n;
+
+    if (sk->num_buffered == 0)
+        return;
+
+    qsort(buf, sk->num_buffered, sizeof(uint32), hll_entry_cmp);
+    nbuf = hll_dedupe(buf, sk->num_buffered);
+
+    merged = (uint32 *)palloc((sk->num_sorted + nbuf) * sizeof(uint32));
+    for (i = j = n = 0; i < sk->num_sorted || j < nbuf; ) {
+        if (j == nbuf || (i < sk->num_sorted && entries[i] <= buf[j]))
+            merged[n++] = entries[i++];
+        else
+            merged[n++] = buf[j++];
+    }
+    n = hll_dedupe(merged, n);
+    memcpy(entries, merged, n * sizeof(uint32));
+    pfree(merged);
+
+    sk->num_sorted = n;
+    sk->num_buffered = 0;
+}
+
+/*!
+ * add the registers of sparse entries to dense registers of precision p
+ */
+static void hll_dense_add_sparse(uint8 *regs, int p,
+                                 const uint32 *entries, uint32 n)
+{
+    uint32 i, idx;
+    uint8  val;
+
+    for (i = 0; i < n; i++) {
+        idx = HLL_ENTRY_INDEX(entries[i]);
+        val = HLL_ENTRY_VALUE(entries[i]);
+        hll_fold(&idx, &val, HLL_SPARSE_PRECISION, p);
+        if (regs[idx] < val)
+            regs[idx] = val;
+    }
+}
+
+/*!
+ * add dense registers of precision <c>psrc</c> >= p to dense registers of
+ * precision p
+ */
+static void hll_dense_add_dense(uint8 *regs, int p, const uint8 *src, int psrc)
+{
+    uint32 i, idx;
+    uint8  val;
+
+    if (psrc == p) {
+        for (i = 0; i < HLL_REGISTERS(p); i++)
+            if (regs[i] < src[i])
+                regs[i] = src[i];
+        return;
+    }
+    for (i = 0; i < HLL_REGISTERS(psrc); i++) {
+        if (src[i] == 0)
+            continue;
+        idx = i;
+        val = src[i];
+        hll_fold(&idx, &val, psrc, p);
+        if (regs[idx] < val)
+            regs[idx] = val;
+    }
+}
+
+/*!
+ * \returns a dense copy of a sketch at the given precision, which must not
+ * exceed the precision of the sketch
+ */
+static bytea *hll_to_dense(bytea *blob, int precision)
+{
+    hllsketch *sk = (hllsketch *)VARDATA(blob);
+    bytea     *newblob = hll_new_dense(precision);
+    hllsketch *newsk = (hllsketch *)VARDATA(newblob);
+
+    if (sk->format == HLL_SPARSE)
+        hll_dense_add_sparse(newsk->data, precision, HLL_SPARSE_ENTRIES(sk),
+                             sk->num_sorted + sk->num_buffered);
+    else
+        hll_dense_add_dense(newsk->data, precision, sk->data, sk->precision);
+    return newblob;
+}
+
+/*!
+ * add a hashed value to a sketch
+ * \param blob a bytea holding an hllsketch, which is updated in place
+ * \param hash 64-bit hash of the value
+ * \returns the (possibly reallocated) sketch
+ */
+bytea *hll_add_hash(bytea *blob, uint64 hash)
+{
+    hllsketch *sk = (hllsketch *)VARDATA(blob);
+    uint32     idx;
+    uint8      val;
+
+    if (sk->format == HLL_SPARSE) {
+        if (sk->num_sorted + sk->num_buffered == sk->capacity) {
+            uint32 maxcap = HLL_SPARSE_MAX_CAPACITY(sk->precision);
+
+            hll_sparse_flush(sk);
+            if (sk->num_sorted > HLL_SPARSE_THRESHOLD(sk->precision)) {
+                blob = hll_to_dense(blob, sk->precision);
+                sk = (hllsketch *)VARDATA(blob);
+            }
+            else if (sk->capacity - sk->num_sorted < sk->capacity / 4
+                     && sk->capacity < maxcap) {
+                /* grow geometrically; the last step leaves a quarter free */
+                uint32  newcap = Min(2 * sk->capacity, maxcap);
+                bytea  *newblob = hll_new_sparse(sk->precision, newcap);
+                hllsketch *newsk = (hllsketch *)VARDATA(newblob);
+
+                newsk->num_sorted = sk->num_sorted;
+                memcpy(newsk->data, sk->data, sk->num_sorted * sizeof(uint32));
+                blob = newblob;
+                sk = newsk;
+            }
+        }
+        if (sk->format == HLL_SPARSE) {
+            hll_split_hash(hash, HLL_SPARSE_PRECISION, &idx, &val);
+            HLL_SPARSE_ENTRIES(sk)[sk->num_sorted + sk->num_buffered++] =
+                (idx << 6) | val;
+            return blob;
+        }
+    }
+
+    hll_split_hash(hash, sk->precision, &idx, &val);
+    if (sk->data[idx] < val)
+        sk->data[idx] = val;
+    return blob;
+}
+
+/*!
+ * combine two sketches.  The first sketch is updated in place when
+ * possible, otherwise a new sketch is returned.  The result has the smaller
+ * of the two precisions.
+ */
+bytea *hll_union_c(bytea *blob1, bytea *blob2)
+{
+    hllsketch *sk1 = (hllsketch *)VARDATA(blob1);
+    hllsketch *sk2 = (hllsketch *)VARDATA(blob2);
+    int        p = Min(sk1->precision, sk2->precision);
+    bytea     *newblob;
+    hllsketch *newsk;
+
+    if (sk1->format == HLL_SPARSE && sk2->format == HLL_SPARSE) {
+        uint32 n1 = sk1->num_sorted + sk1->num_buffered;
+        uint32 n2 = sk2->num_sorted + sk2->num_buffered;
+
+        newblob = hll_new_sparse(p, Max(n1 + n2, HLL_SPARSE_INITIAL));
+        newsk = (hllsketch *)VARDATA(newblob);
+        memcpy(HLL_SPARSE_ENTRIES(newsk), HLL_SPARSE_ENTRIES(sk1),
+               n1 * sizeof(uint32));
+        memcpy(HLL_SPARSE_ENTRIES(newsk) + n1, HLL_SPARSE_ENTRIES(sk2),
+               n2 * sizeof(uint32));
+        newsk->num_buffered = n1 + n2;
+        hll_sparse_flush(newsk);
+        if (newsk->num_sorted > HLL_SPARSE_THRESHOLD(p))
+            newblob = hll_to_dense(newblob, p);
+        return newblob;
+    }
+
+    if (sk1->format == HLL_DENSE && sk1->precision == p)
+        newblob = blob1;
+    else
+        newblob = hll_to_dense(blob1, p);
+    newsk = (hllsketch *)VARDATA(newblob);
+
+    if (sk2->format == HLL_SPARSE)
+        hll_dense_add_sparse(newsk->data, p, HLL_SPARSE_ENTRIES(sk2),
+                             sk2->num_sorted + sk2->num_buffered);
+    else
+        hll_dense_add_dense(newsk->data, p, sk2->data, sk2->precision);
+    return newblob;
+}
+
+/*!
+ * \returns sigma(x) = x + sum_{k>=1} x^(2^k) 2^(k-1), for 0 <= x < 1
+ */
+static double hll_sigma(double x)
+{
+    double y = 1, z = x, zprev;
+
+    do {
+        x *= x;
+        zprev = z;
+        z += x * y;
+        y += y;
+    } while (z != zprev);
+    return z;
+}
+
+/*!
+ * \returns tau(x) = (1 - x - sum_{k>=1} (1 - x^(2^-k))^2 2^-k) / 3
+ */
+static double hll_tau(double x)
+{
+    double y = 1, z = 1 - x, zprev;
+
+    if (x == 0. || x == 1.)
+        return 0.;
+    do {
+        x = sqrt(x);
+        zprev = z;
+        y *= 0.5;
+        z -= (1 - x) * (1 - x) * y;
+    } while (z != zprev);
+    return z / 3;
+}
+
+/*!
+ * Ertl's improved estimator
+ * \param C histogram of register values, C[k] registers have value k
+ * \param q number of hash bits after the index; values range from 0 to q+1
+ * \param m number of registers
+ */
+static double hll_estimate_histogram(const uint32 *C, int q, double m)
+{
+    double z;
+    int    k;
+
+    if (C[0] == m)
+        return 0.;
+    z = m * hll_tau(1 - C[q + 1] / m);
+    for (k = q; k >= 1; k--)
+        z = 0.5 * (z + C[k]);
+    z += m * hll_sigma(C[0] / m);
+    return HLL_ALPHA_INF * m * m / z;
+}
+
+/*!
+ * estimate the number of distinct values added to a sketch
+ */
+double hll_estimate_c(bytea *blob)
+{
+    hllsketch *sk = (hllsketch *)VARDATA(blob);
+    uint32     C[64 + 2];
+    uint32     i;
+
+    memset(C, 0, sizeof(C));
+    if (sk->format == HLL_SPARSE) {
+        uint32  n = sk->num_sorted + sk->num_buffered;
+        uint32 *entries = (uint32 *)palloc(Max(n, 1) * sizeof(uint32));
+        int     q = 64 - HLL_SPARSE_PRECISION;
+
+        memcpy(entries, HLL_SPARSE_ENTRIES(sk), n * sizeof(uint32));
+        qsort(entries, n, sizeof(uint32), hll_entry_cmp);
+        n = hll_dedupe(entries, n);
+        for (i = 0; i < n; i++) {
+            if (HLL_ENTRY_VALUE(entries[i]) > q + 1)
+                elog(ERROR, "invalid hyperloglog sketch");
+            C[HLL_ENTRY_VALUE(entries[i])]++;
+        }
+        C[0] = HLL_REGISTERS(HLL_SPARSE_PRECISION) - n;
+        pfree(entries);
+        return hll_estimate_histogram(C, q,
+                                      HLL_REGISTERS(HLL_SPARSE_PRECISION));
+    }
+
+    for (i = 0; i < HLL_REGISTERS(sk->precision); i++) {
+        if (sk->data[i] > 64 - sk->precision + 1)
+            elog(ERROR, "invalid hyperloglog sketch");
+        C[sk->data[i]]++;
+    }
+    return hll_estimate_histogram(C, 64 - sk->precision,
+                                  HLL_REGISTERS(sk->precision));
+}
+
+/*!
+ * cached type information of the hashed column
+ */
+typedef struct {
+    Oid   typOid;
+    int16 typLen;
+    bool  typByVal;
+} hlltypinfo;
+
+PG_FUNCTION_INFO_V1(__hllsketch_trans);
+
+/*!
+ * UDA transition function for the hllsketch aggregates.  An optional third
+ * argument sets the precision of a new sketch.
+ */
+Datum __hllsketch_trans(PG_FUNCTION_ARGS)
+{
+    bytea      *transblob = (bytea *)PG_GETARG_BYTEA_P(0);
+    Oid         element_type = get_fn_expr_argtype(fcinfo->flinfo, 1);
+    hlltypinfo *info = (hlltypinfo *)fcinfo->flinfo->fn_extra;
+
+    if (!OidIsValid(element_type))
+        elog(ERROR, "could not determine data type of input");
+
+    /*
+     * This function makes destructive updates to its arguments.
+     * Make sure it's being called in an agg context.
+     */
+    if (!(fcinfo->context &&
+          (IsA(fcinfo->context, AggState)
+    #ifdef NOTGP
+           || IsA(fcinfo->context, WindowAggState)
+    #endif
+          )))
+        elog(
+            ERROR,
+            "UDF call to a function that only works for aggs (destructive pass by reference)");
+
+    if (info == NULL || info->typOid != element_type) {
+        info = (hlltypinfo *)MemoryContextAlloc(fcinfo->flinfo->fn_mcxt,
+                                                sizeof(hlltypinfo));
+        info->typOid = element_type;
+        get_typlenbyval(element_type, &(info->typLen), &(info->typByVal));
+        fcinfo->flinfo->fn_extra = info;
+    }
+
+    /* on the first call, we get the empty string as initial value */
+    if (VARSIZE(transblob) <= VARHDRSZ) {
+        int precision = (PG_NARGS() > 2) ? PG_GETARG_INT32(2)
+                                         : HLL_DEFAULT_PRECISION;
+
+        if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION)
+            elog(ERROR, "hyperloglog precision must be between %d and %d",
+                 HLL_MIN_PRECISION, HLL_MAX_PRECISION);
+        transblob = hll_new_sparse(precision, HLL_SPARSE_INITIAL);
+    }
+    else
+        check_hllsketch(transblob);
+
+    PG_RETURN_POINTER(hll_add_hash(transblob,
+                                   sketch_hash_datum(PG_GETARG_DATUM(1),
+                                                     info->typLen,
+                                                     info->typByVal)));
+}
+
+PG_FUNCTION_INFO_V1(hllsketch_union);
+
+/*!
+ * combine two sketches; also the Greenplum "prefunc" of the hllsketch
+ * aggregates.  Either argument may be an empty transition value.
+ */
+Datum hllsketch_union(PG_FUNCTION_ARGS)
+{
+    bytea *blob1 = (bytea *)PG_GETARG_BYTEA_P(0);
+    bytea *blob2 = (bytea *)PG_GETARG_BYTEA_P(1);
+
+    if (VARSIZE(blob2) <= VARHDRSZ)
+        PG_RETURN_POINTER(blob1);
+    check_hllsketch(blob2);
+    if (VARSIZE(blob1) <= VARHDRSZ)
+        PG_RETURN_POINTER(blob2);
+    check_hllsketch(blob1);
+
+    /* only update the first argument in place inside an aggregate */
+    if (!(fcinfo->context && IsA(fcinfo->context, AggState))) {
+        bytea *copy = (bytea *)palloc(VARSIZE(blob1));
+
+        memcpy(copy, blob1, VARSIZE(blob1));
+        blob1 = copy;
+    }
+    PG_RETURN_POINTER(hll_union_c(blob1, blob2));
+}
+
+PG_FUNCTION_INFO_V1(__hllsketch_merge_trans);
+
+/*! UDA transition function for the hllsketch_merge aggregate */
+Datum __hllsketch_merge_trans(PG_FUNCTION_ARGS)
+{
+    bytea *transblob = (bytea *)PG_GETARG_BYTEA_P(0);
+    bytea *sketch = (bytea *)PG_GETARG_BYTEA_P(1);
+
+    if (!(fcinfo->context && IsA(fcinfo->context, AggState)))
+        elog(
+            ERROR,
+            "UDF call to a function that only works for aggs (destructive pass by reference)");
+
+    if (VARSIZE(sketch) <= VARHDRSZ)
+        PG_RETURN_POINTER(transblob);
+    check_hllsketch(sketch);
+    if (VARSIZE(transblob) <= VARHDRSZ) {
+        /* copy, as the state is updated in place later on */
+        bytea *copy = (bytea *)palloc(VARSIZE(sketch));
+
+        memcpy(copy, sketch, VARSIZE(sketch));
+        PG_RETURN_POINTER(copy);
+    }
+    check_hllsketch(transblob);
+    PG_RETURN_POINTER(hll_union_c(transblob, sketch));
+}
+
+PG_FUNCTION_INFO_V1(__hllsketch_serialize);
+
+/*!
+ * UDA final function returning a sketch in compact form: sparse sketches
+ * are sorted and trimmed to their entries.
+ */
+Datum __hllsketch_serialize(PG_FUNCTION_ARGS)
+{
+    bytea     *blob = (bytea *)PG_GETARG_BYTEA_P(0);
+    hllsketch *sk;
+    bytea     *out;
+
+    if (VARSIZE(blob) <= VARHDRSZ)
+        PG_RETURN_NULL();
+    check_hllsketch(blob);
+    sk = (hllsketch *)VARDATA(blob);
+    if (sk->format == HLL_DENSE)
+        PG_RETURN_POINTER(blob);
+
+    out = hll_new_sparse(sk->precision, sk->num_sorted + sk->num_buffered);
+    memcpy(VARDATA(out), VARDATA(blob), VARSIZE(out) - VARHDRSZ);
+    sk = (hllsketch *)VARDATA(out);
+    sk->capacity = sk->num_sorted + sk->num_buffered;
+    hll_sparse_flush(sk);
+    sk->capacity = sk->num_sorted;
+    SET_VARSIZE(out, HLL_SPARSE_SZ(sk->capacity));
+    PG_RETURN_POINTER(out);
+}
+
+PG_FUNCTION_INFO_V1(hllsketch_estimate);
+
+/*!
+ * estimate the number of distinct values from a sketch; also the final
+ * function of hllsketch_dcount
+ */
+Datum hllsketch_estimate(PG_FUNCTION_ARGS)
+{
+    bytea *blob = (bytea *)PG_GETARG_BYTEA_P(0);
+
+    if (VARSIZE(blob) <= VARHDRSZ)
+        /* nothing was ever aggregated! */
+        PG_RETURN_INT64(0);
+    check_hllsketch(blob);
+    PG_RETURN_INT64((int64)rint(hll_estimate_c(blob)));
+}
@@ -0,0 +1,27 @@
+/*!
+ * \file hll.h
+ *
+ * \brief header file for HyperLogLog++ sketches
+ */
+#ifndef HLL_H
+#define HLL_H
+
+/*! precision of sketches built by hllsketch_dcount */
+#define HLL_DEFAULT_PRECISION 14
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+
+Datum __hllsketch_trans(PG_FUNCTION_ARGS);
+Datum __hllsketch_merge_trans(PG_FUNCTION_ARGS);
+Datum __hllsketch_serialize(PG_FUNCTION_ARGS);
+Datum hllsketch_union(PG_FUNCTION_ARGS);
+Datum hllsketch_estimate(PG_FUNCTION_ARGS);
+
+void   check_hllsketch(bytea *blob);
+bytea *hll_new_sparse(int precision, uint32 capacity);
+bytea *hll_new_dense(int precision);
+bytea *hll_add_hash(bytea *blob, uint64 hash);
+bytea *hll_union_c(bytea *blob1, bytea *blob2);
+double hll_estimate_c(bytea *blob);
+
+#endif /* HLL_H */
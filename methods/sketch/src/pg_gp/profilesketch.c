@@ -0,0 +1,703 @@
+/*!
+ * \file profilesketch.c
+ *
+ * \brief single-pass profile of many columns
+ */
+/*!
+ * \implementation
+ * A table profile runs the same set of sketches over every column.  Doing so
+ * with one aggregate per column and statistic hashes every value once per
+ * sketch and keeps a separate transition value for each of them.  The
+ * aggregate in this file instead takes the values of all columns of a row at
+ * once and keeps one flat transition value with a fixed-size segment per
+ * column.  Each value is hashed once, and the hash feeds
+ *   - a dense HyperLogLog sketch of precision PROFILE_HLL_PRECISION for the
+ *     number of distinct values (see hll.c),
+ *   - a Space-Saving sketch of the most frequent values (see spacesaving.c),
+ *     which monitors the 64-bit hashes (as int8 values) rather than the values
+ *     themselves, so its size is fixed.  The text of each monitored value,
+ *     clipped to PROFILE_DISPLAY_LEN bytes, is kept alongside for output,
+ * and values that have a numeric representation also update min/max/sum and
+ * a reservoir sample of PROFILE_SAMPLE_SIZE values, from which the median and
+ * the histograms are computed.
+ *
+ * All sketches are updated in place, so the transition value is allocated
+ * once and its size only depends on the number of columns and buckets.
+ * Transition values of different segments are merged with the usual union of
+ * the sketches; reservoir samples are merged by drawing from both inputs in
+ * proportion to the number of values they represent.
+ */
+
+#include <postgres.h>
+#include <utils/array.h>
+#include <utils/elog.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <nodes/execnodes.h>
+#include <lib/stringinfo.h>
+#include <mb/pg_wchar.h>
+#include <fmgr.h>
+#include <catalog/pg_type.h>
+#include "sketch_support.h"
+#include "hll.h"
+#include "spacesaving.h"
+
+#include <string.h>
+
+/*! precision of the per-column HyperLogLog sketches */
+#define PROFILE_HLL_PRECISION 12
+/*! number of numeric values sampled per column */
+#define PROFILE_SAMPLE_SIZE 1024
+/*! bytes kept of the text of a frequent value, including the terminator */
+#define PROFILE_DISPLAY_LEN 64
+/*! number of output fields per column */
+#define PROFILE_NUM_FIELDS 10
+
+Datum __profile_trans(PG_FUNCTION_ARGS);
+Datum __profile_merge(PG_FUNCTION_ARGS);
+Datum __profile_final(PG_FUNCTION_ARGS);
+
+/*!
+ * \brief transition value of the profile aggregate.
+ * It is followed (at MAXALIGN'd offsets) by <c>num_cols</c> segments of
+ * <c>col_size</c> bytes, each made of
+ *   - a profilecol,
+ *   - a dense hllsketch of <c>hll_size</c> bytes (including its header),
+ *   - a Space-Saving transval of <c>ss_size</c> bytes (including its header),
+ *   - <c>max_mfvs</c> profiledisplay entries,
+ *   - PROFILE_SAMPLE_SIZE float8 sample values.
+ */
+typedef struct {
+    uint32 num_cols;    /*! number of profiled columns */
+    uint32 num_top;     /*! number of buckets requested by the user */
+    uint32 max_mfvs;    /*! number of Space-Saving counters per column */
+    uint32 col_size;    /*! size of a column segment */
+    uint32 hll_size;    /*! size of the embedded HyperLogLog sketch */
+    uint32 ss_size;     /*! size of the embedded Space-Saving sketch */
+    uint64 rows;        /*! number of rows seen */
+    uint64 rng;         /*! state of the sampling random number generator */
+} profiletransval;
+
+/*! \brief plain statistics of a column */
+typedef struct {
+    uint64 count;       /*! number of non-null values */
+    uint64 nulls;       /*! number of null values */
+    uint64 num_count;   /*! number of values with a numeric representation */
+    float8 min;
+    float8 max;
+    float8 sum;
+} profilecol;
+
+/*! \brief text of the value monitored by a Space-Saving counter */
+typedef struct {
+    uint64 hash;                        /*! hash of the value */
+    char   text[PROFILE_DISPLAY_LEN];   /*! clipped, null-terminated text */
+} profiledisplay;
+
+#define PROFILE_HDR_SZ     MAXALIGN(sizeof(profiletransval))
+#define PROFILE_HLL_OFF    MAXALIGN(sizeof(profilecol))
+#define PROFILE_SS_OFF(tv) (PROFILE_HLL_OFF + MAXALIGN((tv)->hll_size))
+#define PROFILE_DISP_OFF(tv) (PROFILE_SS_OFF(tv) + MAXALIGN((tv)->ss_size))
+#define PROFILE_SAMPLE_OFF(tv) \
+    (PROFILE_DISP_OFF(tv) + MAXALIGN((tv)->max_mfvs * sizeof(profiledisplay)))
+
+#define PROFILE_SEGMENT(tv, j) \
+    ((char *)(tv) + PROFILE_HDR_SZ + (size_t)(j) * (tv)->col_size)
+#define PROFILE_COL(tv, j)  ((profilecol *)PROFILE_SEGMENT(tv, j))
+#define PROFILE_HLL(tv, j)  ((bytea *)(PROFILE_SEGMENT(tv, j) + PROFILE_HLL_OFF))
+#define PROFILE_SS(tv, j)   ((bytea *)(PROFILE_SEGMENT(tv, j) + PROFILE_SS_OFF(tv)))
+#define PROFILE_DISP(tv, j) \
+    ((profiledisplay *)(PROFILE_SEGMENT(tv, j) + PROFILE_DISP_OFF(tv)))
+#define PROFILE_SAMPLE(tv, j) \
+    ((float8 *)(PROFILE_SEGMENT(tv, j) + PROFILE_SAMPLE_OFF(tv)))
+
+/*!
+ * xorshift64* pseudo random number generator
+ * \param state non-zero generator state, updated on return
+ */
+static inline uint64 profile_random(uint64 *state)
+{
+    uint64 x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * UINT64CONST(2685821657736338717);
+}
+
+/*!
+ * check the header of a profile transition value
+ * \param transblob a bytea holding a profiletransval
+ */
+static void check_profiletransval(bytea *transblob)
+{
+    profiletransval *tv;
+
+    if (VARSIZE(transblob) < VARHDRSZ + PROFILE_HDR_SZ)
+        elog(ERROR, "invalid transition state for profile");
+    tv = (profiletransval *)VARDATA(transblob);
+    if (tv->num_cols == 0 || tv->max_mfvs == 0 || tv->rng == 0
+        || tv->col_size != PROFILE_SAMPLE_OFF(tv)
+                           + PROFILE_SAMPLE_SIZE * sizeof(float8)
+        || VARSIZE(transblob) != VARHDRSZ + PROFILE_HDR_SZ
+                                 + (size_t)tv->num_cols * tv->col_size)
+        elog(ERROR, "invalid transition state for profile");
+}
+
+/*!
+ * check the sketches embedded in a profile transition value
+ * \param transblob a bytea holding a profiletransval with a valid header
+ */
+static void check_profilesketches(bytea *transblob)
+{
+    profiletransval *tv = (profiletransval *)VARDATA(transblob);
+    uint32           j;
+
+    for (j = 0; j < tv->num_cols; j++) {
+        if (VARSIZE(PROFILE_HLL(tv, j)) != tv->hll_size
+            || VARSIZE(PROFILE_SS(tv, j)) != tv->ss_size)
+            elog(ERROR, "invalid transition state for profile");
+        check_hllsketch(PROFILE_HLL(tv, j));
+        check_sstransval(PROFILE_SS(tv, j));
+    }
+}
+
+/*!
+ * allocate an empty profile transition value
+ * \param num_cols number of columns to profile
+ * \param num_top number of buckets of the histograms
+ */
+static bytea *profile_init_transval(int num_cols, int num_top)
+{
+    profiletransval *tv;
+    profiletransval  hdr;
+    bytea           *transblob;
+    bytea           *hll = hll_new_dense(PROFILE_HLL_PRECISION);
+    bytea           *ss;
+    int              max_mfvs;
+    size_t           size;
+    int              j;
+
+    if (num_top <= 0
+        || (size_t)num_top > MaxAllocSize / (SS_COUNTERS_PER_MFV
+             * (sizeof(sscounter) + sizeof(ssgroup) + 4 * sizeof(uint32)
+                + sizeof(profiledisplay))))
+        elog(ERROR, "invalid number of buckets for profile: %d", num_top);
+    max_mfvs = Max(SS_COUNTERS_PER_MFV * num_top, SS_MIN_COUNTERS);
+    ss = ss_init_transval(num_top, max_mfvs, INT8OID);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.num_cols = num_cols;
+    hdr.num_top = num_top;
+    hdr.max_mfvs = max_mfvs;
+    hdr.hll_size = VARSIZE(hll);
+    hdr.ss_size = VARSIZE(ss);
+    hdr.col_size = PROFILE_SAMPLE_OFF(&hdr)
+                   + PROFILE_SAMPLE_SIZE * sizeof(float8);
+    hdr.rows = 0;
+    hdr.rng = UINT64CONST(0x9E3779B97F4A7C15);
+
+    if (num_cols <= 0)
+        elog(ERROR, "profile expects at least one column");
+    if ((size_t)num_cols > (MaxAllocSize - VARHDRSZ - PROFILE_HDR_SZ)
+                           / hdr.col_size)
+        elog(ERROR, "profile of %d columns with %d buckets exceeds the "
+             "maximum allocation size", num_cols, num_top);
+    size = VARHDRSZ + PROFILE_HDR_SZ + (size_t)num_cols * hdr.col_size;
+
+    transblob = (bytea *)palloc0(size);
+    SET_VARSIZE(transblob, size);
+    tv = (profiletransval *)VARDATA(transblob);
+    memcpy(tv, &hdr, sizeof(hdr));
+    for (j = 0; j < num_cols; j++) {
+        memcpy(PROFILE_HLL(tv, j), hll, hdr.hll_size);
+        memcpy(PROFILE_SS(tv, j), ss, hdr.ss_size);
+    }
+    pfree(hll);
+    pfree(ss);
+
+    return transblob;
+}
+
+/*!
+ * count a non-null value of a column
+ * \param tv a profile transition value
+ * \param j column number
+ * \param val the text of the value
+ */
+static void profile_add_value(profiletransval *tv, uint32 j, text *val)
+{
+    profilecol     *col = PROFILE_COL(tv, j);
+    bytea          *hll = PROFILE_HLL(tv, j);
+    bytea          *ss = PROFILE_SS(tv, j);
+    profiledisplay *disp;
+    const char     *str = VARDATA_ANY(val);
+    int             len = VARSIZE_ANY_EXHDR(val);
+    uint64          hash = sketch_hash64(str, len, 0);
+    uint32          c;
+
+    col->count++;
+    /* the embedded sketches have a fixed size, so updates are in place */
+    if (hll_add_hash(hll, hash) != hll
+        || ss_insert(ss, Int64GetDatum((int64)hash), &c) != ss)
+        elog(ERROR, "profile sketch outgrew its transition state");
+
+    disp = &PROFILE_DISP(tv, j)[c];
+    if (disp->hash != hash || disp->text[0] == '\0') {
+        len = pg_mbcliplen(str, len, PROFILE_DISPLAY_LEN - 1);
+        memcpy(disp->text, str, len);
+        disp->text[len] = '\0';
+        disp->hash = hash;
+    }
+}
+
+/*!
+ * count a numeric value of a column
+ * \param tv a profile transition value
+ * \param j column number
+ * \param x the value
+ */
+static void profile_add_number(profiletransval *tv, uint32 j, float8 x)
+{
+    profilecol *col = PROFILE_COL(tv, j);
+    float8     *sample = PROFILE_SAMPLE(tv, j);
+
+    if (col->num_count == 0 || x < col->min)
+        col->min = x;
+    if (col->num_count == 0 || x > col->max)
+        col->max = x;
+    col->sum += x;
+
+    /* reservoir sampling (Vitter's Algorithm R) */
+    if (col->num_count < PROFILE_SAMPLE_SIZE)
+        sample[col->num_count] = x;
+    else {
+        uint64 r = profile_random(&tv->rng) % (col->num_count + 1);
+
+        if (r < PROFILE_SAMPLE_SIZE)
+            sample[r] = x;
+    }
+    col->num_count++;
+}
+
+PG_FUNCTION_INFO_V1(__profile_trans);
+
+/*!
+ * transition function of the profile aggregate
+ * \param 0 the transition value
+ * \param 1 text[] holding the values of all columns of a row
+ * \param 2 float8[] holding the numeric values of the columns, or NULL for
+ *        columns without numeric representation
+ * \param 3 number of buckets of the histograms
+ */
+Datum __profile_trans(PG_FUNCTION_ARGS)
+{
+    bytea           *transblob = PG_GETARG_BYTEA_P(0);
+    ArrayType       *vals = PG_GETARG_ARRAYTYPE_P(1);
+    ArrayType       *nums = PG_GETARG_ARRAYTYPE_P(2);
+    int              num_top = PG_GETARG_INT32(3);
+    profiletransval *tv;
+    Datum           *valelems, *numelems;
+    bool            *valnulls, *numnulls;
+    int              nvals, nnums;
+    int16            typLen;
+    bool             typByVal;
+    char             typAlign;
+    uint32           j;
+
+    /*
+     * This function makes destructive updates to its arguments.
+     * Make sure it's being called in an agg context.
+     */
+    if (!(fcinfo->context &&
+          (IsA(fcinfo->context, AggState)
+   #ifdef NOTGP
+           || IsA(fcinfo->context, WindowAggState)
+   #endif
+          )))
+        elog(ERROR,
+             "destructive pass by reference outside agg");
+
+    if (ARR_NDIM(vals) > 1 || ARR_NDIM(nums) > 1)
+        elog(ERROR, "profile expects one-dimensional arrays");
+    deconstruct_array(vals, TEXTOID, -1, false, 'i',
+                      &valelems, &valnulls, &nvals);
+    get_typlenbyvalalign(FLOAT8OID, &typLen, &typByVal, &typAlign);
+    deconstruct_array(nums, FLOAT8OID, typLen, typByVal, typAlign,
+                      &numelems, &numnulls, &nnums);
+    if (nvals != nnums)
+        elog(ERROR, "profile expects as many numeric values as columns");
+
+    /* initialize if this is first call */
+    if (VARSIZE(transblob) <= VARHDRSZ)
+        transblob = profile_init_transval(nvals, num_top);
+    else
+        check_profiletransval(transblob);
+
+    tv = (profiletransval *)VARDATA(transblob);
+    if ((uint32)nvals != tv->num_cols)
+        elog(ERROR, "all rows of a profile must have the same number of columns");
+
+    tv->rows++;
+    for (j = 0; j < tv->num_cols; j++) {
+        if (valnulls[j]) {
+            PROFILE_COL(tv, j)->nulls++;
+            continue;
+        }
+        profile_add_value(tv, j, (text *)DatumGetPointer(valelems[j]));
+        if (!numnulls[j])
+            profile_add_number(tv, j, DatumGetFloat8(numelems[j]));
+    }
+
+    PG_RETURN_BYTEA_P(transblob);
+}
+
+/*!
+ * merge the reservoir samples of two columns.  Each element of the result
+ * is drawn without replacement from the first sample with probability
+ * n1/(n1+n2), so that the result is again a uniform sample of the union.
+ * \param rng random number generator state
+ * \param s1 first sample, replaced by the result
+ * \param n1 number of values represented by the first sample
+ * \param s2 second sample, shuffled on return
+ * \param n2 number of values represented by the second sample
+ */
+static void profile_merge_samples(uint64 *rng, float8 *s1, uint64 n1,
+                                  float8 *s2, uint64 n2)
+{
+    float8 *out = (float8 *)palloc(PROFILE_SAMPLE_SIZE * sizeof(float8));
+    uint32  k1 = Min(n1, PROFILE_SAMPLE_SIZE);
+    uint32  k2 = Min(n2, PROFILE_SAMPLE_SIZE);
+    uint32  i1 = 0, i2 = 0, m = Min(k1 + k2, PROFILE_SAMPLE_SIZE), i;
+    double  p1 = (double)n1 / ((double)n1 + (double)n2);
+
+    for (i = 0; i < m; i++) {
+        float8 *s;
+        uint32 *pos, k, r;
+        float8  tmp;
+        bool    first;
+
+        if (i1 == k1)
+            first = false;
+        else if (i2 == k2)
+            first = true;
+        else
+            first = (profile_random(rng) >> 11) * (1.0 / 9007199254740992.0)
+                    < p1;
+
+        /* pick a random element among those not yet taken */
+        s = first ? s1 : s2;
+        pos = first ? &i1 : &i2;
+        k = first ? k1 : k2;
+        r = *pos + (uint32)(profile_random(rng) % (k - *pos));
+        tmp = s[r];
+        s[r] = s[*pos];
+        s[*pos] = tmp;
+        out[i] = s[(*pos)++];
+    }
+    memcpy(s1, out, m * sizeof(float8));
+    pfree(out);
+}
+
+/*!
+ * merge column <c>j</c> of a profile transition value into another one
+ * \param tv1 profile transition value, updated in place
+ * \param tv2 profile transition value of the same shape
+ * \param j column number
+ */
+static void profile_merge_column(profiletransval *tv1, profiletransval *tv2,
+                                 uint32 j)
+{
+    profilecol     *col1 = PROFILE_COL(tv1, j);
+    profilecol     *col2 = PROFILE_COL(tv2, j);
+    bytea          *ss1 = PROFILE_SS(tv1, j);
+    bytea          *ss2 = PROFILE_SS(tv2, j);
+    bytea          *merged;
+    profiledisplay *disp1 = PROFILE_DISP(tv1, j);
+    profiledisplay *disp2 = PROFILE_DISP(tv2, j);
+    profiledisplay *disp;
+    sstransval     *mtv;
+    uint32          c;
+    int             k;
+
+    if (hll_union_c(PROFILE_HLL(tv1, j), PROFILE_HLL(tv2, j))
+        != PROFILE_HLL(tv1, j))
+        elog(ERROR, "profile sketch outgrew its transition state");
+
+    /* look up the text of each surviving counter before overwriting ss1 */
+    merged = ss_merge_c(ss1, ss2);
+    if (VARSIZE(merged) != tv1->ss_size)
+        elog(ERROR, "profile sketch outgrew its transition state");
+    mtv = (sstransval *)VARDATA(merged);
+    disp = (profiledisplay *)palloc0(tv1->max_mfvs * sizeof(profiledisplay));
+    for (c = 0; c < mtv->num_mfvs; c++) {
+        Datum val = ss_value(merged, c);
+
+        if ((k = ss_lookup(ss1, val)) >= 0)
+            disp[c] = disp1[k];
+        else if ((k = ss_lookup(ss2, val)) >= 0)
+            disp[c] = disp2[k];
+    }
+    memcpy(ss1, merged, tv1->ss_size);
+    memcpy(disp1, disp, tv1->max_mfvs * sizeof(profiledisplay));
+    pfree(disp);
+
+    if (col2->num_count > 0)
+        profile_merge_samples(&tv1->rng, PROFILE_SAMPLE(tv1, j),
+                              col1->num_count, PROFILE_SAMPLE(tv2, j),
+                              col2->num_count);
+    if (col2->num_count > 0) {
+        col1->min = col1->num_count > 0 ? Min(col1->min, col2->min) : col2->min;
+        col1->max = col1->num_count > 0 ? Max(col1->max, col2->max) : col2->max;
+    }
+    col1->count += col2->count;
+    col1->nulls += col2->nulls;
+    col1->num_count += col2->num_count;
+    col1->sum += col2->sum;
+}
+
+PG_FUNCTION_INFO_V1(__profile_merge);
+
+/*!
+ * Greenplum "prefunc" to combine profile transition values from multiple
+ * machines
+ */
+Datum __profile_merge(PG_FUNCTION_ARGS)
+{
+    bytea           *transblob1 = PG_GETARG_BYTEA_P(0);
+    bytea           *transblob2 = PG_GETARG_BYTEA_P(1);
+    profiletransval *tv1, *tv2;
+    uint32           j;
+
+    /* handle uninitialized args */
+    if (VARSIZE(transblob1) <= VARHDRSZ)
+        PG_RETURN_BYTEA_P(transblob2);
+    if (VARSIZE(transblob2) <= VARHDRSZ)
+        PG_RETURN_BYTEA_P(transblob1);
+
+    check_profiletransval(transblob1);
+    check_profiletransval(transblob2);
+    tv1 = (profiletransval *)VARDATA(transblob1);
+    tv2 = (profiletransval *)VARDATA(transblob2);
+    if (tv1->num_cols != tv2->num_cols || tv1->num_top != tv2->num_top
+        || tv1->col_size != tv2->col_size)
+        elog(ERROR, "cannot merge profiles of different shape");
+    check_profilesketches(transblob1);
+    check_profilesketches(transblob2);
+
+    /* the first argument is a transition value of ours, so update it */
+    for (j = 0; j < tv1->num_cols; j++)
+        profile_merge_column(tv1, tv2, j);
+    tv1->rows += tv2->rows;
+
+    PG_RETURN_BYTEA_P(transblob1);
+}
+
+/*!
+ * support function to sort float8 values
+ */
+static int profile_float8_cmp(const void *i, const void *j)
+{
+    float8 a = *(const float8 *)i;
+    float8 b = *(const float8 *)j;
+
+    return (a > b) - (a < b);
+}
+
+/*!
+ * \param sorted sorted sample of n > 0 values
+ * \param q a quantile in [0,1]
+ * \returns the linearly interpolated q-quantile of the sample
+ */
+static float8 profile_quantile(const float8 *sorted, uint32 n, double q)
+{
+    double pos = q * (n - 1);
+    uint32 lo = (uint32)pos;
+
+    if (lo + 1 >= n)
+        return sorted[n - 1];
+    return sorted[lo] + (pos - lo) * (sorted[lo + 1] - sorted[lo]);
+}
+
+/*!
+ * \returns the output of float8out for x
+ */
+static char *profile_float8_str(float8 x)
+{
+    return DatumGetCString(DirectFunctionCall1(float8out, Float8GetDatum(x)));
+}
+
+/*!
+ * \returns the histogram bucket "lo:hi:count" as a text Datum
+ */
+static Datum profile_bucket(float8 lo, float8 hi, uint64 cnt)
+{
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf, "%s:%s:" UINT64_FORMAT,
+                     profile_float8_str(lo), profile_float8_str(hi), cnt);
+    return PointerGetDatum(cstring_to_text(buf.data));
+}
+
+/*!
+ * \param elems text Datums
+ * \param n number of elements
+ * \param arrayOutOid output function of text[]
+ * \returns the text[] of the elements, formatted by its output function
+ */
+static Datum profile_text_list(Datum *elems, int n, Oid arrayOutOid)
+{
+    ArrayType *arr = construct_array(elems, n, TEXTOID, -1, false, 'i');
+
+    return PointerGetDatum(cstring_to_text(
+        OidOutputFunctionCall(arrayOutOid, PointerGetDatum(arr))));
+}
+
+/*!
+ * compute the numeric output fields of a column
+ * \param tv a profile transition value
+ * \param j column number
+ * \param out the PROFILE_NUM_FIELDS output fields of the column
+ * \param nulls null flags of the output fields
+ * \param arrayOutOid output function of text[]
+ */
+static void profile_numeric_fields(profiletransval *tv, uint32 j, Datum *out,
+                                   bool *nulls, Oid arrayOutOid)
+{
+    profilecol *col = PROFILE_COL(tv, j);
+    uint32      n = Min(col->num_count, PROFILE_SAMPLE_SIZE);
+    uint32      nbuckets = tv->num_top, b, i;
+    float8     *sorted = (float8 *)palloc(n * sizeof(float8));
+    Datum      *buckets = (Datum *)palloc(nbuckets * sizeof(Datum));
+    uint64     *cnt = (uint64 *)palloc0(nbuckets * sizeof(uint64));
+    double      scale = (double)col->num_count / n;
+    float8      width = (col->max - col->min) / nbuckets;
+
+    memcpy(sorted, PROFILE_SAMPLE(tv, j), n * sizeof(float8));
+    qsort(sorted, n, sizeof(float8), profile_float8_cmp);
+
+    out[3] = PointerGetDatum(cstring_to_text(profile_float8_str(col->min)));
+    out[4] = PointerGetDatum(cstring_to_text(profile_float8_str(col->max)));
+    out[5] = PointerGetDatum(cstring_to_text(
+        profile_float8_str(col->sum / col->num_count)));
+    out[6] = PointerGetDatum(cstring_to_text(
+        profile_float8_str(profile_quantile(sorted, n, 0.5))));
+
+    /* equal-depth buckets; the outer boundaries are the exact extremes */
+    for (b = 0; b < nbuckets; b++) {
+        float8 lo = b == 0 ? col->min
+                    : profile_quantile(sorted, n, (double)b / nbuckets);
+        float8 hi = b + 1 == nbuckets ? col->max
+                    : profile_quantile(sorted, n, (double)(b + 1) / nbuckets);
+        uint64 depth = col->num_count * (b + 1) / nbuckets
+                       - col->num_count * b / nbuckets;
+
+        buckets[b] = profile_bucket(lo, hi, depth);
+    }
+    out[7] = profile_text_list(buckets, nbuckets, arrayOutOid);
+    nulls[7] = false;
+
+    /* equal-width buckets, counts extrapolated from the sample */
+    for (i = 0; i < n; i++) {
+        b = width > 0 ? (uint32)((sorted[i] - col->min) / width) : 0;
+        cnt[Min(b, nbuckets - 1)]++;
+    }
+    for (b = 0; b < nbuckets; b++)
+        buckets[b] = profile_bucket(col->min + b * width,
+                                    b + 1 == nbuckets ? col->max
+                                    : col->min + (b + 1) * width,
+                                    (uint64)(cnt[b] * scale + 0.5));
+    out[8] = profile_text_list(buckets, nbuckets, arrayOutOid);
+    nulls[8] = false;
+
+    for (i = 3; i <= 6; i++)
+        nulls[i] = false;
+    pfree(sorted);
+    pfree(buckets);
+    pfree(cnt);
+}
+
+PG_FUNCTION_INFO_V1(__profile_final);
+
+/*!
+ * final function of the profile aggregate
+ * \returns a one-dimensional text[] with PROFILE_NUM_FIELDS fields per
+ * column: number of non-null values, number of nulls, number of distinct
+ * values, min, max, avg, median, equal-depth histogram and equal-width
+ * histogram (lists of "lo:hi:count") and most frequent values (a list of
+ * "value:count").  Numeric fields are NULL for columns without numeric
+ * values.
+ */
+Datum __profile_final(PG_FUNCTION_ARGS)
+{
+    bytea           *transblob = PG_GETARG_BYTEA_P(0);
+    profiletransval *tv;
+    Datum           *out;
+    bool            *nulls;
+    Datum           *mfvs;
+    uint32          *order;
+    Oid              arrayOutOid;
+    bool             typIsVarlena;
+    int              dims[1], lbs[1];
+    uint32           j, i, n;
+    char             countbuf[MAXINT8LEN + 1];
+
+    if (VARSIZE(transblob) <= VARHDRSZ) PG_RETURN_NULL();
+
+    check_profiletransval(transblob);
+    check_profilesketches(transblob);
+    tv = (profiletransval *)VARDATA(transblob);
+
+    getTypeOutputInfo(get_array_type(TEXTOID), &arrayOutOid, &typIsVarlena);
+    out = (Datum *)palloc0((size_t)tv->num_cols * PROFILE_NUM_FIELDS
+                           * sizeof(Datum));
+    nulls = (bool *)palloc((size_t)tv->num_cols * PROFILE_NUM_FIELDS
+                           * sizeof(bool));
+    memset(nulls, true, (size_t)tv->num_cols * PROFILE_NUM_FIELDS);
+    order = (uint32 *)palloc(tv->max_mfvs * sizeof(uint32));
+    mfvs = (Datum *)palloc(tv->num_top * sizeof(Datum));
+
+    for (j = 0; j < tv->num_cols; j++) {
+        profilecol     *col = PROFILE_COL(tv, j);
+        Datum          *f = out + (size_t)j * PROFILE_NUM_FIELDS;
+        bool           *fnulls = nulls + (size_t)j * PROFILE_NUM_FIELDS;
+        bytea          *ss = PROFILE_SS(tv, j);
+        profiledisplay *disp = PROFILE_DISP(tv, j);
+        uint64          dcount;
+
+        snprintf(countbuf, sizeof(countbuf), UINT64_FORMAT, col->count);
+        f[0] = PointerGetDatum(cstring_to_text(countbuf));
+        snprintf(countbuf, sizeof(countbuf), UINT64_FORMAT, col->nulls);
+        f[1] = PointerGetDatum(cstring_to_text(countbuf));
+        dcount = (uint64)(hll_estimate_c(PROFILE_HLL(tv, j)) + 0.5);
+        snprintf(countbuf, sizeof(countbuf), UINT64_FORMAT,
+                 Min(dcount, col->count));
+        f[2] = PointerGetDatum(cstring_to_text(countbuf));
+        fnulls[0] = fnulls[1] = fnulls[2] = false;
+
+        if (col->num_count > 0)
+            profile_numeric_fields(tv, j, f, fnulls, arrayOutOid);
+
+        n = Min(ss_sorted_counters(ss, order), tv->num_top);
+        if (n > 0) {
+            for (i = 0; i < n; i++) {
+                StringInfoData buf;
+
+                initStringInfo(&buf);
+                appendStringInfo(&buf, "%s:" UINT64_FORMAT,
+                                 disp[order[i]].text, ss_count(ss, order[i]));
+                mfvs[i] = PointerGetDatum(cstring_to_text(buf.data));
+            }
+            f[9] = profile_text_list(mfvs, n, arrayOutOid);
+            fnulls[9] = false;
+        }
+    }
+
+    dims[0] = tv->num_cols * PROFILE_NUM_FIELDS;
+    lbs[0] = 1;
+    PG_RETURN_ARRAYTYPE_P(construct_md_array(out, nulls, 1, dims, lbs,
+                                             TEXTOID, -1, false, 'i'));
+}
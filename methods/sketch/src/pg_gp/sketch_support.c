@@ -450,6 +450,74 @@ size_t ExtractDatumLen(Datum x, int len, bool byVal, size_t capacity)
     return size;
 }
 
+/*!
+ * 64-bit MurmurHash2 (MurmurHash64A) by Austin Appleby, public domain.
+ * Much cheaper than md5 and with good enough avalanche behavior for sketches
+ * that only need uniformly distributed bits.
+ * \param key pointer to the bytes to be hashed
+ * \param len number of bytes
+ * \param seed hash seed
+ */
+uint64 sketch_hash64(const void *key, size_t len, uint64 seed)
+{
+    const uint64  m = UINT64CONST(0xc6a4a7935bd1e995);
+    const int     r = 47;
+    const uint8  *data = (const uint8 *)key;
+    const uint8  *end = data + (len & ~(size_t)7);
+    uint64        h = seed ^ (len * m);
+    uint64        k;
+
+    for (; data != end; data += 8) {
+        memcpy(&k, data, sizeof(uint64));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len & 7) {
+        case 7: h ^= (uint64)data[6] << 48;
+                /* FALLTHROUGH */
+        case 6: h ^= (uint64)data[5] << 40;
+                /* FALLTHROUGH */
+        case 5: h ^= (uint64)data[4] << 32;
+                /* FALLTHROUGH */
+        case 4: h ^= (uint64)data[3] << 24;
+                /* FALLTHROUGH */
+        case 3: h ^= (uint64)data[2] << 16;
+                /* FALLTHROUGH */
+        case 2: h ^= (uint64)data[1] << 8;
+                /* FALLTHROUGH */
+        case 1: h ^= (uint64)data[0];
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+/*!
+ * Hash the binary representation of a datum.  Unlike sketch_md5_bytea, the
+ * header of variable-length types is not hashed, so that short and regular
+ * varlena headers of the same value hash alike.
+ * \param dat a Postgres Datum
+ * \param typLen Postgres type length
+ * \param typByVal Postgres typByVal flag
+ */
+uint64 sketch_hash_datum(Datum dat, int typLen, bool typByVal)
+{
+    if (typLen == -1) {
+        struct varlena *v = PG_DETOAST_DATUM_PACKED(dat);
+
+        return sketch_hash64(VARDATA_ANY(v), VARSIZE_ANY_EXHDR(v), 0);
+    }
+    return sketch_hash64(DatumExtractPointer(dat, typByVal),
+                         ExtractDatumLen(dat, typLen, typByVal, -1), 0);
+}
+
 /*
  * walk an array of int64s and convert word order of int64s to big-endian
  * if force == true, convert even if this arch is big-endian
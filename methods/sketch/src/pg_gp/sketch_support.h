@@ -30,4 +30,6 @@ void   int64_big_endianize(uint64 *, uint32, bool);
 #define DatumExtractPointer(x, byVal)  (byVal ? (void *)&x : DatumGetPointer(x))
 
 size_t ExtractDatumLen(Datum x, int len, bool byVal, size_t capacity);
+uint64 sketch_hash64(const void *key, size_t len, uint64 seed);
+uint64 sketch_hash_datum(Datum dat, int typLen, bool typByVal);
 #endif /* SKETCH_SUPPORT_H */
@@ -0,0 +1,882 @@
+/*!
+ * \file spacesaving.c
+
+ \brief Space-Saving sketch for Most Frequent Value estimation
+ \implementation
+ This is the Space-Saving algorithm of Metwally, Agrawal and El Abbadi: a
+ fixed number of counters monitors the values seen so far.  A value that is
+ already monitored has its counter incremented.  Otherwise, if all counters are
+ taken, the counter with the smallest count is handed over to the new value,
+ which inherits (and increments) its count.  The inherited count is remembered
+ as the maximal overestimation of the new value.  With m counters, every value
+ whose frequency exceeds N/m is guaranteed to be monitored, and each count is
+ overestimated by at most N/m.
+
+ Unlike the CountMin-based <c>mfvsketch_top_histogram</c>, each update costs
+ O(1) regardless of the number of buckets:
+  - monitored values are found through an open-addressed hash table (linear
+    probing, backward-shift deletion) over 64-bit hashes of the values,
+  - counters are kept in the "Stream-Summary" structure: groups of counters
+    with equal count in a list sorted by count, so that incrementing a counter
+    and locating the minimum are constant time,
+  - the storage of evicted values is reclaimed by compacting the storage
+    area in place when it runs full; the transition value is only reallocated
+    when the live values need more room.
+
+ Sketches built in parallel are combined as in the "mergeable summaries" of
+ Agarwal et al.: a value missing from a full sketch is credited with that
+ sketch's minimum count, and the m largest combined counters are kept.  The
+ error guarantee of the merged sketch is that of a single sketch over the union
+ of the inputs, so unlike <c>mfvsketch_quick_histogram</c> no heuristic is
+ involved.
+ */
+
+#include <postgres.h>
+#include <utils/array.h>
+#include <utils/elog.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <nodes/execnodes.h>
+#include <fmgr.h>
+#include <catalog/pg_type.h>
+#include "sketch_support.h"
+#include "spacesaving.h"
+
+#include <string.h>
+
+/*! a counter of one of the sketches to be merged */
+typedef struct {
+    Datum  val;
+    uint64 hash;
+    uint64 cnt;
+    uint64 err;
+} sscandidate;
+
+/*!
+ * check whether the content in the given bytea is safe for sstransval
+ * \param storage a bytea holding a Space-Saving transval
+ */
+void check_sstransval(bytea *storage)
+{
+    sstransval *tv;
+    Oid         outFuncOid;
+    bool        typIsVarLen;
+
+    if (VARSIZE(storage) < VARHDRSZ + sizeof(sstransval))
+        elog(ERROR, "invalid transition state for mfvsketch");
+    tv = (sstransval *)VARDATA(storage);
+
+    if (tv->max_mfvs == 0 || tv->num_mfvs > tv->max_mfvs
+        || tv->table_size < tv->max_mfvs
+        || (tv->table_size & (tv->table_size - 1)) != 0
+        || (tv->min_group != SS_NIL && tv->min_group >= tv->max_mfvs)
+        || VARSIZE(storage) < SS_TRANSVAL_SZ(tv->max_mfvs, tv->table_size)
+        || tv->next_offset < SS_STORAGE_START(tv->max_mfvs, tv->table_size)
+        || tv->next_offset + VARHDRSZ > VARSIZE(storage))
+        elog(ERROR, "invalid transition state for mfvsketch");
+
+    if (InvalidOid == tv->typOid)
+        elog(ERROR, "invalid transition state for mfvsketch");
+
+    getTypeOutputInfo(tv->typOid, &outFuncOid, &typIsVarLen);
+    if (tv->outFuncOid != outFuncOid
+        || tv->typLen != get_typlen(tv->typOid)
+        || tv->typByVal != get_typbyval(tv->typOid))
+        elog(ERROR, "invalid transition state for mfvsketch");
+}
+
+/*!
+ * Initialize a Space-Saving sketch
+ * \param num_top the number of "bins" in the histogram
+ * \param max_mfvs the number of counters
+ * \param typOid the type ID for the column
+ */
+bytea *ss_init_transval(int num_top, int max_mfvs, Oid typOid)
+{
+    bytea      *transblob;
+    sstransval *tv;
+    ssgroup    *groups;
+    uint32      table_size = 1;
+    size_t      initial_size;
+    int         typLen = get_typlen(typOid);
+    bool        typIsVarLen;
+    int         i;
+
+    /* keep the load factor of the hash table at or below one half */
+    while (table_size < 2 * (uint32)max_mfvs)
+        table_size <<= 1;
+
+    /*
+     * if typlen is positive (fixed), size chosen accurately.
+     * Else we'll do a conservative estimate of 16 bytes, and grow as needed.
+     */
+    if (get_typbyval(typOid))
+        initial_size = max_mfvs * MAXALIGN(sizeof(Datum));
+    else if (typLen > 0)
+        initial_size = max_mfvs * MAXALIGN(typLen);
+    else
+        initial_size = max_mfvs * 16;
+
+    transblob = (bytea *)palloc0(SS_TRANSVAL_SZ(max_mfvs, table_size)
+                                 + initial_size);
+    SET_VARSIZE(transblob, SS_TRANSVAL_SZ(max_mfvs, table_size) + initial_size);
+
+    tv = (sstransval *)VARDATA(transblob);
+    tv->max_mfvs = max_mfvs;
+    tv->num_mfvs = 0;
+    tv->num_top = num_top;
+    tv->table_size = table_size;
+    tv->min_group = SS_NIL;
+    tv->next_offset = SS_STORAGE_START(max_mfvs, table_size);
+    tv->garbage = 0;
+    tv->total = 0;
+    tv->typOid = typOid;
+    getTypeOutputInfo(tv->typOid, &(tv->outFuncOid), &typIsVarLen);
+    tv->typLen = typLen;
+    tv->typByVal = get_typbyval(typOid);
+    if (!tv->outFuncOid) {
+        /* no outFunc for this type! */
+        elog(ERROR, "no outFunc for type %d", tv->typOid);
+    }
+
+    /* all groups start out on the free list */
+    groups = SS_GROUPS(tv);
+    tv->free_group = 0;
+    for (i = 0; i < max_mfvs; i++)
+        groups[i].next = (i + 1 < max_mfvs) ? (uint32)(i + 1) : SS_NIL;
+
+    return transblob;
+}
+
+/*!
+ * \param tv a Space-Saving transval
+ * \param dat pointer to a value of the sketch's type; varlena values must not
+ *        be toasted
+ * \param len set to the number of bytes identifying the value
+ * \returns pointer to the bytes identifying the value
+ */
+static const char *ss_key(sstransval *tv, const Datum *dat, size_t *len)
+{
+    if (tv->typByVal) {
+        *len = tv->typLen;
+        return (const char *)dat;
+    }
+    else if (tv->typLen > 0) {
+        *len = tv->typLen;
+        return DatumGetPointer(*dat);
+    }
+    else if (tv->typLen == -1) {
+        *len = VARSIZE_ANY_EXHDR(DatumGetPointer(*dat));
+        return VARDATA_ANY(DatumGetPointer(*dat));
+    }
+    else {
+        *len = strlen(DatumGetCString(*dat)) + 1;
+        return DatumGetCString(*dat);
+    }
+}
+
+/*!
+ * \param tv a Space-Saving transval
+ * \param offset location of a stored value
+ * \returns the number of bytes the value occupies in the storage area
+ */
+static size_t ss_stored_len(sstransval *tv, uint32 offset)
+{
+    char *ptr = (char *)tv + offset;
+
+    if (tv->typByVal)
+        return sizeof(Datum);
+    else if (tv->typLen > 0)
+        return tv->typLen;
+    else if (tv->typLen == -1)
+        return VARSIZE(ptr);
+    else
+        return strlen(ptr) + 1;
+}
+
+/*!
+ * \param tv a Space-Saving transval
+ * \param c index of a counter in use
+ * \returns the value monitored by the counter
+ */
+static Datum ss_getval(sstransval *tv, uint32 c)
+{
+    uint32 offset = SS_COUNTERS(tv)[c].offset;
+    char  *ptr = (char *)tv + offset;
+    Datum  dat;
+
+    if (offset < SS_STORAGE_START(tv->max_mfvs, tv->table_size)
+        || offset + ss_stored_len(tv, offset) > tv->next_offset)
+        elog(ERROR, "illegal offset %u in mfv sketch", offset);
+
+    if (tv->typByVal) {
+        memcpy(&dat, ptr, sizeof(Datum));
+        return dat;
+    }
+    return PointerGetDatum(ptr);
+}
+
+/*!
+ * support function to sort (offset, counter) pairs by offset
+ */
+static int ss_offset_cmp(const void *i, const void *j)
+{
+    const uint32 *o = (const uint32 *)i;
+    const uint32 *p = (const uint32 *)j;
+
+    return (o[0] > p[0]) - (o[0] < p[0]);
+}
+
+/*!
+ * make room for a value of <c>len</c> bytes in the storage area.  The values
+ * of evicted counters are compacted away, in place as long as at least half
+ * of the storage area is then free.  Otherwise the blob is reallocated with
+ * twice the live storage.  Counters whose offset is zero have no value.
+ * \param transblob a bytea holding a Space-Saving transval
+ * \param len number of bytes needed
+ * \returns the (possibly reallocated) transblob
+ */
+static bytea *ss_reserve(bytea *transblob, size_t len)
+{
+    sstransval *tv = (sstransval *)VARDATA(transblob);
+    size_t      start = SS_STORAGE_START(tv->max_mfvs, tv->table_size);
+    size_t      capacity = VARSIZE(transblob) - VARHDRSZ;
+    size_t      live, newcap;
+    sstransval *newtv = tv;
+    sscounter  *counters;
+    uint32     *byoffset;
+    uint32      i, n;
+
+    len = MAXALIGN(len);
+    if (tv->next_offset + len <= capacity)
+        return transblob;
+
+    live = tv->next_offset - start - tv->garbage;
+    newcap = start + 2 * (live + len);
+    if (newcap > capacity) {
+        bytea *newblob;
+
+        if (newcap + VARHDRSZ > MaxAllocSize)
+            elog(ERROR, "mfv sketch exceeds the maximum allocation size");
+        newblob = (bytea *)palloc0(newcap + VARHDRSZ);
+        SET_VARSIZE(newblob, newcap + VARHDRSZ);
+        newtv = (sstransval *)VARDATA(newblob);
+        memcpy(newtv, tv, start);
+        /*
+         * PG won't let us pfree the old transblob
+         * pfree(transblob);
+         */
+        transblob = newblob;
+    }
+
+    /* move the live values to the front, in order of their offset */
+    counters = SS_COUNTERS(newtv);
+    byoffset = (uint32 *)palloc(2 * newtv->num_mfvs * sizeof(uint32));
+    for (i = n = 0; i < newtv->num_mfvs; i++) {
+        if (counters[i].offset == 0)
+            continue;
+        byoffset[2 * n] = counters[i].offset;
+        byoffset[2 * n + 1] = i;
+        n++;
+    }
+    qsort(byoffset, n, 2 * sizeof(uint32), ss_offset_cmp);
+
+    newtv->next_offset = start;
+    newtv->garbage = 0;
+    for (i = 0; i < n; i++) {
+        uint32 c = byoffset[2 * i + 1];
+        size_t vlen = ss_stored_len(tv, counters[c].offset);
+
+        memmove((char *)newtv + newtv->next_offset,
+                (char *)tv + counters[c].offset, vlen);
+        counters[c].offset = newtv->next_offset;
+        newtv->next_offset += MAXALIGN(vlen);
+    }
+    pfree(byoffset);
+
+    return transblob;
+}
+
+/*!
+ * copy a value into the storage area and associate it with counter <c>c</c>
+ * \param transblob a bytea holding a Space-Saving transval
+ * \param dat the value; varlena values must not be toasted
+ * \param c index of the counter, whose offset must be zero unless the type
+ *        has a fixed length
+ * \returns the (possibly reallocated) transblob
+ */
+static bytea *ss_store(bytea *transblob, Datum dat, uint32 c)
+{
+    sstransval *tv = (sstransval *)VARDATA(transblob);
+    size_t      len;
+    char       *ptr;
+
+    if (tv->typByVal)
+        len = sizeof(Datum);
+    else if (tv->typLen > 0)
+        len = tv->typLen;
+    else if (tv->typLen == -1)
+        len = VARSIZE_ANY_EXHDR(DatumGetPointer(dat)) + VARHDRSZ;
+    else
+        len = strlen(DatumGetCString(dat)) + 1;
+
+    /* values of fixed length simply overwrite the value they replace */
+    if (SS_COUNTERS(tv)[c].offset != 0)
+        ptr = (char *)tv + SS_COUNTERS(tv)[c].offset;
+    else {
+        transblob = ss_reserve(transblob, len);
+        tv = (sstransval *)VARDATA(transblob);
+        ptr = (char *)tv + tv->next_offset;
+        SS_COUNTERS(tv)[c].offset = tv->next_offset;
+        tv->next_offset += MAXALIGN(len);
+    }
+
+    if (tv->typByVal)
+        memcpy(ptr, &dat, sizeof(Datum));
+    else if (tv->typLen == -1) {
+        /* always store with a regular header, so the value can be handed out */
+        SET_VARSIZE(ptr, len);
+        memcpy(VARDATA(ptr), VARDATA_ANY(DatumGetPointer(dat)), len - VARHDRSZ);
+    }
+    else
+        memcpy(ptr, DatumGetPointer(dat), len);
+
+    return transblob;
+}
+
+/*!
+ * look to see if the sketch currently monitors <c>dat</c>
+ * \param tv a Space-Saving transval
+ * \param dat pointer to the value to search for
+ * \param hash hash of the value
+ * \returns the index of the counter, or -1 if not found
+ */
+static int ss_find(sstransval *tv, const Datum *dat, uint64 hash)
+{
+    sscounter  *counters = SS_COUNTERS(tv);
+    uint32     *slots = SS_SLOTS(tv);
+    uint32      mask = tv->table_size - 1;
+    uint32      pos = (uint32)hash & mask;
+    size_t      len, curlen;
+    const char *key = ss_key(tv, dat, &len);
+    const char *curkey;
+
+    for (; slots[pos] != 0; pos = (pos + 1) & mask) {
+        uint32 c = slots[pos] - 1;
+        Datum  cur;
+
+        if (counters[c].hash != hash)
+            continue;
+        cur = ss_getval(tv, c);
+        curkey = ss_key(tv, &cur, &curlen);
+        if (curlen == len && memcmp(curkey, key, len) == 0)
+            return c;
+    }
+    return -1;
+}
+
+/*!
+ * add counter <c>c</c> to the hash table
+ */
+static void ss_hash_insert(sstransval *tv, uint32 c)
+{
+    uint32 *slots = SS_SLOTS(tv);
+    uint32  mask = tv->table_size - 1;
+    uint32  pos = (uint32)SS_COUNTERS(tv)[c].hash & mask;
+
+    while (slots[pos] != 0)
+        pos = (pos + 1) & mask;
+    slots[pos] = c + 1;
+}
+
+/*!
+ * remove counter <c>c</c> from the hash table.  Following entries of the
+ * probe sequence are shifted back, so no tombstones are needed.
+ */
+static void ss_hash_delete(sstransval *tv, uint32 c)
+{
+    sscounter *counters = SS_COUNTERS(tv);
+    uint32    *slots = SS_SLOTS(tv);
+    uint32     mask = tv->table_size - 1;
+    uint32     pos = (uint32)counters[c].hash & mask;
+    uint32     next, home;
+
+    while (slots[pos] != c + 1)
+        pos = (pos + 1) & mask;
+
+    for (next = (pos + 1) & mask; slots[next] != 0; next = (next + 1) & mask) {
+        home = (uint32)counters[slots[next] - 1].hash & mask;
+        /* the entry may move to pos unless its home is cyclically in (pos, next] */
+        if (pos <= next ? (home <= pos || home > next)
+                        : (home <= pos && home > next)) {
+            slots[pos] = slots[next];
+            pos = next;
+        }
+    }
+    slots[pos] = 0;
+}
+
+/*!
+ * take a group off the free list and link it into the list of groups
+ * \param tv a Space-Saving transval
+ * \param cnt count of the new group
+ * \param prev the group to insert after, or SS_NIL to insert at the front
+ * \returns index of the new group
+ */
+static uint32 ss_new_group(sstransval *tv, uint64 cnt, uint32 prev)
+{
+    ssgroup *groups = SS_GROUPS(tv);
+    uint32   g = tv->free_group;
+
+    if (g == SS_NIL)
+        elog(ERROR, "invalid transition state for mfvsketch");
+    tv->free_group = groups[g].next;
+
+    groups[g].cnt = cnt;
+    groups[g].head = SS_NIL;
+    groups[g].prev = prev;
+    if (prev == SS_NIL) {
+        groups[g].next = tv->min_group;
+        tv->min_group = g;
+    }
+    else {
+        groups[g].next = groups[prev].next;
+        groups[prev].next = g;
+    }
+    if (groups[g].next != SS_NIL)
+        groups[groups[g].next].prev = g;
+    return g;
+}
+
+/*!
+ * unlink an empty group and put it back on the free list
+ */
+static void ss_free_group(sstransval *tv, uint32 g)
+{
+    ssgroup *groups = SS_GROUPS(tv);
+
+    if (groups[g].prev == SS_NIL)
+        tv->min_group = groups[g].next;
+    else
+        groups[groups[g].prev].next = groups[g].next;
+    if (groups[g].next != SS_NIL)
+        groups[groups[g].next].prev = groups[g].prev;
+
+    groups[g].next = tv->free_group;
+    tv->free_group = g;
+}
+
+/*!
+ * make counter <c>c</c> a member of group <c>g</c>
+ */
+static void ss_attach(sstransval *tv, uint32 c, uint32 g)
+{
+    sscounter *counters = SS_COUNTERS(tv);
+    ssgroup   *groups = SS_GROUPS(tv);
+
+    counters[c].group = g;
+    counters[c].prev = SS_NIL;
+    counters[c].next = groups[g].head;
+    if (groups[g].head != SS_NIL)
+        counters[groups[g].head].prev = c;
+    groups[g].head = c;
+}
+
+/*!
+ * remove counter <c>c</c> from its group
+ */
+static void ss_detach(sstransval *tv, uint32 c)
+{
+    sscounter *counters = SS_COUNTERS(tv);
+    ssgroup   *groups = SS_GROUPS(tv);
+
+    if (counters[c].prev == SS_NIL)
+        groups[counters[c].group].head = counters[c].next;
+    else
+        counters[counters[c].prev].next = counters[c].next;
+    if (counters[c].next != SS_NIL)
+        counters[counters[c].next].prev = counters[c].prev;
+}
+
+/*!
+ * increment the count of counter <c>c</c> by one
+ */
+static void ss_increment(sstransval *tv, uint32 c)
+{
+    ssgroup *groups = SS_GROUPS(tv);
+    uint32   g = SS_COUNTERS(tv)[c].group;
+    uint32   next = groups[g].next;
+    uint64   cnt = groups[g].cnt + 1;
+
+    ss_detach(tv, c);
+    if (next != SS_NIL && groups[next].cnt == cnt) {
+        ss_attach(tv, c, next);
+        if (groups[g].head == SS_NIL)
+            ss_free_group(tv, g);
+    }
+    else if (groups[g].head == SS_NIL) {
+        /* c was alone in its group, which can simply move up */
+        groups[g].cnt = cnt;
+        ss_attach(tv, c, g);
+    }
+    else
+        ss_attach(tv, c, ss_new_group(tv, cnt, g));
+}
+
+/*!
+ * look up the counter of a value
+ * \param transblob a bytea holding a Space-Saving transval
+ * \param dat the value; varlena values must not be toasted
+ * \returns the index of the counter, or -1 if the value is not monitored
+ */
+int ss_lookup(bytea *transblob, Datum dat)
+{
+    sstransval *tv = (sstransval *)VARDATA(transblob);
+
+    return ss_find(tv, &dat, sketch_hash_datum(dat, tv->typLen, tv->typByVal));
+}
+
+/*!
+ * \param transblob a bytea holding a Space-Saving transval
+ * \param c index of a counter in use
+ * \returns the count of the counter
+ */
+uint64 ss_count(bytea *transblob, uint32 c)
+{
+    sstransval *tv = (sstransval *)VARDATA(transblob);
+
+    return SS_GROUPS(tv)[SS_COUNTERS(tv)[c].group].cnt;
+}
+
+/*!
+ * \param transblob a bytea holding a Space-Saving transval
+ * \param c index of a counter in use
+ * \returns the value monitored by the counter
+ */
+Datum ss_value(bytea *transblob, uint32 c)
+{
+    return ss_getval((sstransval *)VARDATA(transblob), c);
+}
+
+/*!
+ * list the counters in use in descending order of count
+ * \param transblob a bytea holding a Space-Saving transval
+ * \param order array of <c>num_mfvs</c> elements receiving counter indexes
+ * \returns the number of counters in use
+ */
+uint32 ss_sorted_counters(bytea *transblob, uint32 *order)
+{
+    sstransval *tv = (sstransval *)VARDATA(transblob);
+    ssgroup    *groups = SS_GROUPS(tv);
+    sscounter  *counters = SS_COUNTERS(tv);
+    uint32      n = tv->num_mfvs, g, c;
+
+    /* walk the groups in ascending order of count, filling from the back */
+    for (g = tv->min_group; g != SS_NIL; g = groups[g].next) {
+        for (c = groups[g].head; c != SS_NIL; c = counters[c].next) {
+            if (n == 0 || c >= tv->num_mfvs)
+                elog(ERROR, "invalid transition state for mfvsketch");
+            order[--n] = c;
+        }
+    }
+    if (n != 0)
+        elog(ERROR, "invalid transition state for mfvsketch");
+    return tv->num_mfvs;
+}
+
+/*!
+ * count one occurrence of a value
+ * \param transblob a bytea holding a Space-Saving transval
+ * \param dat the value; varlena values must not be toasted
+ * \param counter if not NULL, set to the index of the counter of the value
+ * \returns the (possibly reallocated) transblob.  For types of fixed length,
+ * the transblob is reallocated only while the sketch is filling up.
+ */
+bytea *ss_insert(bytea *transblob, Datum dat, uint32 *counter)
+{
+    sstransval *tv = (sstransval *)VARDATA(transblob);
+    sscounter  *counters = SS_COUNTERS(tv);
+    ssgroup    *groups = SS_GROUPS(tv);
+    uint64      hash = sketch_hash_datum(dat, tv->typLen, tv->typByVal);
+    int         found;
+    uint32      c, g;
+
+    tv->total++;
+    if ((found = ss_find(tv, &dat, hash)) >= 0) {
+        ss_increment(tv, found);
+        if (counter)
+            *counter = found;
+        return transblob;
+    }
+
+    if (tv->num_mfvs < tv->max_mfvs) {
+        /* room for new */
+        c = tv->num_mfvs++;
+        g = tv->min_group;
+        if (g == SS_NIL || groups[g].cnt != 1)
+            g = ss_new_group(tv, 1, SS_NIL);
+        ss_attach(tv, c, g);
+        counters[c].err = 0;
+        counters[c].offset = 0;
+    }
+    else {
+        /* evict a value with the smallest count and take over its counter */
+        g = tv->min_group;
+        c = groups[g].head;
+        ss_hash_delete(tv, c);
+        if (!tv->typByVal && tv->typLen < 0) {
+            tv->garbage += MAXALIGN(ss_stored_len(tv, counters[c].offset));
+            counters[c].offset = 0;
+        }
+        counters[c].err = groups[g].cnt;
+        ss_increment(tv, c);
+    }
+    counters[c].hash = hash;
+    ss_hash_insert(tv, c);
+    if (counter)
+        *counter = c;
+
+    return ss_store(transblob, dat, c);
+}
+
+PG_FUNCTION_INFO_V1(__mfvsketch_spacesaving_trans);
+
+/*!
+ *  transition function to maintain a Space-Saving sketch
+ */
+Datum __mfvsketch_spacesaving_trans(PG_FUNCTION_ARGS)
+{
+    bytea *      transblob = PG_GETARG_BYTEA_P(0);
+    Datum        newdatum  = PG_GETARG_DATUM(1);
+    int          num_top   = PG_GETARG_INT32(2);
+    sstransval * transval;
+
+    /*
+     * This function makes destructive updates to its arguments.
+     * Make sure it's being called in an agg context.
+     */
+    if (!(fcinfo->context &&
+          (IsA(fcinfo->context, AggState)
+   #ifdef NOTGP
+           || IsA(fcinfo->context, WindowAggState)
+   #endif
+          )))
+        elog(ERROR,
+             "destructive pass by reference outside agg");
+
+    /* initialize if this is first call */
+    if (VARSIZE(transblob) <= VARHDRSZ) {
+        Oid typOid = get_fn_expr_argtype(fcinfo->flinfo, 1);
+
+        if (num_top <= 0
+            || (size_t)num_top > MaxAllocSize / (SS_COUNTERS_PER_MFV
+                 * (sizeof(sscounter) + sizeof(ssgroup) + 4 * sizeof(uint32))))
+            elog(ERROR, "invalid number of buckets for mfvsketch: %d", num_top);
+        transblob = ss_init_transval(num_top,
+                                     Max(SS_COUNTERS_PER_MFV * num_top,
+                                         SS_MIN_COUNTERS),
+                                     typOid);
+    }
+    else {
+        check_sstransval(transblob);
+    }
+
+    transval = (sstransval *)VARDATA(transblob);
+    if (transval->typOid != get_fn_expr_argtype(fcinfo->flinfo, 1)) {
+        elog(ERROR, "cannot aggregate on elements with different types");
+    }
+    if (transval->typLen == -1)
+        newdatum = PointerGetDatum(PG_DETOAST_DATUM_PACKED(newdatum));
+
+    PG_RETURN_DATUM(PointerGetDatum(ss_insert(transblob, newdatum, NULL)));
+}
+
+PG_FUNCTION_INFO_V1(__mfvsketch_spacesaving_final);
+/*!
+ * scalar function taking a Space-Saving sketch, returning a histogram of
+ * its most frequent values in the format of \ref __mfvsketch_final
+ */
+Datum __mfvsketch_spacesaving_final(PG_FUNCTION_ARGS)
+{
+    bytea *      transblob = PG_GETARG_BYTEA_P(0);
+    sstransval * tv;
+    Datum *      histo;
+    uint32 *     order;
+    ArrayType *  retval;
+    uint32       i, c, num_out;
+    int          dims[2], lbs[2];
+    Oid          outFuncOid;
+    bool         typIsVarlena;
+
+    if (VARSIZE(transblob) <= VARHDRSZ) PG_RETURN_NULL();
+
+    check_sstransval(transblob);
+    tv = (sstransval *)VARDATA(transblob);
+    if (tv->num_mfvs == 0) PG_RETURN_NULL();
+    order = (uint32 *)palloc(tv->num_mfvs * sizeof(uint32));
+    ss_sorted_counters(transblob, order);
+
+    num_out = Min(tv->num_mfvs, tv->num_top);
+    histo = (Datum *)palloc(2 * num_out * sizeof(Datum));
+    getTypeOutputInfo(INT8OID,
+                      &outFuncOid,
+                      &typIsVarlena);
+
+    for (i = 0; i < num_out; i++) {
+        c = order[i];
+        char *countbuf =
+            OidOutputFunctionCall(outFuncOid,
+                                  Int64GetDatum(ss_count(transblob, c)));
+        char *valbuf = OidOutputFunctionCall(tv->outFuncOid, ss_getval(tv, c));
+
+        histo[2 * i] = PointerGetDatum(cstring_to_text(valbuf));
+        histo[2 * i + 1] = PointerGetDatum(cstring_to_text(countbuf));
+        pfree(countbuf);
+        pfree(valbuf);
+    }
+
+    dims[0] = num_out;
+    dims[1] = 2;
+    lbs[0] = lbs[1] = 0;
+    retval = construct_md_array(histo,
+                                NULL,
+                                2,
+                                dims,
+                                lbs,
+                                TEXTOID,
+                                -1,
+                                0,
+                                'i');
+    PG_RETURN_ARRAYTYPE_P(retval);
+}
+
+/*!
+ * support function to sort merge candidates by descending count
+ */
+static int ss_cand_cmp_desc(const void *i, const void *j)
+{
+    const sscandidate *o = (const sscandidate *)i;
+    const sscandidate *p = (const sscandidate *)j;
+
+    return (o->cnt < p->cnt) - (o->cnt > p->cnt);
+}
+
+/*!
+ * append a counter to a sketch that is being built in ascending order of
+ * count
+ * \param transblob a bytea holding a Space-Saving transval
+ * \param cand the value and its counts
+ * \param tail the group with the largest count, updated on return
+ * \returns the (possibly reallocated) transblob
+ */
+static bytea *ss_append_sorted(bytea *transblob, const sscandidate *cand,
+                               uint32 *tail)
+{
+    sstransval *tv = (sstransval *)VARDATA(transblob);
+    sscounter  *counters = SS_COUNTERS(tv);
+    uint32      c = tv->num_mfvs++;
+
+    if (*tail == SS_NIL || SS_GROUPS(tv)[*tail].cnt != cand->cnt)
+        *tail = ss_new_group(tv, cand->cnt, *tail);
+    ss_attach(tv, c, *tail);
+    counters[c].err = cand->err;
+    counters[c].hash = cand->hash;
+    counters[c].offset = 0;
+    ss_hash_insert(tv, c);
+
+    return ss_store(transblob, cand->val, c);
+}
+
+/*!
+ * implementation of the merge of two Space-Saving sketches.  The combined
+ * count of a value is the sum of its counts in both sketches, where a value
+ * that is not monitored by a full sketch is credited with that sketch's
+ * minimum count.  The largest combined counts are kept.
+ * \param transblob1 a Space-Saving transval stored inside a bytea
+ * \param transblob2 another Space-Saving transval in a bytea
+ */
+bytea *ss_merge_c(bytea *transblob1, bytea *transblob2)
+{
+    sstransval  *tv1, *tv2;
+    sscandidate *cand;
+    bytea       *newblob;
+    uint64       min1 = 0, min2 = 0;
+    uint32       i, n = 0, keep, tail = SS_NIL;
+    int          j;
+
+    /* handle uninitialized args */
+    if (VARSIZE(transblob1) <= VARHDRSZ)
+        return transblob2;
+    if (VARSIZE(transblob2) <= VARHDRSZ)
+        return transblob1;
+
+    check_sstransval(transblob1);
+    check_sstransval(transblob2);
+    tv1 = (sstransval *)VARDATA(transblob1);
+    tv2 = (sstransval *)VARDATA(transblob2);
+    if (tv1->typOid != tv2->typOid) {
+        elog(ERROR, "cannot merge two transition state with different element type");
+    }
+
+    if (tv1->num_mfvs == tv1->max_mfvs)
+        min1 = SS_GROUPS(tv1)[tv1->min_group].cnt;
+    if (tv2->num_mfvs == tv2->max_mfvs)
+        min2 = SS_GROUPS(tv2)[tv2->min_group].cnt;
+
+    cand = (sscandidate *)palloc(
+        (tv1->num_mfvs + tv2->num_mfvs) * sizeof(sscandidate));
+    for (i = 0; i < tv1->num_mfvs; i++) {
+        sscounter *ctr = &SS_COUNTERS(tv1)[i];
+
+        cand[n].val = ss_getval(tv1, i);
+        cand[n].hash = ctr->hash;
+        cand[n].cnt = SS_GROUPS(tv1)[ctr->group].cnt;
+        cand[n].err = ctr->err;
+        if ((j = ss_find(tv2, &cand[n].val, ctr->hash)) >= 0) {
+            cand[n].cnt += SS_GROUPS(tv2)[SS_COUNTERS(tv2)[j].group].cnt;
+            cand[n].err += SS_COUNTERS(tv2)[j].err;
+        }
+        else {
+            cand[n].cnt += min2;
+            cand[n].err += min2;
+        }
+        n++;
+    }
+    for (i = 0; i < tv2->num_mfvs; i++) {
+        sscounter *ctr = &SS_COUNTERS(tv2)[i];
+
+        cand[n].val = ss_getval(tv2, i);
+        if (ss_find(tv1, &cand[n].val, ctr->hash) >= 0)
+            continue;
+        cand[n].hash = ctr->hash;
+        cand[n].cnt = SS_GROUPS(tv2)[ctr->group].cnt + min1;
+        cand[n].err = ctr->err + min1;
+        n++;
+    }
+
+    qsort(cand, n, sizeof(sscandidate), ss_cand_cmp_desc);
+
+    newblob = ss_init_transval(Max(tv1->num_top, tv2->num_top),
+                               Max(tv1->max_mfvs, tv2->max_mfvs),
+                               tv1->typOid);
+    ((sstransval *)VARDATA(newblob))->total = tv1->total + tv2->total;
+    keep = Min(n, ((sstransval *)VARDATA(newblob))->max_mfvs);
+    for (i = keep; i > 0; i--)
+        newblob = ss_append_sorted(newblob, &cand[i - 1], &tail);
+
+    pfree(cand);
+    return newblob;
+}
+
+PG_FUNCTION_INFO_V1(__mfvsketch_spacesaving_merge);
+/*!
+ * Greenplum "prefunc" to combine Space-Saving sketches from multiple machines
+ */
+Datum __mfvsketch_spacesaving_merge(PG_FUNCTION_ARGS)
+{
+    bytea * transblob1 = (bytea *)PG_GETARG_BYTEA_P(0);
+    bytea * transblob2 = (bytea *)PG_GETARG_BYTEA_P(1);
+
+    PG_RETURN_DATUM(PointerGetDatum(ss_merge_c(transblob1, transblob2)));
+}
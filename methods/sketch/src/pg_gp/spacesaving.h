@@ -0,0 +1,97 @@
+/*!
+ * \file spacesaving.h
+ *
+ * \brief header file for the Space-Saving most-frequent-values sketch
+ */
+#ifndef SPACESAVING_H
+#define SPACESAVING_H
+
+/*! marks the end of a linked list / an unused slot */
+#define SS_NIL 0xFFFFFFFF
+
+/*! number of counters kept per requested bucket */
+#define SS_COUNTERS_PER_MFV 4
+/*! minimum number of counters in a sketch */
+#define SS_MIN_COUNTERS 64
+
+/*!
+ * \brief a monitored value in a Space-Saving sketch.
+ * The count of the value is the count of its group; <c>err</c> is an upper
+ * bound on how much of that count may belong to values evicted before it.
+ * Counters of the same group form a doubly-linked list.
+ */
+typedef struct {
+    uint64 err;     /*! overestimation bound */
+    uint64 hash;    /*! hash of the value */
+    uint32 offset;  /*! location of the value, relative to the transval */
+    uint32 group;   /*! group holding the count */
+    uint32 prev;    /*! previous counter in the group */
+    uint32 next;    /*! next counter in the group */
+} sscounter;
+
+/*!
+ * \brief a bucket of the Stream-Summary structure: all counters that share
+ * the same count.  Groups are kept in a doubly-linked list in ascending
+ * order of count, so the minimum is always at hand.
+ */
+typedef struct {
+    uint64 cnt;     /*! count shared by all counters of the group */
+    uint32 head;    /*! first counter of the group */
+    uint32 prev;    /*! group with the next smaller count */
+    uint32 next;    /*! group with the next larger count, or next free group */
+    uint32 unused;
+} ssgroup;
+
+/*!
+ * \brief the transition value struct for Space-Saving sketches.
+ * It is followed (at MAXALIGN'd offsets) by
+ *   - <c>max_mfvs</c> sscounters,
+ *   - <c>max_mfvs</c> ssgroups,
+ *   - an open-addressed hash table of <c>table_size</c> slots, each holding
+ *     a counter index plus one (zero marks an empty slot),
+ *   - the storage area for the monitored values.
+ */
+typedef struct {
+    uint32 max_mfvs;    /*! number of counters */
+    uint32 num_mfvs;    /*! number of counters in use */
+    uint32 num_top;     /*! number of values requested by the user */
+    uint32 table_size;  /*! number of hash slots, a power of two */
+    uint32 min_group;   /*! group with the smallest count */
+    uint32 free_group;  /*! head of the list of unused groups */
+    uint32 next_offset; /*! first free byte of the storage area */
+    uint32 garbage;     /*! bytes in the storage area held by evicted values */
+    uint64 total;       /*! number of values seen */
+    Oid    typOid;      /*! Postgres oid of the value type */
+    Oid    outFuncOid;  /*! Postgres oid of the type's output function */
+    int16  typLen;      /*! Postgres typLen of the value type */
+    bool   typByVal;    /*! Postgres typByVal of the value type */
+} sstransval;
+
+#define SS_COUNTERS(tv) \
+    ((sscounter *)((char *)(tv) + MAXALIGN(sizeof(sstransval))))
+#define SS_GROUPS(tv)   ((ssgroup *)(SS_COUNTERS(tv) + (tv)->max_mfvs))
+#define SS_SLOTS(tv)    ((uint32 *)(SS_GROUPS(tv) + (tv)->max_mfvs))
+
+/*! offset of the value storage area relative to the transval */
+#define SS_STORAGE_START(max_mfvs, table_size) \
+    MAXALIGN(MAXALIGN(sizeof(sstransval)) \
+             + (max_mfvs) * (sizeof(sscounter) + sizeof(ssgroup)) \
+             + (table_size) * sizeof(uint32))
+/*! base size of a Space-Saving transval */
+#define SS_TRANSVAL_SZ(max_mfvs, table_size) \
+    (VARHDRSZ + SS_STORAGE_START(max_mfvs, table_size))
+
+Datum __mfvsketch_spacesaving_trans(PG_FUNCTION_ARGS);
+Datum __mfvsketch_spacesaving_final(PG_FUNCTION_ARGS);
+Datum __mfvsketch_spacesaving_merge(PG_FUNCTION_ARGS);
+
+bytea *ss_init_transval(int num_top, int max_mfvs, Oid typOid);
+void   check_sstransval(bytea *storage);
+bytea *ss_insert(bytea *transblob, Datum dat, uint32 *counter);
+int    ss_lookup(bytea *transblob, Datum dat);
+uint64 ss_count(bytea *transblob, uint32 c);
+Datum  ss_value(bytea *transblob, uint32 c);
+uint32 ss_sorted_counters(bytea *transblob, uint32 *order);
+bytea *ss_merge_c(bytea *transblob1, bytea *transblob2);
+
+#endif /* SPACESAVING_H */
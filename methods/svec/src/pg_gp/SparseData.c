@@ -131,53 +131,6 @@ void int8_to_compword(int64 num, char entry[9])
 	entry[0] = 8;
 }
 
-/* Transforms a count entry into an int64 value when provided with a pointer
- * to an entry.
- */
-int64 compword_to_int8(const char *entry)
-{
-	char size = int8compstoragesize(entry);
-	int16_t num_2;
-	char *numptr2 = (char *)(&num_2);
-	int32_t num_4;
-	char *numptr4 = (char *)(&num_4);
-	int64 num;
-	char *numptr8 = (char *)(&num);
-
-	switch(size) {
-	        case 0: /* entry == NULL represents an array of ones; see
-			 * comment after definition of SparseDataStruct above
-			 */
-			return 1; break;
-		case 1:
-			num = -(entry[0]);
-			break;
-		case 3:
-			numptr2[0] = entry[1];
-			numptr2[1] = entry[2];
-			num = num_2;
-			break;
-		case 5:
-			numptr4[0] = entry[1];
-			numptr4[1] = entry[2];
-			numptr4[2] = entry[3];
-			numptr4[3] = entry[4];
-			num = num_4;
-			break;
-		case 9:
-			numptr8[0] = entry[1];
-			numptr8[1] = entry[2];
-			numptr8[2] = entry[3];
-			numptr8[3] = entry[4];
-			numptr8[4] = entry[5];
-			numptr8[5] = entry[6];
-			numptr8[6] = entry[7];
-			numptr8[7] = entry[8];
-			break;
-	}
-	return num;
-}
-
 void printout_double(double *vals, int num_values, int stop)
 {
 	(void) stop; /* avoid warning about unused parameter */
@@ -763,6 +716,128 @@ double l1norm_sdata_values_double(SparseData sdata) {
 	return accum_sdata_values_double(sdata, myabs);
 }
 
+/*
+ * Fused reductions between SparseData arrays
+ *
+ * These walk the RLE indexes of both arguments with two cursors and fold
+ * each overlapping segment straight into scalar accumulators. Unlike
+ * op_sdata_by_sdata() followed by one of the accumulators above, nothing is
+ * palloc'd and no intermediate SparseData is built.
+ *
+ * Note: These functions only work on SparseData of float8s at present.
+ *------------------------------------------------------------------------------
+ */
+enum reduction_t { dot_product, l2dist_squared, l1dist, dot_and_norms };
+
+/* Performs the two-cursor walk for the given reduction. The results are
+ * placed in accum[0] (and, for dot_and_norms, the squared l2 norms of left
+ * and right in accum[1] and accum[2]). Since reduction is a compile-time
+ * constant at every call site, the switch is resolved when inlining.
+ */
+static inline void
+reduce_sdata_by_sdata(enum reduction_t reduction, SparseData left,
+		SparseData right, double accum[3])
+{
+	char *liptr = left->index->data;
+	char *riptr = right->index->data;
+	double *lvals = (double *)left->vals->data;
+	double *rvals = (double *)right->vals->data;
+	int i = 0, j = 0;
+	int64 left_run_length, right_run_length, seg_length;
+	double diff;
+
+	check_sdata_dimensions(left,right);
+
+	accum[0] = accum[1] = accum[2] = 0.;
+	if (left->unique_value_count == 0 || right->unique_value_count == 0)
+		return;
+
+	left_run_length  = compword_to_int8(liptr);
+	right_run_length = compword_to_int8(riptr);
+
+	while (1)
+	{
+		seg_length = Min(left_run_length,right_run_length);
+
+		if (seg_length > 0)
+		{
+			switch (reduction)
+			{
+				case dot_product:
+					accum[0] += lvals[i]*rvals[j]*seg_length;
+					break;
+				case l2dist_squared:
+					diff = lvals[i]-rvals[j];
+					accum[0] += diff*diff*seg_length;
+					break;
+				case l1dist:
+					diff = lvals[i]-rvals[j];
+					accum[0] += myabs(diff)*seg_length;
+					break;
+				case dot_and_norms:
+					accum[0] += lvals[i]*rvals[j]*seg_length;
+					accum[1] += lvals[i]*lvals[i]*seg_length;
+					accum[2] += rvals[j]*rvals[j]*seg_length;
+					break;
+			}
+		}
+
+		left_run_length  -= seg_length;
+		right_run_length -= seg_length;
+
+		/*
+		 * Advance whichever cursor(s) exhausted the current run. Since
+		 * the dimensions agree, both cursors run out together.
+		 */
+		if (left_run_length == 0)
+		{
+			if (++i >= left->unique_value_count) break;
+			liptr += int8compstoragesize(liptr);
+			left_run_length = compword_to_int8(liptr);
+		}
+		if (right_run_length == 0)
+		{
+			if (++j >= right->unique_value_count) break;
+			riptr += int8compstoragesize(riptr);
+			right_run_length = compword_to_int8(riptr);
+		}
+	}
+}
+
+/* Computes the dot product of two SparseData */
+double dot_sdata_by_sdata(SparseData left, SparseData right) {
+	double accum[3];
+	reduce_sdata_by_sdata(dot_product,left,right,accum);
+	return accum[0];
+}
+
+/* Computes the l2 distance between two SparseData */
+double l2dist_sdata_by_sdata(SparseData left, SparseData right) {
+	double accum[3];
+	reduce_sdata_by_sdata(l2dist_squared,left,right,accum);
+	return sqrt(accum[0]);
+}
+
+/* Computes the l1 distance between two SparseData */
+double l1dist_sdata_by_sdata(SparseData left, SparseData right) {
+	double accum[3];
+	reduce_sdata_by_sdata(l1dist,left,right,accum);
+	return accum[0];
+}
+
+/* Computes the dot product of two SparseData together with the squared l2
+ * norms of both, in a single pass. This is all that the cosine and tanimoto
+ * measures need.
+ */
+void dot_and_norms_sdata_by_sdata(SparseData left, SparseData right,
+		double *dot, double *left_sqnorm, double *right_sqnorm) {
+	double accum[3];
+	reduce_sdata_by_sdata(dot_and_norms,left,right,accum);
+	*dot          = accum[0];
+	*left_sqnorm  = accum[1];
+	*right_sqnorm = accum[2];
+}
+
 /*
  * Addition, Scalar Product, Division between SparseData arrays
  *
@@ -1305,6 +1380,36 @@ void serializeSparseData(char *target, SparseData source)
 	} else {
 		((StringInfo)(SDATA_INDEX_SINFO(target)))->data = NULL;
 	}
+
+	/*
+	 * The source may itself be a serialized SparseData with a skip index
+	 * that does not get copied; see serializeSparseDataSkipIndex()
+	 */
+	SDATA_SKIP_COUNT((SparseData)target) = 0;
+}
+
+/*
+ * Builds the skip index of a serialized SparseData. The caller must have
+ * reserved MAXALIGN(SIZEOF_SPARSEDATASERIAL(target)) + SDATA_SKIP_SIZE(target)
+ * bytes for the serialized SparseData.
+ */
+void serializeSparseDataSkipIndex(char *target)
+{
+	SparseData sdata = (SparseData)target;
+	SparseDataSkipEntry *skip = SDATA_SKIP_PTR(sdata);
+	char *ix = sdata->index->data;
+	int64 position = 0;
+	int i;
+
+	for (i=0; i<sdata->unique_value_count; i++) {
+		if (i % SDATA_SKIP_STRIDE == 0) {
+			skip[i / SDATA_SKIP_STRIDE].position = position;
+			skip[i / SDATA_SKIP_STRIDE].offset = ix - sdata->index->data;
+		}
+		position += compword_to_int8(ix);
+		ix += int8compstoragesize(ix);
+	}
+	SDATA_SKIP_COUNT(sdata) = SDATA_SKIP_ENTRIES(sdata);
 }
 
 /**
@@ -1323,15 +1428,67 @@ void printSparseData(SparseData sdata) {
 	}
 }
 
+/**
+ * @param sdata The SparseData to be searched
+ * @param idx The index of the desired element, counting from one
+ * @param ix Set to the count entry of the run containing idx
+ * @param read Set to the number of elements up to and including that run
+ * @return The number of the run containing element idx
+ *
+ * If sdata is a serialized SparseData carrying a skip index, we binary-search
+ * the skip index first and decode at most SDATA_SKIP_STRIDE run lengths.
+ * Without one, we have to scan from the first run.
+ */
+static int sdata_seek(SparseData sdata, int64 idx, char **ix, int64 *read) {
+	char *ptr = sdata->index->data;
+	int64 pos = 0;
+	int i = 0;
+
+	/* Uncompressed SparseData: every run has length one */
+	if (ptr == NULL) {
+		*ix = NULL;
+		*read = idx;
+		return idx - 1;
+	}
+
+	if (SDATA_SKIP_COUNT(sdata) > 0) {
+		SparseDataSkipEntry *skip = SDATA_SKIP_PTR(sdata);
+		int lo = 0, hi = SDATA_SKIP_COUNT(sdata) - 1;
+
+		/* find the last entry that starts before idx */
+		while (lo < hi) {
+			int mid = lo + (hi - lo + 1) / 2;
+			if (skip[mid].position < idx)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+		i = lo * SDATA_SKIP_STRIDE;
+		pos = skip[lo].position;
+		ptr += skip[lo].offset;
+	}
+
+	pos += compword_to_int8(ptr);
+	while (pos < idx) {
+		ptr += int8compstoragesize(ptr);
+		pos += compword_to_int8(ptr);
+		i++;
+	}
+	*ix = ptr;
+	*read = pos;
+	return i;
+}
+
 /**
  * @param sdata The SparseData to be projected on
  * @param idx The index to be projected
  * @return The element of a SparseData at location idx.
  */
 double sd_proj(SparseData sdata, int idx) {
-	char * ix = sdata->index->data;
 	double * vals = (double *)sdata->vals->data;
-	int read, i;
+	char * ix;
+	int64 read;
+	int i;
 
 	/* error checking */
 	if (0 >= idx || idx > sdata->total_value_count)
@@ -1340,13 +1497,7 @@ double sd_proj(SparseData sdata, int idx) {
 			 errmsg("Index out of bounds.")));
 
 	/* find desired block; as is normal in SQL, we start counting from one */
-	read = compword_to_int8(ix);
-	i = 0;
-	while (read < idx) {
-		ix += int8compstoragesize(ix);
-		read += compword_to_int8(ix);
-		i++;
-	}
+	i = sdata_seek(sdata, idx, &ix, &read);
 	return vals[i];
 }
 
@@ -1357,10 +1508,12 @@ double sd_proj(SparseData sdata, int idx) {
  * @return The sub-array, indexed by start and end, of a SparseData.
  */
 SparseData subarr(SparseData sdata, int start, int end) {
-	char * ix = sdata->index->data;
+	char * ix;
 	double * vals = (double *)sdata->vals->data;
 	SparseData ret = makeSparseData();
 	size_t wf8 = sizeof(float8);
+	int64 read;
+	int i;
 
 	if (start > end)
 		return reverse(subarr(sdata,end,start));
@@ -1372,13 +1525,7 @@ SparseData subarr(SparseData sdata, int start, int end) {
 			 errmsg("Array index out of bounds.")));
 
 	/* find start block */
-	int read = compword_to_int8(ix);
-	int i = 0;
-	while (read < start) {
-		ix += int8compstoragesize(ix);
-		read += compword_to_int8(ix);
-		i++;
-	}
+	i = sdata_seek(sdata, start, &ix, &read);
 	if (end <= read) {
 		/* the whole subarray is in the first block, we are done */
 		add_run_to_sdata((char *)(&vals[i]), end-start+1, wf8, ret);
@@ -22,6 +22,7 @@
 #define SPARSEDATA_H
 
 #include <math.h>
+#include <stdint.h>
 #include <string.h>
 #include "postgres.h"
 #include "lib/stringinfo.h"
@@ -102,6 +103,43 @@ typedef SparseDataStruct *SparseData;
 #define SDATA_VALS_PTR(x)       (SDATA_INDEX_SINFO(x)+sizeof(StringInfoData))
 #define SDATA_INDEX_PTR(x) 	(SDATA_VALS_PTR(x)+SDATA_DATA_SIZE(x))
 
+/*------------------------------------------------------------------------------
+ * Skip index (svec v2 layout)
+ *------------------------------------------------------------------------------
+ * Locating element i of a SparseData requires decoding all run lengths in
+ * front of it. To make random access cheap for vectors with many runs, a
+ * serialized SparseData may carry a skip index after the index data, at the
+ * next MAXALIGN'd offset:
+ *
+ * 	SparseDataSkipEntry[n]	entry k describes run k*SDATA_SKIP_STRIDE
+ *
+ * The number of entries n is kept in the cursor field of the serialized
+ * "vals" StringInfoData, which is otherwise unused and has always been
+ * written as zero. A zero count therefore identifies the original layout,
+ * which remains fully readable. In-memory SparseData never carry a skip
+ * index (copyStringInfo() and makeStringInfo() zero the cursor).
+ */
+typedef struct
+{
+	int64 position;	/**< Number of elements in front of the run */
+	int64 offset;	/**< Byte offset of the run's count entry in the index */
+} SparseDataSkipEntry;
+
+/** Number of runs covered by each skip index entry */
+#define SDATA_SKIP_STRIDE	64
+/** Only vectors with at least this many runs get a skip index */
+#define SDATA_SKIP_MIN_RUNS	(4 * SDATA_SKIP_STRIDE)
+
+#define SDATA_SKIP_COUNT(x)	((x)->vals->cursor)
+#define SDATA_SKIP_NEEDED(x)	(((x)->index->data != NULL) && \
+		((x)->unique_value_count >= SDATA_SKIP_MIN_RUNS))
+#define SDATA_SKIP_ENTRIES(x)	(((x)->unique_value_count + SDATA_SKIP_STRIDE - 1) \
+		/ SDATA_SKIP_STRIDE)
+#define SDATA_SKIP_SIZE(x)	(SDATA_SKIP_ENTRIES(x) * sizeof(SparseDataSkipEntry))
+/* Takes a serialized SparseData */
+#define SDATA_SKIP_PTR(x)	((SparseDataSkipEntry *) \
+		((char *)(x) + MAXALIGN(SIZEOF_SPARSEDATASERIAL(x))))
+
 #define SDATA_UNIQUE_VALCNT(x)	(((SparseData)(x))->unique_value_count)
 #define SDATA_TOTAL_VALCNT(x)	(((SparseData)(x))->total_value_count)
 
@@ -123,10 +161,44 @@ typedef SparseDataStruct *SparseData;
  */
 
 void int8_to_compword(int64 num, char entry[9]);
-int64 compword_to_int8(const char *entry);
+
+/* Transforms a count entry into an int64 value when provided with a pointer
+ * to an entry.
+ *
+ * The count word is read with a single (possibly unaligned) load instead of
+ * being assembled byte by byte; memcpy() of a constant size compiles down to
+ * a plain move on all relevant platforms.
+ */
+static inline int64 compword_to_int8(const char *entry)
+{
+	int16_t num_2;
+	int32_t num_4;
+	int64 num_8;
+
+	/* entry == NULL represents an array of ones; see comment after
+	 * definition of SparseDataStruct above
+	 */
+	if (entry == NULL)
+		return 1;
+
+	switch (entry[0]) {
+		case 2:
+			memcpy(&num_2,entry+1,sizeof(int16_t));
+			return num_2;
+		case 4:
+			memcpy(&num_4,entry+1,sizeof(int32_t));
+			return num_4;
+		case 8:
+			memcpy(&num_8,entry+1,sizeof(int64));
+			return num_8;
+		default:
+			return -(entry[0]);
+	}
+}
 
 /** Serialization function */
 void serializeSparseData(char *target, SparseData source);
+void serializeSparseDataSkipIndex(char *target);
 
 /* Constructors and destructors */
 SparseData makeEmptySparseData(void);
@@ -184,6 +256,12 @@ SparseData op_sdata_by_scalar_copy(enum operation_t operation, char *scalar,
 double l2norm_sdata_values_double(SparseData sdata);
 double l1norm_sdata_values_double(SparseData sdata);
 
+double dot_sdata_by_sdata(SparseData left, SparseData right);
+double l2dist_sdata_by_sdata(SparseData left, SparseData right);
+double l1dist_sdata_by_sdata(SparseData left, SparseData right);
+void dot_and_norms_sdata_by_sdata(SparseData left, SparseData right,
+    double *dot, double *left_sqnorm, double *right_sqnorm);
+
 size_t size_of_type(Oid type);
 void printout_double(double *vals, int num_values, int stop);
 void printout_index(char *ix, int num_values, int stop);
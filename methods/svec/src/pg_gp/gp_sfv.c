@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <math.h>
 
+#include "access/hash.h"
 #include "access/tupmacs.h"
 #include "catalog/pg_type.h"
 #if PG_VERSION_NUM >= 90100
@@ -21,7 +22,11 @@ Datum gp_extract_feature_histogram(PG_FUNCTION_ARGS);
 
 static void gp_extract_feature_histogram_errout(char *msg);
 
-static SvecType * classify_document(Datum *features, int num_features,
+typedef struct FeatureDictionary FeatureDictionary;
+
+static FeatureDictionary *get_feature_dictionary(FunctionCallInfo fcinfo);
+
+static SvecType * classify_document(FeatureDictionary *dict,
 				  Datum *document, int num_words, bool *null_words);
 
 #if PG_VERSION_NUM >= 90100
@@ -112,14 +117,14 @@ PG_FUNCTION_INFO_V1( gp_extract_feature_histogram );
 Datum gp_extract_feature_histogram(PG_FUNCTION_ARGS)
 {
 	SvecType   *returnval;
-	ArrayType  *arr0, *arr1;
-	Datum	   *features, *document;
-	int			num_features, num_words;
+	ArrayType  *arr1;
+	FeatureDictionary *dict;
+	Datum	   *document;
+	int			num_words;
 	bool	   *null_words;
 	int16		elmlen;
 	bool		elmbyval;
 	char		elmalign;
-	int			i;
 
 	if (PG_ARGISNULL(0))
 		PG_RETURN_NULL();
@@ -129,8 +134,107 @@ Datum gp_extract_feature_histogram(PG_FUNCTION_ARGS)
 		gp_extract_feature_histogram_errout(
 			"gp_extract_feature_histogram called with wrong number of arguments");
 
-	arr0 = PG_GETARG_ARRAYTYPE_P(0);
+	dict = get_feature_dictionary(fcinfo);
+
 	arr1 = PG_GETARG_ARRAYTYPE_P(1);
+	if (ARR_ELEMTYPE(arr1) != TEXTOID)
+		gp_extract_feature_histogram_errout("the input types must be text[]");
+
+	get_typlenbyvalalign(TEXTOID, &elmlen, &elmbyval, &elmalign);
+	deconstruct_array(arr1, TEXTOID, elmlen, elmbyval, elmalign,
+					  &document, &null_words, &num_words);
+
+	returnval = classify_document(dict, document, num_words, null_words);
+	pfree(document);
+	pfree(null_words);
+
+	PG_RETURN_POINTER(returnval);
+}
+
+static void
+gp_extract_feature_histogram_errout(char *msg) {
+	ereport(ERROR,
+		(errcode(ERRCODE_EXTERNAL_ROUTINE_EXCEPTION),
+		 errmsg(
+		"%s\ngp_extract_feature_histogram internal error.",msg)));
+}
+
+/*
+ * The dictionary, parsed and validated once per query.
+ *
+ * A dictionary with hundreds of thousands of words is typically passed
+ * unchanged with every document, so it is kept in fn_extra together with a
+ * copy of the raw (possibly still toasted or compressed) argument. As long as
+ * the next argument is byte-wise equal, the cached dictionary is used without
+ * even detoasting it. Words are found through an open-addressing hash table.
+ * Texts are equal under bttextcmp if and only if their bytes are equal, so
+ * hashing and comparing bytes is consistent with the sort order checked when
+ * the dictionary is built.
+ */
+struct FeatureDictionary
+{
+	struct varlena *key;		/* copy of the raw dictionary argument */
+	Size		key_size;
+	ArrayType  *array;			/* detoasted dictionary */
+	Datum	   *features;		/* pointers into array */
+	int			num_features;
+	uint32		mask;			/* number of slots - 1 */
+	uint32	   *hashes;
+	int		   *slots;			/* index of feature, or -1 */
+};
+
+/*
+ * Only keep the raw argument as key if its bytes determine the value, i.e.,
+ * if it is not a pointer to a value in memory.
+ */
+#ifdef VARATT_IS_EXTERNAL_ONDISK
+#define DICTIONARY_KEY_IS_STABLE(p) \
+	(!VARATT_IS_EXTERNAL(p) || VARATT_IS_EXTERNAL_ONDISK(p))
+#else
+#define DICTIONARY_KEY_IS_STABLE(p) true
+#endif
+
+static inline uint32
+hash_text_datum(Datum text)
+{
+	return DatumGetUInt32(hash_any((unsigned char *) VARDATA_ANY(text),
+								   VARSIZE_ANY_EXHDR(text)));
+}
+
+static inline bool
+text_datum_equal(Datum a, Datum b)
+{
+	return VARSIZE_ANY_EXHDR(a) == VARSIZE_ANY_EXHDR(b)
+		&& memcmp(VARDATA_ANY(a), VARDATA_ANY(b), VARSIZE_ANY_EXHDR(a)) == 0;
+}
+
+static void
+free_feature_dictionary(FeatureDictionary *dict)
+{
+	if (dict->key != NULL)
+		pfree(dict->key);
+	if (dict->array != NULL)
+		pfree(dict->array);
+	if (dict->features != NULL)
+		pfree(dict->features);
+	if (dict->hashes != NULL)
+		pfree(dict->hashes);
+	if (dict->slots != NULL)
+		pfree(dict->slots);
+	memset(dict, 0, sizeof(FeatureDictionary));
+}
+
+static void
+build_feature_dictionary(FeatureDictionary *dict, struct varlena *raw)
+{
+	ArrayType  *arr0;
+	int16		elmlen;
+	bool		elmbyval;
+	char		elmalign;
+	uint32		num_slots;
+	int			i;
+
+	arr0 = DatumGetArrayTypePCopy(PointerGetDatum(raw));
 
 	/* Error if dictionary is empty or contains a null */
 	if (ARR_HASNULL(arr0))
@@ -141,82 +245,184 @@ Datum gp_extract_feature_histogram(PG_FUNCTION_ARGS)
 		gp_extract_feature_histogram_errout(
 		  "dictionary argument is empty");
 
-	if (ARR_ELEMTYPE(arr0) != TEXTOID || ARR_ELEMTYPE(arr1) != TEXTOID)
+	if (ARR_ELEMTYPE(arr0) != TEXTOID)
 		gp_extract_feature_histogram_errout("the input types must be text[]");
 
+	dict->array = arr0;
 	get_typlenbyvalalign(TEXTOID, &elmlen, &elmbyval, &elmalign);
 	deconstruct_array(arr0, TEXTOID, elmlen, elmbyval, elmalign,
-					  &features, NULL, &num_features);
-	deconstruct_array(arr1, TEXTOID, elmlen, elmbyval, elmalign,
-					  &document, &null_words, &num_words);
+					  &dict->features, NULL, &dict->num_features);
 
-	for (i = 0; i < num_features - 1; i++)
+	for (i = 0; i < dict->num_features - 1; i++)
 	{
 		int		cmp;
 
-		cmp = TextDatumCmp(features[i], features[i + 1]);
+		cmp = TextDatumCmp(dict->features[i], dict->features[i + 1]);
 
 		if (cmp > 0)
 			elog(ERROR, "Dictionary is unsorted: '%s' is out of order.\n",
-					TextDatumGetCString(features[i + 1]));
+					TextDatumGetCString(dict->features[i + 1]));
 		else if (cmp == 0)
 			elog(ERROR, "Dictionary has duplicated word: '%s'\n",
-					TextDatumGetCString(features[i + 1]));
+					TextDatumGetCString(dict->features[i + 1]));
 	}
 
-	returnval = classify_document(features, num_features,
-								  document, num_words, null_words);
-	pfree(features);
-	pfree(document);
+	/* At most half of the slots are used */
+	num_slots = 2;
+	while (num_slots < (uint32) dict->num_features * 2)
+		num_slots <<= 1;
+	dict->mask = num_slots - 1;
+	dict->hashes = (uint32 *) palloc(sizeof(uint32) * num_slots);
+	dict->slots = (int *) palloc(sizeof(int) * num_slots);
+	memset(dict->slots, -1, sizeof(int) * num_slots);
 
-	PG_RETURN_POINTER(returnval);
+	/* Words are unique, as just verified */
+	for (i = 0; i < dict->num_features; i++)
+	{
+		uint32	hash = hash_text_datum(dict->features[i]);
+		uint32	slot = hash & dict->mask;
+
+		while (dict->slots[slot] >= 0)
+			slot = (slot + 1) & dict->mask;
+		dict->hashes[slot] = hash;
+		dict->slots[slot] = i;
+	}
+
+	if (DICTIONARY_KEY_IS_STABLE(raw))
+	{
+		dict->key_size = VARSIZE_ANY(raw);
+		dict->key = (struct varlena *) palloc(dict->key_size);
+		memcpy(dict->key, raw, dict->key_size);
+	}
 }
 
-static void
-gp_extract_feature_histogram_errout(char *msg) {
-	ereport(ERROR,
-		(errcode(ERRCODE_EXTERNAL_ROUTINE_EXCEPTION),
-		 errmsg(
-		"%s\ngp_extract_feature_histogram internal error.",msg)));
+static FeatureDictionary *
+get_feature_dictionary(FunctionCallInfo fcinfo)
+{
+	FeatureDictionary *dict = (FeatureDictionary *) fcinfo->flinfo->fn_extra;
+	struct varlena *raw = (struct varlena *) PG_GETARG_POINTER(0);
+	MemoryContext oldcontext;
+
+	if (dict != NULL && dict->key != NULL
+		&& dict->key_size == VARSIZE_ANY(raw)
+		&& memcmp(dict->key, raw, dict->key_size) == 0)
+		return dict;
+
+	oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+	if (dict == NULL)
+	{
+		dict = (FeatureDictionary *) palloc0(sizeof(FeatureDictionary));
+		fcinfo->flinfo->fn_extra = dict;
+	}
+	else
+		free_feature_dictionary(dict);
+	build_feature_dictionary(dict, raw);
+	MemoryContextSwitchTo(oldcontext);
+
+	return dict;
 }
 
 /*
- * The comparator for bsearch.
+ * Returns the index of the word in the dictionary, or -1.
  */
+static inline int
+lookup_feature(FeatureDictionary *dict, Datum word)
+{
+	uint32	hash = hash_text_datum(word);
+	uint32	slot = hash & dict->mask;
+	int		idx;
+
+	while ((idx = dict->slots[slot]) >= 0)
+	{
+		if (dict->hashes[slot] == hash
+			&& text_datum_equal(dict->features[idx], word))
+			return idx;
+		slot = (slot + 1) & dict->mask;
+	}
+	return -1;
+}
+
 static int
-textdatum_cmp(const void *a, const void *b)
+int_cmp(const void *a, const void *b)
+{
+	int		x = *(const int *) a;
+	int		y = *(const int *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Appends a run to the sparse data. Runs are held back in pending_val and
+ * pending_len so that neighboring runs with the same value are merged, just
+ * as float8arr_to_sdata() would. A final call with len < 0 flushes.
+ */
+static void
+append_histogram_run(SparseData sdata, float8 *pending_val,
+					 int64 *pending_len, float8 val, int64 len)
 {
-	return TextDatumCmp(*(Datum *) a, *(Datum *) b);
+	if (len == 0)
+		return;
+	if (len > 0 && *pending_len > 0 && *pending_val == val)
+	{
+		*pending_len += len;
+		return;
+	}
+	if (*pending_len > 0)
+		add_run_to_sdata((char *) pending_val, *pending_len, sizeof(float8),
+						 sdata);
+	*pending_val = val;
+	*pending_len = len;
 }
 
+/*
+ * Only the dictionary positions of the words found are collected and
+ * sorted. The histogram is then emitted directly as runs, so no dense
+ * array of the dictionary's size is needed.
+ */
 static SvecType *
-classify_document(Datum *features, int num_features,
+classify_document(FeatureDictionary *dict,
 				  Datum *document, int num_words, bool *null_words)
 {
-	float8 * histogram = (float8 *)palloc0(sizeof(float8)*num_features);
-	SvecType * output_sfv;
-	int i;
+	int		   *hits = (int *) palloc(sizeof(int) * Max(num_words, 1));
+	int			num_hits = 0;
+	SparseData	sdata;
+	float8		pending_val = 0.;
+	int64		pending_len = 0;
+	int			pos = 0;
+	int			i;
 
 	for (i = 0; i < num_words; i++)
 	{
-		void   *found;
+		int		idx;
 
 		/* Skip if this word is NULL */
 		if (null_words[i])
 			continue;
-		found = bsearch(&document[i], features, num_features,
-						sizeof(Datum), textdatum_cmp);
-		if (found)
-		{
-			int		idx;
+		idx = lookup_feature(dict, document[i]);
+		if (idx >= 0)
+			hits[num_hits++] = idx;
+	}
+	qsort(hits, num_hits, sizeof(int), int_cmp);
 
-			idx = ((uintptr_t) found - (uintptr_t) features) / sizeof(Datum);
-			histogram[idx]++;
-		}
+	sdata = makeSparseData();
+	for (i = 0; i < num_hits; )
+	{
+		int		idx = hits[i];
+		int		count = 0;
 
+		while (i < num_hits && hits[i] == idx)
+		{
+			count++;
+			i++;
+		}
+		append_histogram_run(sdata, &pending_val, &pending_len, 0., idx - pos);
+		append_histogram_run(sdata, &pending_val, &pending_len, count, 1);
+		pos = idx + 1;
 	}
-	output_sfv = svec_from_float8arr(histogram, num_features);
-	pfree(histogram);
+	append_histogram_run(sdata, &pending_val, &pending_len, 0.,
+						 dict->num_features - pos);
+	append_histogram_run(sdata, &pending_val, &pending_len, 0., -1);
+	pfree(hits);
 
-	return output_sfv;
+	return svec_from_sparsedata(sdata, true);
 }
@@ -48,7 +48,78 @@ double svec_svec_dot_product(SvecType *svec1, SvecType *svec2) {
 	SparseData right = sdata_from_svec(svec2);
 	
 	check_dimension(svec1,svec2,"svec_svec_dot_product");
-	return sum_sdata_values_double( op_sdata_by_sdata(multiply,left,right));
+	return dot_sdata_by_sdata(left,right);
+}
+
+/*
+ * The following distance functions reduce both RLE streams in a single pass
+ * without materializing the difference vector. The caller is expected to
+ * have called check_dimension(). If exactly one of the inputs is a scalar,
+ * we fall back to the broadcasting operators in svec_operate_on_sdata_pair().
+ */
+
+/**
+ * l2 distance between two svecs
+ */
+double svec_svec_l2dist_internal(SvecType *svec1, SvecType *svec2) {
+	if (IS_SCALAR(svec1) != IS_SCALAR(svec2))
+		return l2norm_sdata_values_double(sdata_from_svec(
+			op_svec_by_svec_internal(subtract,svec1,svec2)));
+	return l2dist_sdata_by_sdata(sdata_from_svec(svec1),
+				     sdata_from_svec(svec2));
+}
+
+/**
+ * l1 distance between two svecs
+ */
+double svec_svec_l1dist_internal(SvecType *svec1, SvecType *svec2) {
+	if (IS_SCALAR(svec1) != IS_SCALAR(svec2))
+		return l1norm_sdata_values_double(sdata_from_svec(
+			op_svec_by_svec_internal(subtract,svec1,svec2)));
+	return l1dist_sdata_by_sdata(sdata_from_svec(svec1),
+				     sdata_from_svec(svec2));
+}
+
+/**
+ * Angle (in radians) between two svecs
+ */
+double svec_svec_angle_internal(SvecType *svec1, SvecType *svec2) {
+	double dot, m1, m2, result;
+
+	dot_and_norms_sdata_by_sdata(sdata_from_svec(svec1),
+				     sdata_from_svec(svec2), &dot, &m1, &m2);
+	if (IS_NVP(dot) || IS_NVP(m1) || IS_NVP(m2)) return NVP;
+
+	result = dot/sqrt(m1*m2);
+
+	if (result > 1.0) {
+		result = 1.0;
+	}
+	else if (result < -1.0) {
+		result = -1.0;
+	}
+	return acos(result);
+}
+
+/**
+ * Tanimoto distance between two svecs
+ */
+double svec_svec_tanimoto_distance_internal(SvecType *svec1, SvecType *svec2) {
+	double dot, m1, m2, result;
+
+	dot_and_norms_sdata_by_sdata(sdata_from_svec(svec1),
+				     sdata_from_svec(svec2), &dot, &m1, &m2);
+	if (IS_NVP(dot) || IS_NVP(m1) || IS_NVP(m2)) return NVP;
+
+	result = dot / (m1 + m2 - dot);
+
+	if (result > 1.0) {
+		result = 1.0;
+	}
+	else if (result < 0.0) {
+		result = 0.0;
+	}
+	return 1. - result;
 }
 
 /**
@@ -665,13 +736,10 @@ Datum svec_svec_l2norm(PG_FUNCTION_ARGS)
 {	
 	SvecType *svec1 = PG_GETARG_SVECTYPE_P(0);
 	SvecType *svec2 = PG_GETARG_SVECTYPE_P(1);
+	double accum;
 	
 	check_dimension(svec1,svec2,"l2norm");
-	SvecType *result = op_svec_by_svec_internal(subtract,svec1,svec2);
-	
-	SparseData sdata  = sdata_from_svec(result);
-	double accum;
-	accum = l2norm_sdata_values_double(sdata);
+	accum = svec_svec_l2dist_internal(svec1,svec2);
 	
 	if (IS_NVP(accum)) PG_RETURN_NULL();
 	
@@ -686,13 +754,10 @@ Datum svec_svec_l1norm(PG_FUNCTION_ARGS)
 {	
 	SvecType *svec1 = PG_GETARG_SVECTYPE_P(0);
 	SvecType *svec2 = PG_GETARG_SVECTYPE_P(1);
+	double accum;
 	
 	check_dimension(svec1,svec2,"l1norm");
-	SvecType *result = op_svec_by_svec_internal(subtract,svec1,svec2);
-	
-	SparseData sdata = sdata_from_svec(result);
-	double accum;
-	accum = l1norm_sdata_values_double(sdata);
+	accum = svec_svec_l1dist_internal(svec1,svec2);
 	
 	if (IS_NVP(accum)) PG_RETURN_NULL();
 	
@@ -707,27 +772,14 @@ Datum svec_svec_angle(PG_FUNCTION_ARGS)
 {	
 	SvecType *svec1 = PG_GETARG_SVECTYPE_P(0);
 	SvecType *svec2 = PG_GETARG_SVECTYPE_P(1);
-	SparseData left  = sdata_from_svec(svec1);
-	SparseData right = sdata_from_svec(svec2);
-	double dot, m1, m2, result;
-	
-	dot = svec_svec_dot_product( svec1, svec2);
+	double result;
 
-	m1 = l2norm_sdata_values_double(left);
-	m2 = l2norm_sdata_values_double(right);
+	check_dimension(svec1,svec2,"angle");
+	result = svec_svec_angle_internal(svec1,svec2);
 
-	if (IS_NVP(dot) || IS_NVP(m1) || IS_NVP(m2)) PG_RETURN_NULL();
-	
-	result = dot/(m1*m2);
-	
-	if (result > 1.0) {
-		result = 1.0;
-	}
-	else if (result < -1.0) {
-		result = -1.0;
-	}
+	if (IS_NVP(result)) PG_RETURN_NULL();
 
-	PG_RETURN_FLOAT8(acos(result));
+	PG_RETURN_FLOAT8(result);
 }
 
 PG_FUNCTION_INFO_V1( svec_svec_tanimoto_distance );
@@ -738,27 +790,14 @@ Datum svec_svec_tanimoto_distance(PG_FUNCTION_ARGS)
 {	
 	SvecType *svec1 = PG_GETARG_SVECTYPE_P(0);
 	SvecType *svec2 = PG_GETARG_SVECTYPE_P(1);
-	SparseData left  = sdata_from_svec(svec1);
-	SparseData right = sdata_from_svec(svec2);
-	double dot, m1, m2, result;
-	
-	dot = svec_svec_dot_product( svec1, svec2);
-	
-	m1 = l2norm_sdata_values_double(left);
-	m2 = l2norm_sdata_values_double(right);
-	
-	if (IS_NVP(dot) || IS_NVP(m1) || IS_NVP(m2)) PG_RETURN_NULL();
-	
-	result = dot / (m1*m1 + m2*m2 - dot);
-	
-	if (result > 1.0) {
-		result = 1.0;
-	}
-	else if (result < 0.0) {
-		result = 0.0;
-	}
-	
-	PG_RETURN_FLOAT8(1. - result);
+	double result;
+
+	check_dimension(svec1,svec2,"tanimoto_distance");
+	result = svec_svec_tanimoto_distance_internal(svec1,svec2);
+
+	if (IS_NVP(result)) PG_RETURN_NULL();
+
+	PG_RETURN_FLOAT8(result);
 }
 
 PG_FUNCTION_INFO_V1( svec_normalize );
@@ -1,6 +1,12 @@
 #ifndef SPARSEVECTOR_OPERATORS_H
 #define SPARSEVECTOR_OPERATORS_H
 
+double svec_svec_dot_product(SvecType *svec1, SvecType *svec2);
+double svec_svec_l2dist_internal(SvecType *svec1, SvecType *svec2);
+double svec_svec_l1dist_internal(SvecType *svec1, SvecType *svec2);
+double svec_svec_angle_internal(SvecType *svec1, SvecType *svec2);
+double svec_svec_tanimoto_distance_internal(SvecType *svec1, SvecType *svec2);
+
 Datum svec_svec_l1norm(PG_FUNCTION_ARGS);
 Datum svec_svec_l2norm(PG_FUNCTION_ARGS);
 Datum svec_svec_angle(PG_FUNCTION_ARGS);
@@ -379,11 +379,23 @@ SvecType *svec_from_sparsedata(SparseData sdata, bool trim)
 		sdata->index->maxlen=sdata->index->len;
 	}
 
-	size = SVECHDRSIZE + SIZEOF_SPARSEDATASERIAL(sdata);
+	/*
+	 * Trimmed vectors with many runs get a skip index for random access;
+	 * untrimmed ones are aggregate states that are still being appended to.
+	 */
+	bool with_skip_index = trim && SDATA_SKIP_NEEDED(sdata);
+
+	if (with_skip_index)
+		size = SVECHDRSIZE + MAXALIGN(SIZEOF_SPARSEDATASERIAL(sdata))
+			+ SDATA_SKIP_SIZE(sdata);
+	else
+		size = SVECHDRSIZE + SIZEOF_SPARSEDATASERIAL(sdata);
 
-	SvecType *result = (SvecType *)palloc(size);
+	SvecType *result = (SvecType *)(with_skip_index ? palloc0(size) : palloc(size));
 	SET_VARSIZE(result,size);
 	serializeSparseData(SVEC_SDATAPTR(result),sdata);
+	if (with_skip_index)
+		serializeSparseDataSkipIndex(SVEC_SDATAPTR(result));
 	result->dimension = sdata->total_value_count;
 	if (result->dimension == 1) result->dimension=-1; //Scalar
 	return (result);
@@ -1,11 +1,13 @@
 #include <postgres.h>
 #include <fmgr.h>
 #include <funcapi.h>
+#include <access/hash.h>
 #include <catalog/pg_proc.h>
 #include <catalog/pg_type.h>
 #include <utils/builtins.h>
 #include <utils/datum.h>
 #include <utils/lsyscache.h>
+#include <utils/memutils.h>
 #include <utils/syscache.h>
 
 // On Greenplum 4.2.0, spi.h indirectly includes <emcconnect/api.h>. However,
@@ -28,6 +30,117 @@
         SearchSysCache(cacheId, key1, 0, 0, 0)
 #endif // defined(SearchSysCache1)
 
+// Saved SPI plans are only revalidated after changes to the objects they
+// depend on (e.g., when a table is dropped and recreated) starting with
+// PostgreSQL 8.3 (commit b9527e9 by Tom Lane). Before that, a cached plan could
+// refer to objects that no longer exist, so we do not cache plans.
+#if PG_VERSION_NUM >= 80300
+    #define CACHE_PLANS
+#endif // PG_VERSION_NUM >= 80300
+
+#define MAX_SAVED_PLANS 64
+
+/*
+ * A prepared plan, together with the statement text and argument types it was
+ * prepared for
+ */
+typedef struct SavedPlan {
+    uint32 hash;
+    char* stmt;
+    int nargs;
+    Oid* types;
+    SPIPlanPtr plan;
+    struct SavedPlan* next;
+} SavedPlan;
+
+/*
+ * Per-backend cache of saved plans, most recently used first. The driver
+ * functions call exec_sql_using with the same statements over and over, so
+ * there is no need to parse and plan them more than once.
+ */
+static SavedPlan* savedPlans = NULL;
+static int numSavedPlans = 0;
+
+static uint32
+hash_statement(const char* stmt) {
+    return DatumGetUInt32(hash_any((const unsigned char*) stmt,
+        (int) strlen(stmt)));
+}
+
+/*
+ * Return a plan for the given statement and argument types
+ *
+ * Must be called while connected to SPI. If *isSaved is set to true, the plan
+ * belongs to the cache and must not be freed by the caller.
+ */
+static SPIPlanPtr
+get_plan(const char* stmt, int nargs, Oid* types, bool* isSaved) {
+    uint32 hash = hash_statement(stmt);
+    SavedPlan* prev = NULL;
+
+    *isSaved = false;
+    for (SavedPlan* entry = savedPlans; entry != NULL;
+        prev = entry, entry = entry->next) {
+
+        if (entry->hash == hash && entry->nargs == nargs
+            && memcmp(entry->types, types, sizeof(Oid) * nargs) == 0
+            && strcmp(entry->stmt, stmt) == 0) {
+
+            if (prev != NULL) {
+                prev->next = entry->next;
+                entry->next = savedPlans;
+                savedPlans = entry;
+            }
+            *isSaved = true;
+            return entry->plan;
+        }
+    }
+
+    SPIPlanPtr plan = SPI_prepare(stmt, nargs, types);
+    if (plan == NULL)
+        return NULL;
+
+#if defined(CACHE_PLANS)
+    #if PG_VERSION_NUM >= 90200
+        if (SPI_keepplan(plan) != 0)
+            return plan;
+    #else
+        SPIPlanPtr unsavedPlan = plan;
+        plan = SPI_saveplan(unsavedPlan);
+        SPI_freeplan(unsavedPlan);
+        if (plan == NULL)
+            return SPI_prepare(stmt, nargs, types);
+    #endif
+
+    SavedPlan* entry = MemoryContextAlloc(TopMemoryContext, sizeof(SavedPlan));
+    entry->hash = hash;
+    entry->stmt = MemoryContextStrdup(TopMemoryContext, stmt);
+    entry->nargs = nargs;
+    entry->types = MemoryContextAlloc(TopMemoryContext,
+        sizeof(Oid) * (nargs > 0 ? nargs : 1));
+    memcpy(entry->types, types, sizeof(Oid) * nargs);
+    entry->plan = plan;
+    entry->next = savedPlans;
+    savedPlans = entry;
+    *isSaved = true;
+
+    if (++numSavedPlans > MAX_SAVED_PLANS) {
+        // Evict the least recently used plan
+        SavedPlan* last = savedPlans;
+        while (last->next->next != NULL)
+            last = last->next;
+        SPI_freeplan(last->next->plan);
+        pfree(last->next->stmt);
+        pfree(last->next->types);
+        pfree(last->next);
+        last->next = NULL;
+        numSavedPlans--;
+    }
+#endif // defined(CACHE_PLANS)
+
+    return plan;
+}
+
 
 PG_FUNCTION_INFO_V1(exec_sql_using);
 Datum
@@ -105,7 +218,8 @@ exec_sql_using(PG_FUNCTION_ARGS) {
         }
 
     SPI_connect();
-    SPIPlanPtr plan = SPI_prepare(stmt, nargs - 1, &types[1]);
+    bool planIsSaved;
+    SPIPlanPtr plan = get_plan(stmt, nargs - 1, &types[1], &planIsSaved);
     if (plan == NULL)
         ereport(ERROR, (
             errmsg("function \"%s\" could not obtain execution plan for "
@@ -122,7 +236,7 @@ exec_sql_using(PG_FUNCTION_ARGS) {
         if (result != SPI_OK_SELECT
             && result != SPI_OK_INSERT_RETURNING
             && result != SPI_OK_DELETE_RETURNING
-            && result == SPI_OK_UPDATE_RETURNING)
+            && result != SPI_OK_UPDATE_RETURNING)
             ereport(ERROR, (
                 errmsg("function \"%s\" could not obtain result from query",
                     format_procedure(fcinfo->flinfo->fn_oid))
@@ -147,7 +261,8 @@ exec_sql_using(PG_FUNCTION_ARGS) {
             SPI_tuptable->tupdesc, 1, &returnNull);
     }
 
-    SPI_freeplan(plan);
+    if (!planIsSaved)
+        SPI_freeplan(plan);
     if (nulls)
         pfree(nulls);
     SPI_finish();
@@ -92,8 +92,10 @@ static isfinite(const Eigen::MatrixBase<Derived>& mat) {
 
 #include "HandleMap_proto.hpp"
 #include "SymmetricPositiveDefiniteEigenDecomposition_proto.hpp"
+#include "SymmetricPackedHandleMap_proto.hpp"
 
 #include "HandleMap_impl.hpp"
 #include "SymmetricPositiveDefiniteEigenDecomposition_impl.hpp"
+#include "SymmetricPackedHandleMap_impl.hpp"
 
 #endif // defined(MADLIB_EIGEN_INTEGRATION_HPP)
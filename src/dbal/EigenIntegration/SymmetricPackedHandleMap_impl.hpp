@@ -0,0 +1,236 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file SymmetricPackedHandleMap_impl.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_DBAL_EIGEN_SYMMETRICPACKEDHANDLEMAP_IMPL_HPP
+#define MADLIB_DBAL_EIGEN_SYMMETRICPACKEDHANDLEMAP_IMPL_HPP
+
+namespace madlib {
+
+namespace dbal {
+
+namespace eigen_integration {
+
+/**
+ * @brief Default constructor
+ *
+ * Using the SymmetricPackedHandleMap before a rebind() is undefined.
+ */
+template <class EigenType, class Handle>
+inline
+SymmetricPackedHandleMap<EigenType, Handle>::SymmetricPackedHandleMap()
+  : mDimension(0) { }
+
+template <class EigenType, class Handle>
+inline
+SymmetricPackedHandleMap<EigenType, Handle>::SymmetricPackedHandleMap(
+    const Handle &inHandle, Index inDimension)
+  : mDimension(inDimension),
+    mPacked(inHandle, packedSize(inDimension)) { }
+
+/**
+ * @brief Rebind to a different handle
+ *
+ * @param inHandle Handle to the first element of the packed storage
+ * @param inDimension Number of rows (and columns) of the matrix. The handle
+ *     must provide access to packedSize(inDimension) elements.
+ */
+template <class EigenType, class Handle>
+inline
+SymmetricPackedHandleMap<EigenType, Handle>&
+SymmetricPackedHandleMap<EigenType, Handle>::rebind(
+    const Handle &inHandle, Index inDimension) {
+
+    mDimension = inDimension;
+    mPacked.rebind(inHandle, packedSize(inDimension));
+    return *this;
+}
+
+/**
+ * @brief Return the number of elements needed for a matrix of the given
+ *     dimension
+ */
+template <class EigenType, class Handle>
+inline
+typename SymmetricPackedHandleMap<EigenType, Handle>::Index
+SymmetricPackedHandleMap<EigenType, Handle>::packedSize(Index inDimension) {
+    return inDimension * (inDimension + 1) / 2;
+}
+
+template <class EigenType, class Handle>
+inline
+typename SymmetricPackedHandleMap<EigenType, Handle>::Index
+SymmetricPackedHandleMap<EigenType, Handle>::rows() const {
+    return mDimension;
+}
+
+template <class EigenType, class Handle>
+inline
+typename SymmetricPackedHandleMap<EigenType, Handle>::Index
+SymmetricPackedHandleMap<EigenType, Handle>::cols() const {
+    return mDimension;
+}
+
+/**
+ * @brief Return the offset of the diagonal element of the given column
+ *
+ * Column j is preceded by columns of lengths n, n - 1, ..., n - j + 1.
+ */
+template <class EigenType, class Handle>
+inline
+typename SymmetricPackedHandleMap<EigenType, Handle>::Index
+SymmetricPackedHandleMap<EigenType, Handle>::columnOffset(Index inCol) const {
+    return inCol * mDimension - inCol * (inCol - 1) / 2;
+}
+
+/**
+ * @brief Return an element of the symmetric matrix
+ *
+ * Elements above the diagonal are read from their mirror image.
+ */
+template <class EigenType, class Handle>
+inline
+typename SymmetricPackedHandleMap<EigenType, Handle>::Scalar
+SymmetricPackedHandleMap<EigenType, Handle>::operator()(
+    Index inRow, Index inCol) const {
+
+    if (inRow < inCol)
+        std::swap(inRow, inCol);
+    return mPacked(columnOffset(inCol) + inRow - inCol);
+}
+
+/**
+ * @brief Return a reference to an element of the symmetric matrix
+ *
+ * Since only one triangle is stored, the elements (i, j) and (j, i) share the
+ * same memory.
+ */
+template <class EigenType, class Handle>
+inline
+typename SymmetricPackedHandleMap<EigenType, Handle>::Scalar&
+SymmetricPackedHandleMap<EigenType, Handle>::coeffRef(
+    Index inRow, Index inCol) {
+
+    if (inRow < inCol)
+        std::swap(inRow, inCol);
+    return mPacked.coeffRef(columnOffset(inCol) + inRow - inCol);
+}
+
+template <class EigenType, class Handle>
+inline
+bool
+SymmetricPackedHandleMap<EigenType, Handle>::is_finite() const {
+    return mPacked.is_finite();
+}
+
+/**
+ * @brief Return the packed storage as a column vector
+ */
+template <class EigenType, class Handle>
+inline
+const typename SymmetricPackedHandleMap<EigenType, Handle>::Packed_type&
+SymmetricPackedHandleMap<EigenType, Handle>::packed() const {
+    return mPacked;
+}
+
+template <class EigenType, class Handle>
+inline
+typename SymmetricPackedHandleMap<EigenType, Handle>::Packed_type&
+SymmetricPackedHandleMap<EigenType, Handle>::packed() {
+    return mPacked;
+}
+
+/**
+ * @brief Return the full (dense) symmetric matrix
+ */
+template <class EigenType, class Handle>
+inline
+typename SymmetricPackedHandleMap<EigenType, Handle>::PlainMatrix
+SymmetricPackedHandleMap<EigenType, Handle>::unpack() const {
+    PlainMatrix matrix(mDimension, mDimension);
+    for (Index j = 0; j < mDimension; ++j) {
+        matrix.col(j).tail(mDimension - j)
+            = mPacked.segment(columnOffset(j), mDimension - j);
+        matrix.row(j).tail(mDimension - j)
+            = mPacked.segment(columnOffset(j), mDimension - j).transpose();
+    }
+    return matrix;
+}
+
+template <class EigenType, class Handle>
+inline
+void
+SymmetricPackedHandleMap<EigenType, Handle>::fill(const Scalar& inValue) {
+    mPacked.fill(inValue);
+}
+
+/**
+ * @brief Perform the rank-one update \f$ M \leftarrow M + \alpha v v^T \f$
+ *
+ * Only the lower triangle is computed, so this costs half as many operations
+ * as a dense update.
+ */
+template <class EigenType, class Handle>
+template <class Derived>
+inline
+SymmetricPackedHandleMap<EigenType, Handle>&
+SymmetricPackedHandleMap<EigenType, Handle>::rankUpdate(
+    const Eigen::MatrixBase<Derived>& inVector, const Scalar& inAlpha) {
+
+    madlib_assert(inVector.size() == mDimension,
+        std::runtime_error("Internal error: Dimension mismatch in rank "
+            "update of symmetric matrix."));
+
+    for (Index j = 0; j < mDimension; ++j)
+        mPacked.segment(columnOffset(j), mDimension - j).noalias()
+            += (inAlpha * inVector(j)) * inVector.tail(mDimension - j);
+    return *this;
+}
+
+/**
+ * @brief Add a symmetric dense matrix, given by its lower triangle
+ *
+ * The strict upper triangle of the argument is not read.
+ */
+template <class EigenType, class Handle>
+template <class Derived>
+inline
+SymmetricPackedHandleMap<EigenType, Handle>&
+SymmetricPackedHandleMap<EigenType, Handle>::addLowerTriangle(
+    const Eigen::MatrixBase<Derived>& inMatrix, const Scalar& inAlpha) {
+
+    madlib_assert(inMatrix.rows() == mDimension
+        && inMatrix.cols() == mDimension,
+        std::runtime_error("Internal error: Dimension mismatch in addition "
+            "to symmetric matrix."));
+
+    for (Index j = 0; j < mDimension; ++j)
+        mPacked.segment(columnOffset(j), mDimension - j)
+            += inAlpha * inMatrix.col(j).tail(mDimension - j);
+    return *this;
+}
+
+template <class EigenType, class Handle>
+template <class OtherEigenType, class OtherHandle>
+inline
+SymmetricPackedHandleMap<EigenType, Handle>&
+SymmetricPackedHandleMap<EigenType, Handle>::operator+=(
+    const SymmetricPackedHandleMap<OtherEigenType, OtherHandle>& inOther) {
+
+    madlib_assert(inOther.rows() == mDimension,
+        std::runtime_error("Internal error: Dimension mismatch in addition "
+            "of symmetric matrices."));
+
+    mPacked += inOther.packed();
+    return *this;
+}
+
+} // namespace eigen_integration
+
+} // namespace dbal
+
+} // namespace madlib
+
+#endif // defined(MADLIB_DBAL_EIGEN_SYMMETRICPACKEDHANDLEMAP_IMPL_HPP)
@@ -0,0 +1,87 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file SymmetricPackedHandleMap_proto.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_DBAL_EIGEN_SYMMETRICPACKEDHANDLEMAP_PROTO_HPP
+#define MADLIB_DBAL_EIGEN_SYMMETRICPACKEDHANDLEMAP_PROTO_HPP
+
+namespace madlib {
+
+namespace dbal {
+
+namespace eigen_integration {
+
+/**
+ * @brief Symmetric matrix of which only the lower triangle is stored
+ *
+ * Transition states are shipped between segments and the master verbatim, so
+ * storing symmetric matrices (such as \f$ X^T A X \f$ or Hessians) in full
+ * doubles the size of the state for no benefit. This class stores the lower
+ * triangle in packed column-major order: column \f$ j \f$ occupies
+ * \f$ n - j \f$ consecutive elements, starting with the diagonal element.
+ * The packed storage needs \f$ n(n+1)/2 \f$ elements.
+ *
+ * Updates (rank-one updates and additions) only touch the packed storage.
+ * Where a dense matrix is needed (e.g., for a decomposition), unpack() returns
+ * the full symmetric matrix.
+ *
+ * EigenType determines mutability in the same way as for HandleMap: If it is
+ * a const type, the handle may be immutable and no updates are allowed.
+ */
+template <class EigenType, class Handle>
+class SymmetricPackedHandleMap {
+public:
+    typedef typename boost::remove_cv<EigenType>::type PlainMatrix;
+    typedef typename PlainMatrix::Scalar Scalar;
+    typedef typename PlainMatrix::Index Index;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> PlainVector;
+    typedef HandleMap<
+        typename boost::mpl::if_<boost::is_const<EigenType>,
+            const PlainVector, PlainVector>::type,
+        Handle> Packed_type;
+
+    SymmetricPackedHandleMap();
+    SymmetricPackedHandleMap(const Handle &inHandle, Index inDimension);
+
+    SymmetricPackedHandleMap& rebind(const Handle &inHandle,
+        Index inDimension);
+    static Index packedSize(Index inDimension);
+
+    Index rows() const;
+    Index cols() const;
+    Scalar operator()(Index inRow, Index inCol) const;
+    Scalar& coeffRef(Index inRow, Index inCol);
+    bool is_finite() const;
+    const Packed_type& packed() const;
+    Packed_type& packed();
+    PlainMatrix unpack() const;
+
+    void fill(const Scalar& inValue);
+    template <class Derived>
+    SymmetricPackedHandleMap& rankUpdate(
+        const Eigen::MatrixBase<Derived>& inVector,
+        const Scalar& inAlpha = Scalar(1));
+    template <class Derived>
+    SymmetricPackedHandleMap& addLowerTriangle(
+        const Eigen::MatrixBase<Derived>& inMatrix,
+        const Scalar& inAlpha = Scalar(1));
+    template <class OtherEigenType, class OtherHandle>
+    SymmetricPackedHandleMap& operator+=(
+        const SymmetricPackedHandleMap<OtherEigenType, OtherHandle>& inOther);
+
+protected:
+    Index columnOffset(Index inCol) const;
+
+    Index mDimension;
+    Packed_type mPacked;
+};
+
+} // namespace eigen_integration
+
+} // namespace dbal
+
+} // namespace madlib
+
+#endif // defined(MADLIB_DBAL_EIGEN_SYMMETRICPACKEDHANDLEMAP_PROTO_HPP)
@@ -0,0 +1,246 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file conjugate_gradient.cpp
+ *
+ * @brief (Preconditioned) conjugate gradient method
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#include <dbconnector/dbconnector.hpp>
+#include <modules/shared/HandleTraits.hpp>
+
+#include "conjugate_gradient.hpp"
+
+namespace madlib {
+
+// Use Eigen
+using namespace dbal::eigen_integration;
+
+namespace modules {
+
+namespace conjugate_gradient {
+
+/**
+ * @brief Inter-iteration state of the conjugate gradient method
+ *
+ * One iteration needs the product A p of the matrix with the current search
+ * direction, which the driver computes with one pass of the
+ * matrix_vector_product aggregate. Everything else is O(n) and happens in
+ * the functions below, so no vector ever leaves the database.
+ */
+template <class Handle>
+class CGState {
+public:
+    CGState(const AnyType &inArray)
+        : mStorage(inArray.getAs<Handle>()) {
+
+        rebind(static_cast<uint32_t>(mStorage[0]));
+    }
+
+    /**
+     * @brief Allocate a new (zeroed) state for the given number of unknowns
+     */
+    CGState(const Allocator &inAllocator, uint32_t inDimension)
+        : mStorage(inAllocator.allocateArray<double, dbal::FunctionContext,
+            dbal::DoZero, dbal::ThrowBadAlloc>(arraySize(inDimension))) {
+
+        rebind(inDimension);
+        dimension = inDimension;
+    }
+
+    operator AnyType() const {
+        return mStorage;
+    }
+
+    /**
+     * @brief Set the search direction to the preconditioned residual
+     */
+    void resetDirection() {
+        direction = inversePreconditioner.cwiseProduct(residual);
+        rz = residual.dot(direction);
+        residualNorm = residual.squaredNorm();
+    }
+
+private:
+    static inline size_t arraySize(uint32_t inDimension) {
+        return static_cast<size_t>(6 + 4 * inDimension);
+    }
+
+    /**
+     * @brief Rebind to a new storage array
+     *
+     * @param inDimension The number of unknowns
+     *
+     * Array layout:
+     * - 0: dimension (number of unknowns n)
+     * - 1: numIterations (number of iterations performed)
+     * - 2: numRestarts (number of restarts from the true residual)
+     * - 3: numStalls (consecutive iterations without a smaller residual)
+     * - 4: rz (residual times preconditioned residual)
+     * - 5: residualNorm (squared 2-norm of the residual)
+     * - 6: x (current solution, n elements)
+     * - 6 + n: residual (b - A x, n elements)
+     * - 6 + 2n: direction (search direction p, n elements)
+     * - 6 + 3n: inversePreconditioner (inverse of the diagonal of the
+     *   preconditioner, n elements)
+     */
+    void rebind(uint32_t inDimension) {
+        madlib_assert(mStorage.size() >= arraySize(inDimension),
+            std::runtime_error("Out-of-bounds array access detected."));
+
+        dimension.rebind(&mStorage[0]);
+        numIterations.rebind(&mStorage[1]);
+        numRestarts.rebind(&mStorage[2]);
+        numStalls.rebind(&mStorage[3]);
+        rz.rebind(&mStorage[4]);
+        residualNorm.rebind(&mStorage[5]);
+        x.rebind(&mStorage[6], inDimension);
+        residual.rebind(&mStorage[6 + inDimension], inDimension);
+        direction.rebind(&mStorage[6 + 2 * inDimension], inDimension);
+        inversePreconditioner.rebind(&mStorage[6 + 3 * inDimension],
+            inDimension);
+    }
+
+    Handle mStorage;
+
+public:
+    typename HandleTraits<Handle>::ReferenceToUInt32 dimension;
+    typename HandleTraits<Handle>::ReferenceToUInt32 numIterations;
+    typename HandleTraits<Handle>::ReferenceToUInt32 numRestarts;
+    typename HandleTraits<Handle>::ReferenceToUInt32 numStalls;
+    typename HandleTraits<Handle>::ReferenceToDouble rz;
+    typename HandleTraits<Handle>::ReferenceToDouble residualNorm;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap x;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap residual;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap direction;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap
+        inversePreconditioner;
+};
+
+/**
+ * @brief Start from x = 0, so that the residual is b
+ *
+ * If the diagonal of the matrix is given, it is used as (Jacobi)
+ * preconditioner.
+ */
+AnyType
+internal_cg_init::run(AnyType &args) {
+    MappedColumnVector b = args[0].getAs<MappedColumnVector>();
+    if (b.size() == 0)
+        throw std::invalid_argument("Invalid arguments: b must not be empty.");
+
+    CGState<MutableArrayHandle<double> > state(*this,
+        static_cast<uint32_t>(b.size()));
+    state.residual = b;
+
+    if (args[1].isNull()) {
+        state.inversePreconditioner.setOnes();
+    } else {
+        MappedColumnVector diagonal = args[1].getAs<MappedColumnVector>();
+        if (diagonal.size() != b.size())
+            throw std::invalid_argument("Invalid arguments: The matrix must "
+                "have as many rows as b has elements.");
+        if ((diagonal.array() <= 0).any())
+            throw std::invalid_argument("Invalid arguments: The Jacobi "
+                "preconditioner needs a positive diagonal. Check if input is "
+                "positive definite.");
+        state.inversePreconditioner = diagonal.cwiseInverse();
+    }
+    state.resetDirection();
+    return state;
+}
+
+AnyType
+internal_cg_direction::run(AnyType &args) {
+    CGState<ArrayHandle<double> > state = args[0];
+
+    MutableNativeColumnVector direction(allocateArray<double>(
+        static_cast<uint32_t>(state.dimension)));
+    direction = state.direction;
+    return direction;
+}
+
+AnyType
+internal_cg_step::run(AnyType &args) {
+    CGState<MutableArrayHandle<double> > state = args[0];
+    MappedColumnVector Ap = args[1].getAs<MappedColumnVector>();
+
+    if (Ap.size() != state.direction.size())
+        throw std::invalid_argument("Invalid arguments: The matrix must have "
+            "as many rows as b has elements.");
+
+    double pAp = state.direction.dot(Ap);
+    if (!(pAp > 0))
+        throw std::runtime_error("Algorithm failed to converge. Check if "
+            "input is positive definite.");
+
+    double alpha = state.rz / pAp;
+    double rzOld = state.rz;
+    double residualNormOld = state.residualNorm;
+    state.x += alpha * state.direction;
+    state.residual -= alpha * Ap;
+
+    // p = z + beta p, where z is the preconditioned residual
+    state.rz = state.residual.dot(
+        state.inversePreconditioner.cwiseProduct(state.residual));
+    state.direction *= state.rz / rzOld;
+    state.direction += state.inversePreconditioner.cwiseProduct(
+        state.residual);
+    state.residualNorm = state.residual.squaredNorm();
+
+    state.numIterations ++;
+    if (state.residualNorm < residualNormOld)
+        state.numStalls = 0;
+    else
+        state.numStalls ++;
+    if (state.numStalls >= 15)
+        throw std::runtime_error("Algorithm failed to converge. Check if "
+            "input is positive definite.");
+
+    return state;
+}
+
+/**
+ * @brief Replace the updated residual by the true residual b - A x
+ *
+ * Rounding errors accumulate in the residual that is updated in every
+ * iteration, so it is recomputed before accepting a solution.
+ */
+AnyType
+internal_cg_restart::run(AnyType &args) {
+    CGState<MutableArrayHandle<double> > state = args[0];
+    MappedColumnVector b = args[1].getAs<MappedColumnVector>();
+    MappedColumnVector Ax = args[2].getAs<MappedColumnVector>();
+
+    if (b.size() != state.residual.size() || Ax.size() != b.size())
+        throw std::invalid_argument("Invalid arguments: The matrix must have "
+            "as many rows as b has elements.");
+
+    state.residual = b - Ax;
+    state.resetDirection();
+    state.numRestarts ++;
+    return state;
+}
+
+AnyType
+internal_cg_residual_norm::run(AnyType &args) {
+    CGState<ArrayHandle<double> > state = args[0];
+
+    return static_cast<double>(state.residualNorm);
+}
+
+AnyType
+internal_cg_result::run(AnyType &args) {
+    CGState<ArrayHandle<double> > state = args[0];
+
+    MutableNativeColumnVector x(allocateArray<double>(
+        static_cast<uint32_t>(state.dimension)));
+    x = state.x;
+    return x;
+}
+
+} // namespace conjugate_gradient
+
+} // namespace modules
+
+} // namespace madlib
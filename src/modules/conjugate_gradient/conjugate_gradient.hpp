@@ -0,0 +1,37 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file conjugate_gradient.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+/**
+ * @brief Conjugate gradient: Initial state for the right-hand side b and an
+ *     optional Jacobi preconditioner
+ */
+DECLARE_UDF(conjugate_gradient, internal_cg_init)
+
+/**
+ * @brief Conjugate gradient: Search direction p of a state
+ */
+DECLARE_UDF(conjugate_gradient, internal_cg_direction)
+
+/**
+ * @brief Conjugate gradient: Next state, given the product A p
+ */
+DECLARE_UDF(conjugate_gradient, internal_cg_step)
+
+/**
+ * @brief Conjugate gradient: Restart from the true residual, given the
+ *     product A x
+ */
+DECLARE_UDF(conjugate_gradient, internal_cg_restart)
+
+/**
+ * @brief Conjugate gradient: Squared norm of the residual of a state
+ */
+DECLARE_UDF(conjugate_gradient, internal_cg_residual_norm)
+
+/**
+ * @brief Conjugate gradient: Solution x of a state
+ */
+DECLARE_UDF(conjugate_gradient, internal_cg_result)
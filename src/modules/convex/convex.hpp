@@ -7,4 +7,5 @@
  * -------------------------------------------------------------------------- */
 
 #include "lmf_igd.hpp"
+#include "lmf_als.hpp"
 
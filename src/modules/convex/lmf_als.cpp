@@ -0,0 +1,217 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file lmf_als.cpp
+ *
+ * @brief Low-rank Matrix Factorization functions using alternating least
+ *     squares
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#include <dbconnector/dbconnector.hpp>
+#include <modules/shared/HandleTraits.hpp>
+
+#include "lmf_als.hpp"
+
+#include "type/model.hpp"
+#include "type/state.hpp"
+
+namespace madlib {
+
+namespace modules {
+
+namespace convex {
+
+// Use Eigen
+using namespace madlib::dbal::eigen_integration;
+
+/**
+ * @brief Perform the alternating least-squares transition step
+ *
+ * Called for each tuple. Each entry a_ij contributes the rank-1 update
+ * v_j v_j' to the Gram matrix of row i (and a_ij v_j to its right-hand side)
+ * when solving for U, and symmetrically when solving for V.
+ */
+AnyType
+lmf_als_transition::run(AnyType &args) {
+    // For the first tuple: args[0] is nothing more than a marker that
+    // indicates that we should do some initial operations.
+    LMFALSState<MutableArrayHandle<double> > state = args[0];
+
+    // initilize the state if first tuple
+    if (state.algo.numRows == 0) {
+        if (!args[4].isNull()) {
+            LMFALSState<ArrayHandle<double> > previousState = args[4];
+            state.allocate(*this, previousState.task.rowDim,
+                    previousState.task.colDim, previousState.task.maxRank,
+                    previousState.task.numIterations);
+            state.copyTask(previousState);
+        } else {
+            // configuration parameters
+            uint32_t rowDim = args[5].getAs<uint32_t>();
+            if (rowDim == 0) {
+                throw std::runtime_error("Invalid parameter: row_dim = 0");
+            }
+            uint32_t columnDim = args[6].getAs<uint32_t>();
+            if (columnDim == 0) {
+                throw std::runtime_error("Invalid parameter: column_dim = 0");
+            }
+            uint16_t maxRank = args[7].getAs<uint16_t>();
+            if (maxRank == 0) {
+                throw std::runtime_error("Invalid parameter: max_rank = 0");
+            }
+            double lambda = args[8].getAs<double>();
+            if (lambda <= 0.) {
+                throw std::runtime_error("Invalid parameter: lambda <= 0.0");
+            }
+            double scaleFactor = args[9].getAs<double>();
+            if (scaleFactor <= 0.) {
+                throw std::runtime_error("Invalid parameter: scale_factor <= "
+                        "0.0");
+            }
+
+            state.allocate(*this, rowDim, columnDim, maxRank, 0);
+            state.task.lambda = lambda;
+            state.task.initValue = scaleFactor;
+            state.task.model.initialize(scaleFactor);
+        }
+        // resetting in either case
+        state.reset();
+    }
+
+    int32_t i = args[1].getAs<int32_t>();
+    int32_t j = args[2].getAs<int32_t>();
+    if (i <= 0 || j <= 0) {
+        throw std::runtime_error("Invalid parameter: [col_row] <= 0 or "
+                "[col_column] <= 0 in table [rel_source]");
+    }
+    if (static_cast<uint32_t>(i) > state.task.rowDim
+            || static_cast<uint32_t>(j) > state.task.colDim) {
+        throw std::runtime_error("Invalid parameter: [col_row] > row_dim or "
+                "[col_column] > column_dim in table [rel_source]");
+    }
+    // database starts from 1, while C++ starts from 0
+    i --;
+    j --;
+    double a = args[3].getAs<double>();
+
+    // loss of the model as it is before this iteration's solve
+    double e = state.task.model.matrixU.row(i).dot(
+        state.task.model.matrixV.row(j)) - a;
+    state.algo.loss += e * e;
+
+    // the fixed factor provides the regressors, the other one is solved for
+    Index solved;
+    ColumnVector x;
+    if (state.solvesForU()) {
+        solved = i;
+        x = trans(state.task.model.matrixV.row(j));
+    } else {
+        solved = j;
+        x = trans(state.task.model.matrixU.row(i));
+    }
+
+    state.algo.count(solved) += 1.;
+    state.algo.rhs.col(solved).noalias() += a * x;
+    // Gram matrices are symmetric, so only their lower triangles are stored
+    state.gram(solved).rankUpdate(x);
+    state.algo.numRows ++;
+
+    return state;
+}
+
+/**
+ * @brief Perform the perliminary aggregation function: Merge transition states
+ */
+AnyType
+lmf_als_merge::run(AnyType &args) {
+    LMFALSState<MutableArrayHandle<double> > stateLeft = args[0];
+    LMFALSState<ArrayHandle<double> > stateRight = args[1];
+
+    // We first handle the trivial case where this function is called with one
+    // of the states being the initial state
+    if (stateLeft.algo.numRows == 0) { return stateRight; }
+    else if (stateRight.algo.numRows == 0) { return stateLeft; }
+
+    // Both states started from the same model, so the normal equations simply
+    // add up
+    stateLeft.algo.numRows += stateRight.algo.numRows;
+    stateLeft.algo.loss += stateRight.algo.loss;
+    stateLeft.algo.count += stateRight.algo.count;
+    stateLeft.algo.rhs += stateRight.algo.rhs;
+    stateLeft.algo.gram += stateRight.algo.gram;
+
+    return stateLeft;
+}
+
+/**
+ * @brief Perform the alternating least-squares final step
+ *
+ * Solves the regularized rank x rank normal equations of every row of the
+ * factor this iteration is responsible for. Rows without any entries keep
+ * their previous value. Only the task state is returned; the normal equations
+ * are not needed beyond this iteration.
+ */
+AnyType
+lmf_als_final::run(AnyType &args) {
+    // We request a mutable object. Depending on the backend, this might perform
+    // a deep copy.
+    LMFALSState<MutableArrayHandle<double> > state = args[0];
+
+    // Aggregates that haven't seen any data just return Null.
+    if (state.algo.numRows == 0) { return Null(); }
+
+    Matrix gram;
+    for (Index k = 0; k < state.algo.count.size(); k ++) {
+        if (state.algo.count(k) == 0) { continue; }
+
+        // weighted-lambda regularization: the penalty grows with the number
+        // of entries of the row
+        gram = state.gram(k).unpack();
+        gram.diagonal().array() += state.task.lambda * state.algo.count(k);
+        ColumnVector solution = gram.ldlt().solve(state.algo.rhs.col(k));
+
+        if (state.solvesForU()) {
+            state.task.model.matrixU.row(k) = trans(solution);
+        } else {
+            state.task.model.matrixV.row(k) = trans(solution);
+        }
+    }
+    state.computeRMSE();
+    state.task.numIterations ++;
+
+    return state.taskState(*this);
+}
+
+/**
+ * @brief Return the difference in RMSE between two states
+ */
+AnyType
+internal_lmf_als_distance::run(AnyType &args) {
+    LMFALSState<ArrayHandle<double> > stateLeft = args[0];
+    LMFALSState<ArrayHandle<double> > stateRight = args[1];
+
+    return std::abs(stateLeft.task.RMSE - stateRight.task.RMSE);
+}
+
+/**
+ * @brief Return the factors and the RMSE of the state
+ */
+AnyType
+internal_lmf_als_result::run(AnyType &args) {
+    LMFALSState<ArrayHandle<double> > state = args[0];
+
+    Matrix U = trans(state.task.model.matrixU);
+    Matrix V = trans(state.task.model.matrixV);
+    double RMSE = state.task.RMSE;
+
+    AnyType tuple;
+    tuple << U << V << RMSE;
+
+    return tuple;
+}
+
+} // namespace convex
+
+} // namespace modules
+
+} // namespace madlib
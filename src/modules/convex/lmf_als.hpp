@@ -0,0 +1,36 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file lmf_als.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+/**
+ * @brief Low-rank matrix factorization (alternating least squares): Transition
+ *     function
+ */
+DECLARE_UDF(convex, lmf_als_transition)
+
+/**
+ * @brief Low-rank matrix factorization (alternating least squares): State
+ *     merge function
+ */
+DECLARE_UDF(convex, lmf_als_merge)
+
+/**
+ * @brief Low-rank matrix factorization (alternating least squares): Final
+ *     function
+ */
+DECLARE_UDF(convex, lmf_als_final)
+
+/**
+ * @brief Low-rank matrix factorization (alternating least squares):
+ *     Difference in RMSE between two transition states
+ */
+DECLARE_UDF(convex, internal_lmf_als_distance)
+
+/**
+ * @brief Low-rank matrix factorization (alternating least squares): Convert
+ *     transition state to result tuple
+ */
+DECLARE_UDF(convex, internal_lmf_als_result)
+
@@ -51,7 +51,7 @@ lmf_igd_transition::run(AnyType &args) {
             LMFIGDState<ArrayHandle<double> > previousState = args[4];
             state.allocate(*this, previousState.task.rowDim,
                     previousState.task.colDim, previousState.task.maxRank);
-            state = previousState;
+            state.copyTask(previousState);
         } else {
             // configuration parameters
             uint16_t rowDim = args[5].getAs<uint16_t>();
@@ -148,7 +148,9 @@ lmf_igd_final::run(AnyType &args) {
     // for stepsize tuning
     dberr << "RMSE: " << state.task.RMSE << std::endl;
 
-    return state;
+    // The incremental model equals the model now, so there is no need to
+    // keep it between iterations
+    return state.taskState(*this);
 }
 
 /**
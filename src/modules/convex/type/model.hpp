@@ -30,9 +30,9 @@ struct LMFModel {
      * necessary for a matrix, so that it can perform operations. These are
      * stored in the HandleMap.
      */
-    static inline uint32_t arraySize(const uint16_t inRowDim, 
-            const uint16_t inColDim, const uint16_t inMaxRank) {
-        return (inRowDim + inColDim) * inMaxRank;
+    static inline uint64_t arraySize(const uint32_t inRowDim,
+            const uint32_t inColDim, const uint16_t inMaxRank) {
+        return (static_cast<uint64_t>(inRowDim) + inColDim) * inMaxRank;
     }
 
     /**
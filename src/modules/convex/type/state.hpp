@@ -17,6 +17,21 @@ namespace modules {
 
 namespace convex {
 
+/**
+ * @brief Return the number of elements of a state array, or throw if the
+ *        backend cannot represent an array of that many elements
+ *
+ * Sizes are computed in 64 bits, where they cannot overflow for any
+ * dimensions the states accept. Array dimensions are 32-bit signed integers
+ * in the backend.
+ */
+inline size_t checkedArraySize(uint64_t inSize) {
+    if (inSize > static_cast<uint64_t>(std::numeric_limits<int32_t>::max()))
+        throw std::length_error("Invalid parameter: row_dim, column_dim and "
+            "max_rank are too large for the transition state");
+    return static_cast<size_t>(inSize);
+}
+
 /**
  * @brief Inter- (Task State) and intra-iteration (Algo State) state of
  *        incremental gradient descent for low-rank matrix factorization
@@ -84,6 +99,32 @@ public:
         return *this;
     }
 
+    /**
+     * @brief Copy the task state (the model) from another state
+     */
+    template <class OtherHandle>
+    void copyTask(const LMFIGDState<OtherHandle> &inOtherState) {
+        for (size_t i = 0; i < taskArraySize(task.rowDim, task.colDim,
+                task.maxRank); i++) {
+            mStorage[i] = inOtherState.mStorage[i];
+        }
+    }
+
+    /**
+     * @brief Return a copy of just the task state
+     */
+    inline AnyType taskState(const Allocator &inAllocator) const {
+        size_t size = taskArraySize(task.rowDim, task.colDim, task.maxRank);
+        MutableArrayHandle<double> result = inAllocator.allocateArray<double,
+                dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(
+                size);
+        for (size_t i = 0; i < size; i++) {
+            result[i] = mStorage[i];
+        }
+
+        return result;
+    }
+
     /**
      * @brief Reset the intra-iteration fields.
      */
@@ -104,9 +145,16 @@ public:
         task.RMSE = sqrt(algo.loss / static_cast<double>(algo.numRows));
     }
 
-    static inline uint32_t arraySize(const uint16_t inRowDim, 
+    static inline size_t taskArraySize(const uint16_t inRowDim,
             const uint16_t inColDim, const uint16_t inMaxRank) {
-        return 8 + 2 * LMFModel<Handle>::arraySize(inRowDim, inColDim, inMaxRank);
+        return checkedArraySize(6
+            + LMFModel<Handle>::arraySize(inRowDim, inColDim, inMaxRank));
+    }
+
+    static inline size_t arraySize(const uint16_t inRowDim,
+            const uint16_t inColDim, const uint16_t inMaxRank) {
+        return checkedArraySize(8
+            + 2 * LMFModel<Handle>::arraySize(inRowDim, inColDim, inMaxRank));
     }
 
 private:
@@ -136,14 +184,18 @@ private:
         task.stepsize.rebind(&mStorage[3]);
         task.initValue.rebind(&mStorage[4]);
         task.model.matrixU.rebind(&mStorage[5], task.rowDim, task.maxRank);
-        task.model.matrixV.rebind(&mStorage[5 + task.rowDim * task.maxRank],
-                task.colDim, task.maxRank);
-        uint32_t modelLength = LMFModel<Handle>::arraySize(task.rowDim,
+        task.model.matrixV.rebind(
+                &mStorage[5 + static_cast<size_t>(task.rowDim) * task.maxRank],
                 task.colDim, task.maxRank);
+        size_t modelLength = checkedArraySize(LMFModel<Handle>::arraySize(
+                task.rowDim, task.colDim, task.maxRank));
 //        task.model.rebind(&mStorage[5], task.rowDim,
 //                task.colDim, task.maxRank);
         task.RMSE.rebind(&mStorage[5 + modelLength]);
 
+        // The final function returns just the task state
+        if (mStorage.size() < 8 + modelLength) { return; }
+
         algo.numRows.rebind(&mStorage[6 + modelLength]);
         algo.loss.rebind(&mStorage[7 + modelLength]);
 //        algo.incrModel.rebind(&mStorage[8 + modelLength], task.rowDim,
@@ -151,7 +203,8 @@ private:
         algo.incrModel.matrixU.rebind(&mStorage[8 + modelLength],
                 task.rowDim, task.maxRank);
         algo.incrModel.matrixV.rebind(&mStorage[8 + modelLength +
-                task.rowDim * task.maxRank], task.colDim, task.maxRank);
+                static_cast<size_t>(task.rowDim) * task.maxRank],
+                task.colDim, task.maxRank);
     }
 
     Handle mStorage;
@@ -174,6 +227,230 @@ public:
     } algo;
 };
 
+/**
+ * @brief Inter- (Task State) and intra-iteration (Algo State) state of
+ *        alternating least squares for low-rank matrix factorization
+ *
+ * Each iteration is one aggregate pass that solves for one of the two factors
+ * while the other one is held fixed: even iterations solve for the rows of U,
+ * odd iterations for the rows of V. The transition function accumulates, for
+ * every row of the factor being solved, the rank x rank normal equations of
+ * its least-squares problem. The final function solves them in memory.
+ *
+ * The normal equations are only needed within an iteration. The final
+ * function therefore returns just the task state, which is also what the
+ * driver keeps between iterations; rebind() only binds the algo state if the
+ * storage is large enough to hold it.
+ *
+ * Note: We assume that the DOUBLE PRECISION array is initialized by the
+ * database with length at least 9, and all elements are 0.
+ */
+template <class Handle>
+class LMFALSState {
+    template <class OtherHandle>
+    friend class LMFALSState;
+
+public:
+    LMFALSState(const AnyType &inArray) : mStorage(inArray.getAs<Handle>()) {
+        rebind();
+    }
+
+    /**
+     * @brief Convert to backend representation
+     *
+     * We define this function so that we can use State in the
+     * argument list and as a return type.
+     */
+    inline operator AnyType() const {
+        return mStorage;
+    }
+
+    /**
+     * @brief Allocating the alternating least-squares state.
+     *
+     * The size of the algo state depends on which factor the iteration
+     * solves for, so the iteration number is needed here.
+     */
+    inline void allocate(const Allocator &inAllocator, uint32_t inRowDim,
+            uint32_t inColDim, uint16_t inMaxRank, uint32_t inNumIterations) {
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+                dbal::DoZero, dbal::ThrowBadAlloc>(
+                arraySize(inRowDim, inColDim, inMaxRank, inNumIterations));
+
+        // Same trick as in LMFIGDState: bind the scalars first, so that the
+        // second rebind sees the correct dimensions
+        mStorage[0] = inRowDim;
+        mStorage[1] = inColDim;
+        mStorage[2] = inMaxRank;
+        mStorage[5] = inNumIterations;
+        rebind();
+    }
+
+    /**
+     * @brief Copy the task state (the model) from another state
+     */
+    template <class OtherHandle>
+    void copyTask(const LMFALSState<OtherHandle> &inOtherState) {
+        for (size_t i = 0; i < taskArraySize(task.rowDim, task.colDim,
+                task.maxRank); i++) {
+            mStorage[i] = inOtherState.mStorage[i];
+        }
+    }
+
+    /**
+     * @brief Return a copy of just the task state
+     */
+    inline AnyType taskState(const Allocator &inAllocator) const {
+        size_t size = taskArraySize(task.rowDim, task.colDim, task.maxRank);
+        MutableArrayHandle<double> result = inAllocator.allocateArray<double,
+                dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(
+                size);
+        for (size_t i = 0; i < size; i++) {
+            result[i] = mStorage[i];
+        }
+
+        return result;
+    }
+
+    /**
+     * @brief Reset the intra-iteration fields.
+     */
+    inline void reset() {
+        algo.numRows = 0;
+        algo.loss = 0.;
+        algo.count.setZero();
+        algo.rhs.setZero();
+        algo.gram.setZero();
+    }
+
+    /**
+     * @brief Whether this iteration solves for U (or else for V)
+     */
+    inline bool solvesForU() const {
+        return task.numIterations % 2 == 0;
+    }
+
+    /**
+     * @brief Compute RMSE using loss and numRows
+     */
+    inline void computeRMSE() {
+        task.RMSE = sqrt(algo.loss / static_cast<double>(algo.numRows));
+    }
+
+    static inline size_t taskArraySize(const uint32_t inRowDim,
+            const uint32_t inColDim, const uint16_t inMaxRank) {
+        return checkedArraySize(7
+            + LMFModel<Handle>::arraySize(inRowDim, inColDim, inMaxRank));
+    }
+
+    static inline size_t arraySize(const uint32_t inRowDim,
+            const uint32_t inColDim, const uint16_t inMaxRank,
+            const uint32_t inNumIterations) {
+        uint64_t numSolved = inNumIterations % 2 == 0 ? inRowDim : inColDim;
+        return checkedArraySize(7
+            + LMFModel<Handle>::arraySize(inRowDim, inColDim, inMaxRank) + 2
+            + numSolved * (1 + inMaxRank + gramSize(inMaxRank)));
+    }
+
+    /**
+     * @brief Number of elements of the packed lower triangle of a Gram matrix
+     */
+    static inline uint64_t gramSize(const uint16_t inMaxRank) {
+        return static_cast<uint64_t>(inMaxRank) * (inMaxRank + 1) / 2;
+    }
+
+    /**
+     * @brief Return the Gram matrix of the normal equations of a solved row
+     */
+    inline typename HandleTraits<Handle>::SymmetricMatrixTransparentHandleMap
+    gram(size_t inSolved) {
+        return typename HandleTraits<Handle>
+            ::SymmetricMatrixTransparentHandleMap(
+                algo.gram.col(inSolved).data(), task.maxRank);
+    }
+
+private:
+    /**
+     * @brief Rebind to a new storage array.
+     *
+     * Array layout (iteration refers to one aggregate-function call):
+     * Inter-iteration components (updated in final function):
+     * - 0: rowDim (row dimension of the input sparse matrix A)
+     * - 1: colDim (col dimension of the input sparse matrix A)
+     * - 2: maxRank (the rank of the low-rank assumption)
+     * - 3: lambda (regularization, scaled by the number of ratings per row)
+     * - 4: initValue (value scale used to initialize the model)
+     * - 5: numIterations (number of completed half-steps)
+     * - 6: RMSE (root mean squared error of the model before the last step)
+     * - 7: model (matrices U(rowDim x maxRank), V(colDim x maxRank), A ~ UV')
+     *
+     * Intra-iteration components (updated in transition step):
+     *   taskLength = 7 + (rowDim + colDim) * maxRank
+     *   numSolved = rowDim if solving for U, colDim if solving for V
+     * - taskLength: numRows (number of rows processed in this iteration)
+     * - taskLength + 1: loss (sum of squared errors)
+     * - taskLength + 2: count (number of entries per solved row)
+     * - taskLength + 2 + numSolved: rhs (maxRank x numSolved, right-hand
+     *   sides of the normal equations)
+     * - taskLength + 2 + numSolved * (1 + maxRank): gram
+     *   (maxRank * (maxRank + 1) / 2 x numSolved, lower triangles of the
+     *   Gram matrices of the normal equations, packed as in
+     *   SymmetricPackedHandleMap)
+     */
+    void rebind() {
+        task.rowDim.rebind(&mStorage[0]);
+        task.colDim.rebind(&mStorage[1]);
+        task.maxRank.rebind(&mStorage[2]);
+        task.lambda.rebind(&mStorage[3]);
+        task.initValue.rebind(&mStorage[4]);
+        task.numIterations.rebind(&mStorage[5]);
+        task.RMSE.rebind(&mStorage[6]);
+        task.model.matrixU.rebind(&mStorage[7], task.rowDim, task.maxRank);
+        task.model.matrixV.rebind(
+                &mStorage[7 + static_cast<size_t>(task.rowDim) * task.maxRank],
+                task.colDim, task.maxRank);
+
+        size_t taskLength = taskArraySize(task.rowDim, task.colDim,
+                task.maxRank);
+        if (mStorage.size() < taskLength + 2) { return; }
+
+        // The per-row arrays are empty as long as the dimensions are not
+        // known, so we use pointer arithmetic instead of the bounds-checked
+        // operator[] here
+        size_t numSolved = solvesForU() ? task.rowDim : task.colDim;
+        algo.numRows.rebind(&mStorage[taskLength]);
+        algo.loss.rebind(&mStorage[taskLength + 1]);
+        algo.count.rebind(mStorage.ptr() + taskLength + 2, numSolved);
+        algo.rhs.rebind(mStorage.ptr() + taskLength + 2 + numSolved,
+                task.maxRank, numSolved);
+        algo.gram.rebind(mStorage.ptr() + taskLength + 2
+                + numSolved * (1 + task.maxRank),
+                gramSize(task.maxRank), numSolved);
+    }
+
+    Handle mStorage;
+
+public:
+    struct TaskState {
+        typename HandleTraits<Handle>::ReferenceToUInt32 rowDim;
+        typename HandleTraits<Handle>::ReferenceToUInt32 colDim;
+        typename HandleTraits<Handle>::ReferenceToUInt16 maxRank;
+        typename HandleTraits<Handle>::ReferenceToDouble lambda;
+        typename HandleTraits<Handle>::ReferenceToDouble initValue;
+        typename HandleTraits<Handle>::ReferenceToUInt32 numIterations;
+        typename HandleTraits<Handle>::ReferenceToDouble RMSE;
+        LMFModel<Handle> model;
+    } task;
+
+    struct AlgoState {
+        typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+        typename HandleTraits<Handle>::ReferenceToDouble loss;
+        typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap count;
+        typename HandleTraits<Handle>::MatrixTransparentHandleMap rhs;
+        typename HandleTraits<Handle>::MatrixTransparentHandleMap gram;
+    } algo;
+};
+
 } // namespace convex
 
 } // namespace modules
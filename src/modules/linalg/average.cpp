@@ -23,6 +23,13 @@ namespace linalg {
 /**
  * @brief Transition state for computing average of vectors
  *
+ * The sum is kept with Neumaier's compensated summation: Each dimension has
+ * a compensation term that collects the rounding error of every addition.
+ * The error of the average is therefore independent of the number of rows.
+ * Merging two states also recovers the rounding error of adding their sums,
+ * so the result stays equally accurate however rows are split across
+ * segments.
+ *
  * Note: We assume that the DOUBLE PRECISION array is initialized by the
  * database with length 3, and all elemenets are 0. Handle::operator[] will
  * perform bounds checking.
@@ -62,13 +69,51 @@ public:
                 "states");
 
         numRows += inOtherState.numRows;
-        sumOfVectors += inOtherState.sumOfVectors;
+
+        double *sum = sumOfVectors.data();
+        double *compensation = compensationOfSum.data();
+        const double *otherSum = inOtherState.sumOfVectors.data();
+        const double *otherCompensation
+            = inOtherState.compensationOfSum.data();
+        for (Index i = 0; i < sumOfVectors.size(); ++i) {
+            // Knuth's TwoSum: sum[i] + otherSum[i] == total + error exactly
+            double total = sum[i] + otherSum[i];
+            double otherPart = total - sum[i];
+            double error = (sum[i] - (total - otherPart))
+                + (otherSum[i] - otherPart);
+            sum[i] = total;
+            compensation[i] += otherCompensation[i] + error;
+        }
         return *this;
     }
 
+    /**
+     * @brief Add a vector to the compensated sum
+     */
+    template <class Derived>
+    void add(const Eigen::MatrixBase<Derived> &inX) {
+        double *sum = sumOfVectors.data();
+        double *compensation = compensationOfSum.data();
+        for (Index i = 0; i < sumOfVectors.size(); ++i) {
+            double x = inX(i);
+            double total = sum[i] + x;
+            compensation[i] += std::fabs(sum[i]) >= std::fabs(x)
+                ? (sum[i] - total) + x
+                : (x - total) + sum[i];
+            sum[i] = total;
+        }
+    }
+
+    /**
+     * @brief The sum of all vectors, including the compensation
+     */
+    ColumnVector sum() const {
+        return sumOfVectors + compensationOfSum;
+    }
+
 private:
     static inline size_t arraySize(uint32_t inNumDimensions) {
-        return static_cast<size_t>(2 + inNumDimensions);
+        return static_cast<size_t>(2 + 2 * inNumDimensions);
     }
 
     /**
@@ -81,11 +126,15 @@ private:
      * - 0: numRows (number of rows already processed in this iteration)
      * - 1: numDimensions (dimension of space that points are from)
      * - 2: sumOfPoints (vector with \c numDimensions rows)
+     * - 2 + numDimensions: compensationOfSum (rounding errors of
+     *   \c sumOfPoints, vector with \c numDimensions rows)
      */
     void rebind(uint32_t inNumDimensions) {
         numRows.rebind(&mStorage[0]);
         numDimensions.rebind(&mStorage[1]);
         sumOfVectors.rebind(&mStorage[2], inNumDimensions);
+        compensationOfSum.rebind(&mStorage[2 + inNumDimensions],
+            inNumDimensions);
         madlib_assert(mStorage.size() >= arraySize(inNumDimensions),
             std::runtime_error("Out-of-bounds array access detected."));
     }
@@ -97,6 +146,8 @@ public:
     typename HandleTraits<Handle>::ReferenceToUInt32 numDimensions;
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap
         sumOfVectors;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap
+        compensationOfSum;
 };
 
 
@@ -114,7 +165,7 @@ avg_vector_transition::run(AnyType& args) {
             "not consistent.");
 
     ++state.numRows;
-    state.sumOfVectors += x;
+    state.add(x);
     return state;
 }
 
@@ -140,7 +191,7 @@ avg_vector_final::run(AnyType& args) {
 
     MutableNativeColumnVector avgVector(allocateArray<double>(
         state.sumOfVectors.size()));
-    avgVector = state.sumOfVectors / static_cast<double>(state.numRows);
+    avgVector = state.sum() / static_cast<double>(state.numRows);
     return avgVector;
 }
 
@@ -159,7 +210,7 @@ normalized_avg_vector_transition::run(AnyType& args) {
             "not consistent.");
 
     ++state.numRows;
-    state.sumOfVectors += x.normalized();
+    state.add(x.normalized());
     return state;
 }
 
@@ -169,7 +220,7 @@ normalized_avg_vector_final::run(AnyType& args) {
 
     MutableNativeColumnVector avgVector(allocateArray<double>(
         state.sumOfVectors.size()));
-    avgVector = (state.sumOfVectors /
+    avgVector = (state.sum() /
         static_cast<double>(state.numRows)).normalized();
     return avgVector;
 }
@@ -8,4 +8,5 @@
 
 #include "average.hpp"
 #include "matrix_agg.hpp"
+#include "matrix_vector.hpp"
 #include "metric.hpp"
@@ -8,7 +8,6 @@
 
 #include <dbconnector/dbconnector.hpp>
 #include <modules/shared/HandleTraits.hpp>
-#include <utils/Math.hpp>
 
 #include "matrix_agg.hpp"
 
@@ -50,34 +49,59 @@ public:
         numRows = inNumRows;
     }
 
+    /**
+     * @brief Append a new (zero) column and return it
+     */
     typename HandleTraits<Handle>::MatrixTransparentHandleMap::ColXpr
     newColumn(const Allocator& inAllocator) {
-        uint64_t numColsReserved = utils::nextPowerOfTwo(
-            static_cast<uint16_t>(numCols));
-
-        if (numColsReserved <= numCols) {
-            if (numColsReserved == 0)
-                numColsReserved = 1;
-            else
-                numColsReserved *= 2;
-
-            MatrixAggState oldSelf = *this;
-            mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
-                dbal::DoZero, dbal::ThrowBadAlloc>(
-                    arraySize(numRows, numColsReserved));
-            rebind(numRows, numColsReserved);
-            numRows = oldSelf.numRows;
-            numCols = oldSelf.numCols;
-            matrix.leftCols(static_cast<Index>(numCols)) =
-                oldSelf.matrix.leftCols(static_cast<Index>(numCols));
+        return column(inAllocator, numCols);
+    }
+
+    /**
+     * @brief Return the column with the given (0-based) index
+     *
+     * If the matrix has fewer columns, it is extended by zero columns.
+     */
+    typename HandleTraits<Handle>::MatrixTransparentHandleMap::ColXpr
+    column(const Allocator& inAllocator, uint64_t inIndex) {
+        if (inIndex >= numCols) {
+            reserve(inAllocator, inIndex + 1);
+            numCols = inIndex + 1;
         }
+        rebind(numRows, numCols);
+        return matrix.col(static_cast<Index>(inIndex));
+    }
 
-        rebind(numRows, numCols + 1);
-        return matrix.col(static_cast<Index>(numCols++));
+    /**
+     * @brief Make room for at least the given number of columns
+     *
+     * The capacity is implied by the size of the storage array. It grows
+     * geometrically, so that appending n columns copies O(n) columns in total.
+     */
+    void reserve(const Allocator& inAllocator, uint64_t inNumCols) {
+        uint64_t numColsReserved = numRows == 0
+            ? inNumCols
+            : (mStorage.size() - 2) / numRows;
+        if (numColsReserved >= inNumCols)
+            return;
+
+        numColsReserved = std::max(inNumCols, 2 * numColsReserved);
+        MatrixAggState oldSelf = *this;
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+            dbal::DoZero, dbal::ThrowBadAlloc>(
+                arraySize(numRows, numColsReserved));
+        rebind(oldSelf.numRows, numColsReserved);
+        numRows = oldSelf.numRows;
+        numCols = oldSelf.numCols;
+        matrix.leftCols(static_cast<Index>(numCols)) =
+            oldSelf.matrix.leftCols(static_cast<Index>(numCols));
     }
 
 private:
     static inline size_t arraySize(uint64_t inNumRows, uint64_t inNumCols) {
+        if (inNumRows != 0 && inNumCols
+            > (std::numeric_limits<size_t>::max() - 2) / inNumRows)
+            throw std::bad_alloc();
         return static_cast<size_t>(2 + inNumRows * inNumCols);
     }
 
@@ -91,7 +115,8 @@ private:
      * Inter-iteration components (updated in final function):
      * - 0: numRows (number of rows)
      * - 1: numCols (number of columns)
-     * - 2: sumOfPoints (matrix with \c numRows rows and \c numCols columns)
+     * - 2: matrix (\c numRows rows and at least \c numCols columns, stored
+     *   column by column; only the first \c numCols columns are used)
      */
     void rebind(uint64_t inNumRows, uint64_t inNumCols) {
         numRows.rebind(&mStorage[0]);
@@ -130,6 +155,54 @@ matrix_agg_transition::run(AnyType& args) {
     return state;
 }
 
+/**
+ * @brief Add a vector to the column with the given index
+ *
+ * Unlike matrix_agg_transition, the result does not depend on the order of
+ * the input, so partial matrices can be merged.
+ */
+AnyType
+matrix_agg_column_transition::run(AnyType& args) {
+    MatrixAggState<MutableArrayHandle<double> > state = args[0];
+    MappedColumnVector x = args[1].getAs<MappedColumnVector>();
+    int64_t column = args[2].getAs<int64_t>();
+
+    if (column < 0)
+        throw std::invalid_argument("Invalid arguments: Column indices must "
+            "not be negative.");
+
+    if (state.numCols == 0)
+        state.initialize(x.size());
+    else if (x.size() != state.matrix.rows())
+        throw std::invalid_argument("Invalid arguments: Dimensions of vectors "
+            "not consistent.");
+
+    state.column(*this, static_cast<uint64_t>(column)) += x;
+    return state;
+}
+
+/**
+ * @brief Add two partial matrices, padding the narrower one with zero columns
+ */
+AnyType
+matrix_agg_column_merge::run(AnyType& args) {
+    MatrixAggState<MutableArrayHandle<double> > stateLeft = args[0];
+    MatrixAggState<ArrayHandle<double> > stateRight = args[1];
+
+    if (stateRight.numCols == 0)
+        return stateLeft;
+    else if (stateLeft.numCols == 0)
+        return stateRight;
+    else if (stateLeft.numRows != stateRight.numRows)
+        throw std::invalid_argument("Invalid arguments: Dimensions of vectors "
+            "not consistent.");
+
+    stateLeft.column(*this, stateRight.numCols - 1);
+    stateLeft.matrix.leftCols(static_cast<Index>(stateRight.numCols))
+        += stateRight.matrix.leftCols(static_cast<Index>(stateRight.numCols));
+    return stateLeft;
+}
+
 AnyType
 matrix_agg_final::run(AnyType& args) {
     MatrixAggState<ArrayHandle<double> > state = args[0];
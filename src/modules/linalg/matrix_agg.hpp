@@ -9,6 +9,16 @@
  */
 DECLARE_UDF(linalg, matrix_agg_transition)
 
+/**
+ * @brief Aggregate matrix from indexed columns: Transition function
+ */
+DECLARE_UDF(linalg, matrix_agg_column_transition)
+
+/**
+ * @brief Aggregate matrix from indexed columns: Merge function
+ */
+DECLARE_UDF(linalg, matrix_agg_column_merge)
+
 /**
  * @brief Aggregate matrix from columns: Final function
  */
@@ -0,0 +1,220 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file matrix_vector.cpp
+ *
+ * @brief Multiply a matrix stored as a table with a vector
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#include <dbconnector/dbconnector.hpp>
+#include <modules/shared/HandleTraits.hpp>
+#include <utils/Math.hpp>
+
+#include "matrix_vector.hpp"
+
+namespace madlib {
+
+// Use Eigen
+using namespace dbal::eigen_integration;
+
+namespace modules {
+
+namespace linalg {
+
+/**
+ * @brief Transition state for multiplying a matrix with a vector
+ *
+ * The vector is the same for all rows of the matrix. It is copied into the
+ * state on the first row, so that the vector argument is not touched (and,
+ * in particular, not detoasted) for any subsequent row. The product grows
+ * with the largest row id seen, in powers of two.
+ *
+ * Note: We assume that the DOUBLE PRECISION array is initialized by the
+ * database with length 3, and all elemenets are 0. Handle::operator[] will
+ * perform bounds checking.
+ */
+template <class Handle>
+class MatrixVectorProductState {
+    template <class OtherHandle>
+    friend class MatrixVectorProductState;
+
+public:
+    MatrixVectorProductState(const AnyType &inArray)
+        : mStorage(inArray.getAs<Handle>()) {
+
+        uint64_t cols = static_cast<uint64_t>(mStorage[0]);
+        rebind(cols, mStorage.size() - 2 - cols);
+    }
+
+    operator AnyType() const {
+        return mStorage;
+    }
+
+    void initialize(const Allocator &inAllocator,
+        const MappedColumnVector &inX) {
+
+        uint64_t cols = static_cast<uint64_t>(inX.size());
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+            dbal::DoZero, dbal::ThrowBadAlloc>(arraySize(cols, 1));
+        rebind(cols, 1);
+        numCols = cols;
+        x = inX;
+    }
+
+    /**
+     * @brief Make sure the product has room for the given number of rows
+     */
+    void reserveRows(const Allocator &inAllocator, uint64_t inNumRows) {
+        uint64_t numRowsReserved = static_cast<uint64_t>(product.size());
+
+        if (inNumRows > numRowsReserved) {
+            numRowsReserved = utils::nextPowerOfTwo(inNumRows);
+
+            MatrixVectorProductState oldSelf = *this;
+            mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+                dbal::DoZero, dbal::ThrowBadAlloc>(
+                    arraySize(oldSelf.numCols, numRowsReserved));
+            rebind(oldSelf.numCols, numRowsReserved);
+            numCols = oldSelf.numCols;
+            numRows = oldSelf.numRows;
+            x = oldSelf.x;
+            product.head(static_cast<Index>(numRows))
+                = oldSelf.product.head(static_cast<Index>(numRows));
+        }
+        if (inNumRows > numRows)
+            numRows = inNumRows;
+    }
+
+    template <class OtherHandle>
+    MatrixVectorProductState &add(const Allocator &inAllocator,
+        const MatrixVectorProductState<OtherHandle> &inOtherState) {
+
+        if (numCols != inOtherState.numCols)
+            throw std::logic_error("Internal error: Incompatible transition "
+                "states");
+
+        reserveRows(inAllocator, inOtherState.numRows);
+        product.head(static_cast<Index>(inOtherState.numRows))
+            += inOtherState.product.head(
+                static_cast<Index>(inOtherState.numRows));
+        return *this;
+    }
+
+private:
+    static inline size_t arraySize(uint64_t inNumCols,
+        uint64_t inNumRowsReserved) {
+
+        return static_cast<size_t>(2 + inNumCols + inNumRowsReserved);
+    }
+
+    /**
+     * @brief Rebind to a new storage array
+     *
+     * @param inNumCols The number of columns of the matrix
+     * @param inNumRowsReserved The number of rows the product has room for
+     *
+     * Array layout:
+     * - 0: numCols (number of columns of the matrix, i.e., size of the vector)
+     * - 1: numRows (largest row id seen so far)
+     * - 2: x (vector with \c numCols elements)
+     * - 2 + numCols: product (vector with \c inNumRowsReserved elements)
+     */
+    void rebind(uint64_t inNumCols, uint64_t inNumRowsReserved) {
+        madlib_assert(mStorage.size()
+            >= arraySize(inNumCols, inNumRowsReserved),
+            std::runtime_error("Out-of-bounds array access detected."));
+
+        numCols.rebind(&mStorage[0]);
+        numRows.rebind(&mStorage[1]);
+        x.rebind(mStorage.ptr() + 2, static_cast<Index>(inNumCols));
+        product.rebind(mStorage.ptr() + 2 + inNumCols,
+            static_cast<Index>(inNumRowsReserved));
+    }
+
+    Handle mStorage;
+
+public:
+    typename HandleTraits<Handle>::ReferenceToUInt64 numCols;
+    typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap x;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap product;
+};
+
+
+AnyType
+matrix_vector_product_transition::run(AnyType& args) {
+    MatrixVectorProductState<MutableArrayHandle<double> > state = args[0];
+    int32_t rowId = args[1].getAs<int32_t>();
+    MappedColumnVector row = args[2].getAs<MappedColumnVector>();
+
+    if (state.numCols == 0)
+        state.initialize(*this, args[3].getAs<MappedColumnVector>());
+
+    if (rowId < 1)
+        throw std::invalid_argument("Invalid arguments: Row ids must be "
+            "positive.");
+    if (static_cast<uint64_t>(row.size()) != state.numCols)
+        throw std::invalid_argument("Invalid arguments: Dimensions of rows "
+            "and vector not consistent.");
+
+    state.reserveRows(*this, static_cast<uint64_t>(rowId));
+    state.product(rowId - 1) += row.dot(state.x);
+    return state;
+}
+
+AnyType
+sparse_matrix_vector_product_transition::run(AnyType& args) {
+    MatrixVectorProductState<MutableArrayHandle<double> > state = args[0];
+    int32_t rowId = args[1].getAs<int32_t>();
+    int32_t colId = args[2].getAs<int32_t>();
+    double value = args[3].getAs<double>();
+
+    if (state.numCols == 0)
+        state.initialize(*this, args[4].getAs<MappedColumnVector>());
+
+    if (rowId < 1)
+        throw std::invalid_argument("Invalid arguments: Row ids must be "
+            "positive.");
+    if (colId < 1 || static_cast<uint64_t>(colId) > state.numCols)
+        throw std::invalid_argument("Invalid arguments: Column ids must be "
+            "between 1 and the dimension of the vector.");
+
+    state.reserveRows(*this, static_cast<uint64_t>(rowId));
+    state.product(rowId - 1) += value * state.x(colId - 1);
+    return state;
+}
+
+AnyType
+matrix_vector_product_merge::run(AnyType& args) {
+    MatrixVectorProductState<MutableArrayHandle<double> > stateLeft = args[0];
+    MatrixVectorProductState<ArrayHandle<double> > stateRight = args[1];
+
+    // We first handle the trivial case where this function is called with one
+    // of the states being the initial state
+    if (stateLeft.numCols == 0)
+        return stateRight;
+    else if (stateRight.numCols == 0)
+        return stateLeft;
+
+    return stateLeft.add(*this, stateRight);
+}
+
+AnyType
+matrix_vector_product_final::run(AnyType& args) {
+    MatrixVectorProductState<ArrayHandle<double> > state = args[0];
+
+    // Aggregates that haven't seen any data just return Null.
+    if (state.numRows == 0)
+        return Null();
+
+    MutableNativeColumnVector product(allocateArray<double>(
+        static_cast<Index>(state.numRows)));
+    product = state.product.head(static_cast<Index>(state.numRows));
+    return product;
+}
+
+} // namespace linalg
+
+} // namespace modules
+
+} // namespace madlib
@@ -0,0 +1,26 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file matrix_vector.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+/**
+ * @brief Matrix-vector product from dense rows: Transition function
+ */
+DECLARE_UDF(linalg, matrix_vector_product_transition)
+
+/**
+ * @brief Matrix-vector product from (row, column, value) triples: Transition
+ *     function
+ */
+DECLARE_UDF(linalg, sparse_matrix_vector_product_transition)
+
+/**
+ * @brief Matrix-vector product: State merge function
+ */
+DECLARE_UDF(linalg, matrix_vector_product_merge)
+
+/**
+ * @brief Matrix-vector product: Final function
+ */
+DECLARE_UDF(linalg, matrix_vector_product_final)
@@ -122,6 +122,86 @@ LinearRegressionAccumulator<Container>::operator<<(
     return *this;
 }
 
+/**
+ * @brief Remove a row from the accumulation state
+ *
+ * This is the inverse of operator<<(const tuple_type&). All sums are linear in
+ * the rows, so removing a row costs as much as adding it. This makes moving
+ * windows (and rollups that drop old data) independent of the window size.
+ */
+template <class Container>
+inline
+LinearRegressionAccumulator<Container>&
+LinearRegressionAccumulator<Container>::retract(const tuple_type& inTuple) {
+    const MappedColumnVector& x = std::get<0>(inTuple);
+    const double& y = std::get<1>(inTuple);
+
+    if (!std::isfinite(y))
+        throw std::domain_error("Dependent variables are not finite.");
+    else if (!isfinite(x))
+        throw std::domain_error("Design matrix is not finite.");
+    else if (numRows == 0)
+        throw std::runtime_error("Cannot remove a row from an empty "
+            "linear-regression state.");
+    else if (widthOfX != static_cast<uint16_t>(x.size()))
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+
+    numRows--;
+    if (numRows == 0) {
+        // Do not keep rounding errors around once all rows are gone
+        y_sum = 0;
+        y_square_sum = 0;
+        X_transp_Y.setZero();
+        X_transp_X.setZero();
+        return *this;
+    }
+
+    y_sum -= y;
+    y_square_sum -= y * y;
+    X_transp_Y.noalias() -= x * y;
+    triangularView<Lower>(X_transp_X) -= x * trans(x);
+    return *this;
+}
+
+/**
+ * @brief Remove the rows of another accumulation state
+ *
+ * The rows accumulated in \c inOther must have been accumulated in this state
+ * before, e.g., when computing a rolling model from per-day states.
+ */
+template <class Container>
+template <class OtherContainer>
+inline
+LinearRegressionAccumulator<Container>&
+LinearRegressionAccumulator<Container>::retract(
+    const LinearRegressionAccumulator<OtherContainer>& inOther) {
+
+    if (inOther.numRows == 0)
+        return *this;
+    else if (numRows < inOther.numRows)
+        throw std::runtime_error("Cannot remove more rows than a "
+            "linear-regression state contains.");
+    else if (widthOfX != inOther.widthOfX)
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+
+    numRows -= inOther.numRows;
+    if (numRows == 0) {
+        y_sum = 0;
+        y_square_sum = 0;
+        X_transp_Y.setZero();
+        X_transp_X.setZero();
+        return *this;
+    }
+
+    y_sum -= inOther.y_sum;
+    y_square_sum -= inOther.y_square_sum;
+    X_transp_Y.noalias() -= inOther.X_transp_Y;
+    triangularView<Lower>(X_transp_X) -= inOther.X_transp_X;
+    return *this;
+}
+
 template <class Container>
 template <class OtherContainer>
 inline
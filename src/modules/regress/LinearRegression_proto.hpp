@@ -30,6 +30,9 @@ public:
     LinearRegressionAccumulator& operator<<(const tuple_type& inTuple);
     template <class OtherContainer> LinearRegressionAccumulator& operator<<(
         const LinearRegressionAccumulator<OtherContainer>& inOther);
+    LinearRegressionAccumulator& retract(const tuple_type& inTuple);
+    template <class OtherContainer> LinearRegressionAccumulator& retract(
+        const LinearRegressionAccumulator<OtherContainer>& inOther);
     template <class OtherContainer> LinearRegressionAccumulator& operator=(
         const LinearRegressionAccumulator<OtherContainer>& inOther);
 
@@ -0,0 +1,101 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file cross_validation.cpp
+ *
+ * @brief Cross validation of regression models
+ *
+ * The states of the regression aggregates are sums over rows. Hence, the
+ * states of all folds can be accumulated in a single pass, and the state of
+ * the training set of a fold is the total state minus the fold's state.
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#include <dbconnector/dbconnector.hpp>
+
+#include "LinearRegression_proto.hpp"
+#include "LinearRegression_impl.hpp"
+#include "cross_validation.hpp"
+
+namespace madlib {
+
+namespace modules {
+
+namespace regress {
+
+typedef LinearRegressionAccumulator<RootContainer> LinRegrState;
+typedef LinearRegressionAccumulator<MutableRootContainer> MutableLinRegrState;
+
+/**
+ * @brief Return the 1-based fold of a row
+ *
+ * The fold is derived from a 64-bit mix (the SplitMix64 finalizer) of the
+ * row id, so consecutive ids are spread evenly over all folds, and the
+ * assignment does not depend on the platform or on the order of rows.
+ */
+AnyType
+cv_fold::run(AnyType& args) {
+    uint64_t id = static_cast<uint64_t>(args[0].getAs<int64_t>());
+    int32_t numFolds = args[1].getAs<int32_t>();
+
+    if (numFolds < 1)
+        throw std::invalid_argument("Number of folds must be positive.");
+
+    id += 0x9E3779B97F4A7C15ULL;
+    id = (id ^ (id >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    id = (id ^ (id >> 27)) * 0x94D049BB133111EBULL;
+    id ^= id >> 31;
+    return static_cast<int32_t>(id % static_cast<uint64_t>(numFolds)) + 1;
+}
+
+/**
+ * @brief Train on all rows but one fold, and test on that fold
+ *
+ * The training state is the total state minus the state of the fold. The
+ * sum of squared prediction errors on the fold follows from its state, too:
+ * \f$ \sum_i (y_i - \boldsymbol c^T \boldsymbol x_i)^2
+ *     = \boldsymbol y^T \boldsymbol y - 2 \boldsymbol c^T X^T \boldsymbol y
+ *     + \boldsymbol c^T X^T X \boldsymbol c \f$.
+ * No further pass over the data is therefore needed.
+ */
+AnyType
+internal_linregr_cv_result::run(AnyType& args) {
+    MutableLinRegrState trainState = args[0].getAs<MutableByteString>();
+    LinRegrState testState = args[1].getAs<ByteString>();
+
+    trainState.retract(testState);
+    if (trainState.numRows == 0 || testState.numRows == 0)
+        return Null();
+
+    LinearRegression result(trainState);
+
+    // Only the lower triangle of X^T X is stored
+    ColumnVector X_transp_X_coef
+        = testState.X_transp_X.selfadjointView<Eigen::Lower>() * result.coef;
+    double testSSE = testState.y_square_sum
+        - 2 * dot(result.coef, testState.X_transp_Y)
+        + dot(result.coef, X_transp_X_coef);
+    // Like the other sums of squares, this cannot be negative
+    if (testSSE < 0)
+        testSSE = 0;
+
+    double testTSS = testState.y_square_sum
+        - testState.y_sum * testState.y_sum
+            / static_cast<double>(testState.numRows);
+
+    AnyType tuple;
+    tuple << static_cast<int64_t>(trainState.numRows)
+        << static_cast<int64_t>(testState.numRows)
+        << result.coef << result.r2 << result.conditionNo
+        << testSSE / static_cast<double>(testState.numRows);
+    if (testTSS > 0)
+        tuple << 1. - testSSE / testTSS;
+    else
+        tuple << Null();
+    return tuple;
+}
+
+} // namespace regress
+
+} // namespace modules
+
+} // namespace madlib
@@ -0,0 +1,16 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file cross_validation.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+/**
+ * @brief Cross validation: Fold of a row, derived from a hash of its id
+ */
+DECLARE_UDF(regress, cv_fold)
+
+/**
+ * @brief Cross validation: Linear-regression model trained without one fold
+ *     and its prediction error on that fold
+ */
+DECLARE_UDF(regress, internal_linregr_cv_result)
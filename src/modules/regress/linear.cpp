@@ -40,6 +40,34 @@ linregr_merge_states::run(AnyType& args) {
     return stateLeft.storage();
 }
 
+/**
+ * @brief Remove a row that was previously added by linregr_transition
+ *
+ * Used as inverse transition function of moving aggregates, so that sliding
+ * windows do not re-aggregate all rows of the frame.
+ */
+AnyType
+linregr_inverse_transition::run(AnyType& args) {
+    MutableLinRegrState state = args[0].getAs<MutableByteString>();
+    double y = args[1].getAs<double>();
+    MappedColumnVector x = args[2].getAs<MappedColumnVector>();
+
+    state.retract(MutableLinRegrState::tuple_type(x, y));
+    return state.storage();
+}
+
+/**
+ * @brief Remove the rows of the second state from the first state
+ */
+AnyType
+linregr_subtract_states::run(AnyType& args) {
+    MutableLinRegrState stateLeft = args[0].getAs<MutableByteString>();
+    LinRegrState stateRight = args[1].getAs<ByteString>();
+
+    stateLeft.retract(stateRight);
+    return stateLeft.storage();
+}
+
 AnyType
 linregr_final::run(AnyType& args) {
     LinRegrState state = args[0].getAs<ByteString>();
@@ -60,6 +88,42 @@ linregr_final::run(AnyType& args) {
     return tuple;
 }
 
+/**
+ * @brief Return the predicted value \f$ \boldsymbol c^T \boldsymbol x \f$
+ */
+AnyType
+linregr_predict::run(AnyType& args) {
+    MappedColumnVector coef = args[0].getAs<MappedColumnVector>();
+    MappedColumnVector x = args[1].getAs<MappedColumnVector>();
+
+    if (x.size() != coef.size())
+        throw std::invalid_argument("Invalid arguments: Coefficients and "
+            "independent variables must have the same number of elements.");
+
+    return static_cast<double>(coef.dot(x));
+}
+
+/**
+ * @brief Return the predicted values of all rows of a two-dimensional array
+ *
+ * Each element of the outer dimension is one vector of independent variables.
+ * The coefficients are read only once for the whole block, and the products
+ * are computed as one matrix-vector product.
+ */
+AnyType
+linregr_predict_rows::run(AnyType& args) {
+    MappedColumnVector coef = args[0].getAs<MappedColumnVector>();
+    MappedMatrix X = args[1].getAs<MappedMatrix>();
+
+    if (X.rows() != coef.size())
+        throw std::invalid_argument("Invalid arguments: Coefficients and "
+            "independent variables must have the same number of elements.");
+
+    MutableNativeColumnVector prediction(allocateArray<double>(X.cols()));
+    prediction.noalias() = trans(X) * coef;
+    return prediction;
+}
+
 } // namespace regress
 
 } // namespace modules
@@ -14,8 +14,28 @@ DECLARE_UDF(regress, linregr_transition)
  */
 DECLARE_UDF(regress, linregr_merge_states)
 
+/**
+ * @brief Linear regression: Inverse transition function
+ */
+DECLARE_UDF(regress, linregr_inverse_transition)
+
+/**
+ * @brief Linear regression: State subtraction function
+ */
+DECLARE_UDF(regress, linregr_subtract_states)
+
 /**
  * @brief Linear regression: Final function
  */
 DECLARE_UDF(regress, linregr_final)
 
+
+/**
+ * @brief Linear regression: Predicted value of a single row
+ */
+DECLARE_UDF(regress, linregr_predict)
+
+/**
+ * @brief Linear regression: Predicted values of a block of rows
+ */
+DECLARE_UDF(regress, linregr_predict_rows)
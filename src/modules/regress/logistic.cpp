@@ -4,13 +4,15 @@
  *
  * @brief Logistic-Regression functions
  *
- * We implement the conjugate-gradient method and the iteratively-reweighted-
- * least-squares method.
+ * We implement the conjugate-gradient method, the iteratively-reweighted-
+ * least-squares method, the incremental-gradient method, and the
+ * limited-memory BFGS method.
  *
  *//* ----------------------------------------------------------------------- */
 #include <limits>
 #include <dbconnector/dbconnector.hpp>
 #include <modules/shared/HandleTraits.hpp>
+#include <modules/shared/LBFGS.hpp>
 #include <modules/prob/boost.hpp>
 
 #include "logistic.hpp"
@@ -125,7 +127,7 @@ public:
 
 private:
     static inline size_t arraySize(const uint16_t inWidthOfX) {
-        return 5 + inWidthOfX * inWidthOfX + 4 * inWidthOfX;
+        return 5 + inWidthOfX * (inWidthOfX + 1) / 2 + 4 * inWidthOfX;
     }
 
     /**
@@ -145,8 +147,8 @@ private:
      * Intra-iteration components (updated in transition step):
      * - 3 + 3 * widthOfX: numRows (number of rows already processed in this iteration)
      * - 4 + 3 * widthOfX: gradNew (intermediate value for gradient)
-     * - 4 + 4 * widthOfX: X_transp_AX (X^T A X)
-     * - 4 + widthOfX * widthOfX + 4 * widthOfX: logLikelihood ( ln(l(c)) )
+     * - 4 + 4 * widthOfX: X_transp_AX (X^T A X, lower triangle packed)
+     * - 4 + widthOfX * (widthOfX + 1) / 2 + 4 * widthOfX: logLikelihood ( ln(l(c)) )
      */
     void rebind(uint16_t inWidthOfX) {
         iteration.rebind(&mStorage[0]);
@@ -157,8 +159,8 @@ private:
         beta.rebind(&mStorage[2 + 3 * inWidthOfX]);
         numRows.rebind(&mStorage[3 + 3 * inWidthOfX]);
         gradNew.rebind(&mStorage[4 + 3 * inWidthOfX], inWidthOfX);
-        X_transp_AX.rebind(&mStorage[4 + 4 * inWidthOfX], inWidthOfX, inWidthOfX);
-        logLikelihood.rebind(&mStorage[4 + inWidthOfX * inWidthOfX + 4 * inWidthOfX]);
+        X_transp_AX.rebind(&mStorage[4 + 4 * inWidthOfX], inWidthOfX);
+        logLikelihood.rebind(&mStorage[4 + inWidthOfX * (inWidthOfX + 1) / 2 + 4 * inWidthOfX]);
     }
 
     Handle mStorage;
@@ -173,7 +175,7 @@ public:
 
     typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap gradNew;
-    typename HandleTraits<Handle>::MatrixTransparentHandleMap X_transp_AX;
+    typename HandleTraits<Handle>::SymmetricMatrixTransparentHandleMap X_transp_AX;
     typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
 };
 
@@ -219,7 +221,7 @@ logregr_cg_step_transition::run(AnyType &args) {
     // Note: sigma(-x) = 1 - sigma(x).
     // a_i = sigma(x_i c) sigma(-x_i c)
     double a = sigma(xc) * sigma(-xc);
-    triangularView<Lower>(state.X_transp_AX) += x * trans(x) * a;
+    state.X_transp_AX.rankUpdate(x, a);
 
     //          n
     //         --
@@ -311,7 +313,7 @@ logregr_cg_step_final::run(AnyType &args) {
     //
     // c_k = c_{k-1} - alpha_k * d_k
     state.coef += dot(state.grad, state.dir) /
-        as_scalar(trans(state.dir) * state.X_transp_AX * state.dir)
+        as_scalar(trans(state.dir) * state.X_transp_AX.unpack() * state.dir)
         * state.dir;
 
     if(!state.coef.is_finite())
@@ -342,7 +344,7 @@ internal_logregr_cg_result::run(AnyType &args) {
     LogRegrCGTransitionState<ArrayHandle<double> > state = args[0];
 
     SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
-        state.X_transp_AX, EigenvaluesOnly, ComputePseudoInverse);
+        state.X_transp_AX.unpack(), EigenvaluesOnly, ComputePseudoInverse);
 
     return stateToResult(*this, state.coef,
         decomposition.pseudoInverse().diagonal(), state.logLikelihood,
@@ -358,8 +360,16 @@ internal_logregr_cg_result::run(AnyType &args) {
  * exposed as a single DOUBLE PRECISION array, to the C++ code it is a proper
  * object containing scalars, a vector, and a matrix.
  *
+ * Besides the model-based covariance matrix \f$ (X^T A X)^{-1} \f$, the state
+ * can optionally accumulate the "meat" of the sandwich estimator of the
+ * covariance matrix, so that robust (Huber-White) or cluster-robust standard
+ * errors are available after the last iteration without another pass over
+ * the data. For clustered standard errors, the sums of the score vectors of
+ * all clusters are kept in an open-addressing hash table whose capacity is
+ * fixed when the state is initialized.
+ *
  * Note: We assume that the DOUBLE PRECISION array is initialized by the
- * database with length at least 4, and all elemenets are 0.
+ * database with length at least 6, and all elemenets are 0.
  */
 template <class Handle>
 class LogRegrIRLSTransitionState {
@@ -367,10 +377,25 @@ class LogRegrIRLSTransitionState {
     friend class LogRegrIRLSTransitionState;
 
 public:
+    /**
+     * @brief Type of covariance matrix that is estimated
+     */
+    enum VarianceType {
+        ModelBased = 0,
+        Robust = 1,
+        Clustered = 2
+    };
+
     LogRegrIRLSTransitionState(const AnyType &inArray)
         : mStorage(inArray.getAs<Handle>()) {
 
-        rebind(static_cast<uint16_t>(mStorage[0]));
+        uint16_t inWidthOfX = static_cast<uint16_t>(mStorage[0]);
+        size_t varianceTypeIndex = baseSize(inWidthOfX);
+        madlib_assert(mStorage.size() >= varianceTypeIndex + 2,
+            std::runtime_error("Out-of-bounds array access detected."));
+        rebind(inWidthOfX,
+            static_cast<uint16_t>(mStorage[varianceTypeIndex]),
+            static_cast<uint32_t>(mStorage[varianceTypeIndex + 1]));
     }
 
     /**
@@ -388,11 +413,17 @@ public:
      *
      * This function is only called for the first iteration, for the first row.
      */
-    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX) {
+    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX,
+        uint16_t inVarianceType = ModelBased,
+        uint32_t inMaxNumClusters = 0) {
+
         mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
-            dbal::DoZero, dbal::ThrowBadAlloc>(arraySize(inWidthOfX));
-        rebind(inWidthOfX);
+            dbal::DoZero, dbal::ThrowBadAlloc>(
+                arraySize(inWidthOfX, inVarianceType, inMaxNumClusters));
+        rebind(inWidthOfX, inVarianceType, inMaxNumClusters);
         widthOfX = inWidthOfX;
+        varianceType = inVarianceType;
+        maxNumClusters = inMaxNumClusters;
     }
 
     /**
@@ -416,7 +447,8 @@ public:
         const LogRegrIRLSTransitionState<OtherHandle> &inOtherState) {
 
         if (mStorage.size() != inOtherState.mStorage.size() ||
-            widthOfX != inOtherState.widthOfX)
+            widthOfX != inOtherState.widthOfX ||
+            varianceType != inOtherState.varianceType)
             throw std::logic_error("Internal error: Incompatible transition "
                 "states");
 
@@ -424,6 +456,12 @@ public:
         X_transp_Az += inOtherState.X_transp_Az;
         X_transp_AX += inOtherState.X_transp_AX;
         logLikelihood += inOtherState.logLikelihood;
+        X_transp_BX += inOtherState.X_transp_BX;
+        for (Index i = 0; i < inOtherState.clusters.cols(); ++i)
+            if (inOtherState.clusters(0, i) > 0)
+                addToCluster(inOtherState.clusters(1, i),
+                    inOtherState.clusters(0, i),
+                    inOtherState.clusters.col(i).tail(widthOfX));
         return *this;
     }
 
@@ -435,17 +473,65 @@ public:
         X_transp_Az.fill(0);
         X_transp_AX.fill(0);
         logLikelihood = 0;
+        numClusters = 0;
+        X_transp_BX.fill(0);
+        clusters.fill(0);
+    }
+
+    /**
+     * @brief Add the score vector of a row (or the sum of score vectors of
+     *     several rows) to a cluster
+     *
+     * Cluster ids are hashed into a table with twice as many slots as
+     * clusters are allowed, using linear probing. Slot layout: number of
+     * rows (0 for unused slots), cluster id, sum of score vectors.
+     */
+    template <class Derived>
+    void addToCluster(double inClusterId, double inNumRows,
+        const Eigen::MatrixBase<Derived>& inScore) {
+
+        Index numSlots = clusters.cols();
+        Index slot = static_cast<Index>(
+            (static_cast<uint64_t>(static_cast<int64_t>(inClusterId))
+                * 0x9E3779B97F4A7C15ULL) % static_cast<uint64_t>(numSlots));
+        while (clusters(0, slot) > 0 && clusters(1, slot) != inClusterId)
+            slot = (slot + 1) % numSlots;
+
+        if (clusters(0, slot) == 0) {
+            if (numClusters >= maxNumClusters)
+                throw std::runtime_error("Number of clusters exceeds the "
+                    "maximum number of clusters.");
+            numClusters++;
+            clusters(1, slot) = inClusterId;
+        }
+        clusters(0, slot) += inNumRows;
+        clusters.col(slot).tail(widthOfX) += inScore;
     }
 
 private:
-    static inline uint32_t arraySize(const uint16_t inWidthOfX) {
-        return 3 + inWidthOfX * inWidthOfX + 2 * inWidthOfX;
+    static inline size_t baseSize(const uint16_t inWidthOfX) {
+        return 3 + inWidthOfX * (inWidthOfX + 1) / 2 + 2 * inWidthOfX;
+    }
+
+    static inline size_t arraySize(const uint16_t inWidthOfX,
+        const uint16_t inVarianceType, const uint32_t inMaxNumClusters) {
+
+        return baseSize(inWidthOfX) + 3
+            + (inVarianceType == ModelBased
+                ? 0 : inWidthOfX * (inWidthOfX + 1) / 2)
+            + (inVarianceType == Clustered
+                ? 2 * static_cast<size_t>(inMaxNumClusters)
+                    * (2 + inWidthOfX)
+                : 0);
     }
 
     /**
      * @brief Rebind to a new storage array
      *
      * @param inWidthOfX The number of independent variables.
+     * @param inVarianceType The type of covariance matrix estimated
+     * @param inMaxNumClusters The maximum number of clusters (only used for
+     *     cluster-robust standard errors)
      *
      * Array layout (iteration refers to one aggregate-function call):
      * Inter-iteration components (updated in final function):
@@ -455,16 +541,46 @@ private:
      * Intra-iteration components (updated in transition step):
      * - 1 + widthOfX: numRows (number of rows already processed in this iteration)
      * - 2 + widthOfX: X_transp_Az (X^T A z)
-     * - 2 + 2 * widthOfX: X_transp_AX (X^T A X)
-     * - 2 + widthOfX^2 + 2 * widthOfX: logLikelihood ( ln(l(c)) )
+     * - 2 + 2 * widthOfX: X_transp_AX (X^T A X, lower triangle packed)
+     * - 2 + widthOfX * (widthOfX + 1) / 2 + 2 * widthOfX: logLikelihood ( ln(l(c)) )
+     *
+     * Components for the sandwich estimator (with
+     * b = 3 + widthOfX * (widthOfX + 1) / 2 + 2 * widthOfX):
+     * - b: varianceType (inter-iteration, see VarianceType)
+     * - b + 1: maxNumClusters (inter-iteration)
+     * - b + 2: numClusters (number of distinct clusters seen so far)
+     * - b + 3: X_transp_BX (X^T B X with B = diag(b_1, ..., b_n) the squared
+     *   scores, lower triangle packed; empty if varianceType is ModelBased)
+     * - b + 3 + widthOfX * (widthOfX + 1) / 2: clusters (hash table of
+     *   2 * maxNumClusters slots with 2 + widthOfX elements each; empty unless
+     *   varianceType is Clustered)
      */
-    void rebind(uint16_t inWidthOfX = 0) {
+    void rebind(uint16_t inWidthOfX, uint16_t inVarianceType,
+        uint32_t inMaxNumClusters) {
+
+        madlib_assert(mStorage.size()
+            >= arraySize(inWidthOfX, inVarianceType, inMaxNumClusters),
+            std::runtime_error("Out-of-bounds array access detected."));
+
+        size_t b = baseSize(inWidthOfX);
+        uint16_t widthOfMeat = inVarianceType == ModelBased ? 0 : inWidthOfX;
+        Index numSlots = inVarianceType == Clustered
+            ? 2 * static_cast<Index>(inMaxNumClusters) : 0;
+
         widthOfX.rebind(&mStorage[0]);
         coef.rebind(&mStorage[1], inWidthOfX);
         numRows.rebind(&mStorage[1 + inWidthOfX]);
         X_transp_Az.rebind(&mStorage[2 + inWidthOfX], inWidthOfX);
-        X_transp_AX.rebind(&mStorage[2 + 2 * inWidthOfX], inWidthOfX, inWidthOfX);
-        logLikelihood.rebind(&mStorage[2 + inWidthOfX * inWidthOfX + 2 * inWidthOfX]);
+        X_transp_AX.rebind(&mStorage[2 + 2 * inWidthOfX], inWidthOfX);
+        logLikelihood.rebind(&mStorage[2 + inWidthOfX * (inWidthOfX + 1) / 2 + 2 * inWidthOfX]);
+        varianceType.rebind(&mStorage[b]);
+        maxNumClusters.rebind(&mStorage[b + 1]);
+        numClusters.rebind(&mStorage[b + 2]);
+        // The following two may be empty, so we cannot use operator[]
+        X_transp_BX.rebind(mStorage.ptr() + b + 3, widthOfMeat);
+        clusters.rebind(
+            mStorage.ptr() + b + 3 + widthOfMeat * (widthOfMeat + 1) / 2,
+            2 + inWidthOfX, numSlots);
     }
 
     Handle mStorage;
@@ -475,10 +591,26 @@ public:
 
     typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap X_transp_Az;
-    typename HandleTraits<Handle>::MatrixTransparentHandleMap X_transp_AX;
+    typename HandleTraits<Handle>::SymmetricMatrixTransparentHandleMap X_transp_AX;
     typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
+
+    typename HandleTraits<Handle>::ReferenceToUInt16 varianceType;
+    typename HandleTraits<Handle>::ReferenceToUInt32 maxNumClusters;
+    typename HandleTraits<Handle>::ReferenceToUInt32 numClusters;
+    typename HandleTraits<Handle>::SymmetricMatrixTransparentHandleMap X_transp_BX;
+    typename HandleTraits<Handle>::MatrixTransparentHandleMap clusters;
 };
 
+/**
+ * @brief Perform the logistic-regression transition step
+ *
+ * Besides the state, the dependent variable, the independent variables, and
+ * the previous state, the transition function optionally takes a cluster id
+ * and the maximum number of clusters. If these are given, the state also
+ * accumulates the meat of the sandwich estimator: If the maximum number of
+ * clusters is 0, robust (Huber-White) standard errors are computed, otherwise
+ * cluster-robust standard errors.
+ */
 AnyType
 logregr_irls_step_transition::run(AnyType &args) {
     LogRegrIRLSTransitionState<MutableArrayHandle<double> > state = args[0];
@@ -494,12 +626,26 @@ logregr_irls_step_transition::run(AnyType &args) {
             throw std::domain_error("Number of independent variables cannot be "
                 "larger than 65535.");
 
-        state.initialize(*this, static_cast<uint16_t>(x.size()));
         if (!args[3].isNull()) {
             LogRegrIRLSTransitionState<ArrayHandle<double> > previousState = args[3];
 
+            state.initialize(*this, static_cast<uint16_t>(x.size()),
+                previousState.varianceType, previousState.maxNumClusters);
             state = previousState;
             state.reset();
+        } else if (args.numFields() >= 6) {
+            int32_t maxNumClusters = args[5].getAs<int32_t>();
+            if (maxNumClusters < 0)
+                throw std::domain_error("Maximum number of clusters must not "
+                    "be negative.");
+
+            state.initialize(*this, static_cast<uint16_t>(x.size()),
+                maxNumClusters == 0
+                    ? state.Robust
+                    : state.Clustered,
+                static_cast<uint32_t>(maxNumClusters));
+        } else {
+            state.initialize(*this, static_cast<uint16_t>(x.size()));
         }
     }
 
@@ -523,7 +669,27 @@ logregr_irls_step_transition::run(AnyType &args) {
     double az = xc * a + sigma(-y * xc) * y;
 
     state.X_transp_Az.noalias() += x * az;
-    triangularView<Lower>(state.X_transp_AX) += x * trans(x) * a;
+    state.X_transp_AX.rankUpdate(x, a);
+
+    // The score (the gradient of the log-likelihood) of row i is
+    // sigma(-y_i x_i c) y_i x_i
+    if (state.varianceType == state.Robust) {
+        double score = sigma(-y * xc);
+        state.X_transp_BX.rankUpdate(x, score * score);
+    } else if (state.varianceType == state.Clustered) {
+        if (args[4].isNull())
+            throw std::domain_error("Cluster ids must not be NULL.");
+
+        int64_t clusterId = args[4].getAs<int64_t>();
+        // Cluster ids are stored as double, so they have to be exactly
+        // representable
+        const int64_t maxExactId = static_cast<int64_t>(1) << 53;
+        if (clusterId > maxExactId || clusterId < -maxExactId)
+            throw std::domain_error("Cluster ids must not exceed 2^53 in "
+                "absolute value.");
+        state.addToCluster(static_cast<double>(clusterId), 1,
+            (sigma(-y * xc) * y) * x);
+    }
 
     //          n
     //         --
@@ -575,7 +741,7 @@ logregr_irls_step_final::run(AnyType &args) {
             "calulation. Input data is likely of poor numerical condition.");
 
     SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
-        state.X_transp_AX, EigenvaluesOnly, ComputePseudoInverse);
+        state.X_transp_AX.unpack(), EigenvaluesOnly, ComputePseudoInverse);
 
     // Precompute (X^T * A * X)^+
     Matrix inverse_of_X_transp_AX = decomposition.pseudoInverse();
@@ -591,7 +757,34 @@ logregr_irls_step_final::run(AnyType &args) {
     // Likewise, we store the condition number.
     // FIXME: This feels a bit like a hack.
     state.X_transp_Az = inverse_of_X_transp_AX.diagonal();
-    state.X_transp_AX(0,0) = decomposition.conditionNo();
+    state.X_transp_AX.coeffRef(0,0) = decomposition.conditionNo();
+
+    // The sandwich estimator of the covariance matrix is
+    // (X^T A X)^+ M (X^T A X)^+, where the meat M is the sum of the outer
+    // products of the scores (of rows or of clusters). We use the same
+    // small-sample corrections as Stata: n / (n - 1) for robust and
+    // G / (G - 1) for cluster-robust standard errors. The diagonal is stored
+    // in X_transp_BX, similar to the model-based one.
+    if (state.varianceType != state.ModelBased) {
+        Matrix meat;
+        double correction;
+        if (state.varianceType == state.Robust) {
+            meat = state.X_transp_BX.unpack();
+            correction = static_cast<double>(state.numRows)
+                / (static_cast<double>(state.numRows) - 1.);
+        } else {
+            meat = Matrix::Zero(state.widthOfX, state.widthOfX);
+            for (Index i = 0; i < state.clusters.cols(); ++i)
+                if (state.clusters(0, i) > 0)
+                    meat.noalias() += state.clusters.col(i).tail(state.widthOfX)
+                        * trans(state.clusters.col(i).tail(state.widthOfX));
+            correction = static_cast<double>(state.numClusters)
+                / (static_cast<double>(state.numClusters) - 1.);
+        }
+        state.X_transp_BX.packed().head(state.widthOfX)
+            = correction * (inverse_of_X_transp_AX * meat
+                * inverse_of_X_transp_AX).diagonal();
+    }
 
     return state;
 }
@@ -615,7 +808,10 @@ internal_logregr_irls_result::run(AnyType &args) {
     LogRegrIRLSTransitionState<ArrayHandle<double> > state = args[0];
 
     return stateToResult(*this, state.coef,
-        state.X_transp_Az, state.logLikelihood, state.X_transp_AX(0,0));
+        state.varianceType == state.ModelBased
+            ? ColumnVector(state.X_transp_Az)
+            : ColumnVector(state.X_transp_BX.packed().head(state.widthOfX)),
+        state.logLikelihood, state.X_transp_AX(0,0));
 }
 
 /**
@@ -719,7 +915,7 @@ public:
 
 private:
     static inline uint32_t arraySize(const uint16_t inWidthOfX) {
-        return 4 + inWidthOfX * inWidthOfX + inWidthOfX;
+        return 4 + inWidthOfX * (inWidthOfX + 1) / 2 + inWidthOfX;
     }
     /**
      * @brief Rebind to a new storage array
@@ -734,16 +930,16 @@ private:
      *
      * Intra-iteration components (updated in transition step):
      * - 2 + widthOfX: numRows (number of rows already processed in this iteration)
-     * - 3 + widthOfX: X_transp_AX (X^T A X)
-     * - 3 + widthOfX * widthOfX + widthOfX: logLikelihood ( ln(l(c)) )
+     * - 3 + widthOfX: X_transp_AX (X^T A X, lower triangle packed)
+     * - 3 + widthOfX * (widthOfX + 1) / 2 + widthOfX: logLikelihood ( ln(l(c)) )
      */
     void rebind(uint16_t inWidthOfX) {
         widthOfX.rebind(&mStorage[0]);
         stepsize.rebind(&mStorage[1]);
         coef.rebind(&mStorage[2], inWidthOfX);
         numRows.rebind(&mStorage[2 + inWidthOfX]);
-        X_transp_AX.rebind(&mStorage[3 + inWidthOfX], inWidthOfX, inWidthOfX);
-        logLikelihood.rebind(&mStorage[3 + inWidthOfX * inWidthOfX + inWidthOfX]);
+        X_transp_AX.rebind(&mStorage[3 + inWidthOfX], inWidthOfX);
+        logLikelihood.rebind(&mStorage[3 + inWidthOfX * (inWidthOfX + 1) / 2 + inWidthOfX]);
     }
 
     Handle mStorage;
@@ -754,7 +950,7 @@ public:
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap coef;
 
     typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
-	typename HandleTraits<Handle>::MatrixTransparentHandleMap X_transp_AX;
+	typename HandleTraits<Handle>::SymmetricMatrixTransparentHandleMap X_transp_AX;
     typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
 };
 
@@ -802,7 +998,7 @@ logregr_igd_step_transition::run(AnyType &args) {
 
         // a_i = sigma(x_i c) sigma(-x_i c)
 		double a = sigma(previous_xc) * sigma(-previous_xc);
-		triangularView<Lower>(state.X_transp_AX) += x * trans(x) * a;
+		state.X_transp_AX.rankUpdate(x, a);
 
 		// l_i(c) = - ln(1 + exp(-y_i * c^T x_i))
 		state.logLikelihood -= std::log( 1. + std::exp(-y * previous_xc) );
@@ -872,13 +1068,494 @@ internal_logregr_igd_result::run(AnyType &args) {
     LogRegrIGDTransitionState<ArrayHandle<double> > state = args[0];
 
     SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
-        state.X_transp_AX, EigenvaluesOnly, ComputePseudoInverse);
+        state.X_transp_AX.unpack(), EigenvaluesOnly, ComputePseudoInverse);
 
     return stateToResult(*this, state.coef,
         decomposition.pseudoInverse().diagonal(), state.logLikelihood,
         decomposition.conditionNo());
 }
 
+/**
+ * @brief Inter- and intra-iteration state for the limited-memory BFGS method
+ *        for logistic regression
+ *
+ * Unlike the conjugate-gradient and IRLS states, this state only contains
+ * vectors: Each row costs \f$ O(p) \f$, which makes this method suitable for
+ * very wide models. \f$ X^T A X \f$ is only accumulated if \c withHessian is
+ * set, which is done in one additional scan once the coefficients have
+ * converged (for the standard errors).
+ *
+ * L-BFGS minimizes over the scaled coefficients \f$ z_j = s_j c_j \f$, where
+ * \f$ s_j \f$ is the root mean square of the j-th independent variable
+ * (computed in the first scan). Otherwise, independent variables of very
+ * different magnitude slow down convergence considerably.
+ *
+ * Note: We assume that the DOUBLE PRECISION array is initialized by the
+ * database with length at least 5, and all elemenets are 0.
+ */
+template <class Handle>
+class LogRegrLBFGSTransitionState {
+    template <class OtherHandle>
+    friend class LogRegrLBFGSTransitionState;
+
+public:
+    static const int m = 7; // The number of corrections used in the LBFGS update.
+
+    LogRegrLBFGSTransitionState(const AnyType &inArray)
+        : mStorage(inArray.getAs<Handle>()) {
+
+        rebind(static_cast<uint16_t>(mStorage[1]), mStorage[2] != 0);
+    }
+
+    /**
+     * @brief Convert to backend representation
+     *
+     * We define this function so that we can use State in the
+     * argument list and as a return type.
+     */
+    inline operator AnyType() const {
+        return mStorage;
+    }
+
+    /**
+     * @brief Initialize the L-BFGS state.
+     *
+     * This function is only called for the first row of an iteration.
+     */
+    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX,
+        bool inWithHessian = false) {
+
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+            dbal::DoZero, dbal::ThrowBadAlloc>(
+                arraySize(inWidthOfX, inWithHessian));
+        rebind(inWidthOfX, inWithHessian);
+        widthOfX = inWidthOfX;
+        withHessian = inWithHessian;
+        diag.fill(1);
+    }
+
+    /**
+     * @brief We need to support assigning the previous state
+     */
+    template <class OtherHandle>
+    LogRegrLBFGSTransitionState &operator=(
+        const LogRegrLBFGSTransitionState<OtherHandle> &inOtherState) {
+
+        for (size_t i = 0; i < mStorage.size(); i++)
+            mStorage[i] = inOtherState.mStorage[i];
+        return *this;
+    }
+
+    /**
+     * @brief Merge with another State object by copying the intra-iteration
+     *     fields
+     */
+    template <class OtherHandle>
+    LogRegrLBFGSTransitionState &operator+=(
+        const LogRegrLBFGSTransitionState<OtherHandle> &inOtherState) {
+
+        if (mStorage.size() != inOtherState.mStorage.size() ||
+            widthOfX != inOtherState.widthOfX)
+            throw std::logic_error("Internal error: Incompatible transition "
+                "states");
+
+        numRows += inOtherState.numRows;
+        logLikelihood += inOtherState.logLikelihood;
+        grad += inOtherState.grad;
+        if (iteration == 0)
+            scale += inOtherState.scale;
+        X_transp_AX += inOtherState.X_transp_AX;
+        return *this;
+    }
+
+    /**
+     * @brief Reset the inter-iteration fields.
+     */
+    inline void reset() {
+        numRows = 0;
+        logLikelihood = 0;
+        grad.fill(0);
+        X_transp_AX.fill(0);
+    }
+
+    /**
+     * @brief Return the number of completed L-BFGS iterations
+     *
+     * lbfgs_state(7) is the L-BFGS iteration in progress. It is only
+     * complete once L-BFGS has finished (iflag, i.e., lbfgs_state(6), is 0
+     * and mcsrch_state(24) is set).
+     */
+    inline uint32_t numLBFGSIterations() const {
+        if (widthOfX == 0)
+            return 0;
+
+        uint32_t iter = static_cast<uint32_t>(lbfgs_state(7));
+        return lbfgs_state(6) == 0 && mcsrch_state(24) == 1
+            ? iter : (iter > 0 ? iter - 1 : 0);
+    }
+
+private:
+    static inline size_t arraySize(const uint16_t inWidthOfX,
+        const bool inWithHessian) {
+
+        return 51 + 4 * inWidthOfX + inWidthOfX * (2 * m + 1) + 2 * m
+            + (inWithHessian ? inWidthOfX * (inWidthOfX + 1) / 2 : 0);
+    }
+
+    /**
+     * @brief Rebind to a new storage array
+     *
+     * @param inWidthOfX The number of independent variables.
+     * @param inWithHessian Whether the state contains X^T A X
+     *
+     * Array layout (iteration refers to one aggregate-function call):
+     * Inter-iteration components (updated in final function):
+     * - 0: iteration (number of function evaluations)
+     * - 1: widthOfX (number of coefficients)
+     * - 2: withHessian (whether X_transp_AX is accumulated)
+     *
+     * Intra-iteration components (updated in transition step):
+     * - 3: numRows (number of rows already processed in this iteration)
+     * - 4: logLikelihood ( ln(l(c)) )
+     *
+     * Inter-iteration components (updated in final function):
+     * - 5: coef (vector of coefficients, i.e., the next point to evaluate)
+     *
+     * Intra-iteration components (updated in transition step):
+     * - 5 + widthOfX: grad (gradient of the log-likelihood)
+     *
+     * Inter-iteration components (updated in final function):
+     * - 5 + 2 * widthOfX: diag (diagonal of the initial inverse Hessian; while
+     *   a line search is in progress, its starting point, i.e., the last
+     *   accepted iterate, in scaled coefficients)
+     * - 5 + 3 * widthOfX: scale (scale of the coefficients; in the first
+     *   scan, the sums of squares of the independent variables)
+     * - 5 + 4 * widthOfX: lbfgs_state (21 scalars of the L-BFGS driver)
+     * - 26 + 4 * widthOfX: mcsrch_state (25 scalars of the line search)
+     * - 51 + 4 * widthOfX: ws (workspace with the last m corrections)
+     *
+     * Intra-iteration components (updated in transition step):
+     * - 51 + 4 * widthOfX + widthOfX * (2 * m + 1) + 2 * m: X_transp_AX
+     *   (X^T A X, lower triangle packed; empty unless withHessian)
+     *
+     * The initial state only contains the scalars, so the vectors are only
+     * bound once the number of independent variables is known.
+     */
+    void rebind(uint16_t inWidthOfX, bool inWithHessian) {
+        iteration.rebind(&mStorage[0]);
+        widthOfX.rebind(&mStorage[1]);
+        withHessian.rebind(&mStorage[2]);
+        numRows.rebind(&mStorage[3]);
+        logLikelihood.rebind(&mStorage[4]);
+        if (inWidthOfX == 0)
+            return;
+
+        madlib_assert(mStorage.size() >= arraySize(inWidthOfX, inWithHessian),
+            std::runtime_error("Out-of-bounds array access detected."));
+
+        size_t w = 51 + 4 * inWidthOfX;
+        coef.rebind(&mStorage[5], inWidthOfX);
+        grad.rebind(&mStorage[5 + inWidthOfX], inWidthOfX);
+        diag.rebind(&mStorage[5 + 2 * inWidthOfX], inWidthOfX);
+        scale.rebind(&mStorage[5 + 3 * inWidthOfX], inWidthOfX);
+        lbfgs_state.rebind(&mStorage[5 + 4 * inWidthOfX], 21);
+        mcsrch_state.rebind(&mStorage[26 + 4 * inWidthOfX], 25);
+        ws.rebind(&mStorage[w], inWidthOfX * (2 * m + 1) + 2 * m);
+        // X_transp_AX may be empty, so we cannot use operator[]
+        X_transp_AX.rebind(
+            mStorage.ptr() + w + inWidthOfX * (2 * m + 1) + 2 * m,
+            inWithHessian ? inWidthOfX : 0);
+    }
+
+    Handle mStorage;
+
+public:
+    typename HandleTraits<Handle>::ReferenceToUInt32 iteration;
+    typename HandleTraits<Handle>::ReferenceToUInt16 widthOfX;
+    typename HandleTraits<Handle>::ReferenceToBool withHessian;
+
+    typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+    typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
+
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap coef;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap grad;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap diag;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap scale;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap lbfgs_state;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap mcsrch_state;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap ws;
+
+    typename HandleTraits<Handle>::SymmetricMatrixTransparentHandleMap X_transp_AX;
+};
+
+/**
+ * @brief Perform the logistic-regression transition step
+ *
+ * The log-likelihood and its gradient are evaluated at the coefficients of
+ * the previous state. If the optional fifth argument \c with_hessian is true,
+ * \f$ X^T A X \f$ is accumulated, too, and the final function does not move
+ * the coefficients.
+ */
+AnyType
+logregr_lbfgs_step_transition::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<MutableArrayHandle<double> > state = args[0];
+    double y = args[1].getAs<bool>() ? 1. : -1.;
+    MappedColumnVector x = args[2].getAs<MappedColumnVector>();
+
+    // The following check was added with MADLIB-138.
+    if (!x.is_finite())
+        throw std::domain_error("Design matrix is not finite.");
+
+    if (state.numRows == 0) {
+        if (x.size() > std::numeric_limits<uint16_t>::max())
+            throw std::domain_error("Number of independent variables cannot be "
+                "larger than 65535.");
+
+        bool withHessian = args.numFields() >= 5 && !args[4].isNull()
+            && args[4].getAs<bool>();
+        state.initialize(*this, static_cast<uint16_t>(x.size()), withHessian);
+
+        if (!args[3].isNull()) {
+            LogRegrLBFGSTransitionState<ArrayHandle<double> > previousState
+                = args[3];
+
+            if (previousState.widthOfX != state.widthOfX)
+                throw std::runtime_error("Inconsistent numbers of independent "
+                    "variables.");
+
+            if (withHessian) {
+                // Only the last accepted iterate is needed. The L-BFGS memory
+                // is not used any more. While a line search is in progress
+                // (iflag is 1), coef is a trial point.
+                state.iteration = previousState.iteration;
+                if (previousState.lbfgs_state(6) == 1)
+                    state.coef = previousState.diag.cwiseQuotient(
+                        previousState.scale);
+                else
+                    state.coef = previousState.coef;
+                state.lbfgs_state = previousState.lbfgs_state;
+                state.mcsrch_state = previousState.mcsrch_state;
+            } else {
+                state = previousState;
+                state.reset();
+            }
+        }
+    } else if (state.widthOfX != static_cast<uint16_t>(x.size())) {
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+    }
+
+    // Now do the transition step
+    state.numRows++;
+
+    // xc = x^T_i c
+    double xc = dot(x, state.coef);
+
+    // The gradient of the log-likelihood is the sum of the scores
+    // sigma(-y_i x_i c) y_i x_i
+    state.grad.noalias() += sigma(-y * xc) * y * x;
+
+    if (state.iteration == 0)
+        state.scale += x.cwiseAbs2();
+
+    if (state.withHessian) {
+        // a_i = sigma(x_i c) sigma(-x_i c)
+        double a = sigma(xc) * sigma(-xc);
+        state.X_transp_AX.rankUpdate(x, a);
+    }
+
+    //          n
+    //         --
+    // l(c) = -\  ln(1 + exp(-y_i * c^T x_i))
+    //         /_
+    //         i=1
+    state.logLikelihood -= std::log( 1. + std::exp(-y * xc) );
+    return state;
+}
+
+/**
+ * @brief Perform the perliminary aggregation function: Merge transition states
+ */
+AnyType
+logregr_lbfgs_step_merge_states::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<MutableArrayHandle<double> > stateLeft = args[0];
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > stateRight = args[1];
+
+    // We first handle the trivial case where this function is called with one
+    // of the states being the initial state
+    if (stateLeft.numRows == 0)
+        return stateRight;
+    else if (stateRight.numRows == 0)
+        return stateLeft;
+
+    // Merge states together and return
+    stateLeft += stateRight;
+    return stateLeft;
+}
+
+/**
+ * @brief Perform the logistic-regression final step
+ *
+ * We minimize the negative log-likelihood. Each call consumes the function
+ * value and gradient at the current coefficients and stores the next point to
+ * evaluate (either the next trial point of the line search or the start of
+ * the next line search) in \c coef. An L-BFGS iteration therefore takes one
+ * or more calls.
+ */
+AnyType
+logregr_lbfgs_step_final::run(AnyType &args) {
+    // We request a mutable object. Depending on the backend, this might perform
+    // a deep copy.
+    LogRegrLBFGSTransitionState<MutableArrayHandle<double> > state = args[0];
+
+    // Aggregates that haven't seen any data just return Null.
+    if (state.numRows == 0)
+        return Null();
+
+    if (!state.grad.is_finite() || !std::isfinite(static_cast<double>(state.logLikelihood)))
+        throw NoSolutionFoundException("Over- or underflow in intermediate "
+            "calulation. Input data is likely of poor numerical condition.");
+
+    // With the Hessian, this is the last scan and the coefficients stay.
+    // Likewise, once L-BFGS has converged (lbfgs_state(6) is iflag).
+    if (state.withHessian)
+        return state;
+    else if (state.iteration > 0 && state.lbfgs_state(6) == 0) {
+        state.iteration++;
+        return state;
+    }
+
+    if (state.iteration == 0) {
+        // Independent variables that are always 0 are left unscaled
+        for (Index i = 0; i < state.scale.size(); i++)
+            state.scale(i) = state.scale(i) > 0
+                ? std::sqrt(state.scale(i) / static_cast<double>(state.numRows))
+                : 1.;
+    }
+
+    // The gradient sums over all rows, so the tolerance scales with the
+    // number of rows
+    double eps = 1e-7 * static_cast<double>(state.numRows);
+    double xtol = 1.0e-16; // an estimate of the machine precision
+
+    LBFGS instance(state); // initialize the lbfgs with state of last iteration
+    instance.x = state.coef.cwiseProduct(state.scale);
+    instance.lbfgs(state.widthOfX, state.m,
+        -static_cast<double>(state.logLikelihood),
+        -state.grad.cwiseQuotient(state.scale), eps, xtol);
+
+    if (instance.iflag < 0)
+        throw NoSolutionFoundException(instance.info == 7
+            ? "L-BFGS search direction is not a descent direction. Input data "
+              "is likely of poor numerical condition."
+            : "L-BFGS step failed. Input data is likely of poor numerical "
+              "condition.");
+
+    if (instance.x.is_finite()) {
+        instance.save_state(state); // save current state for the next iteration
+        state.coef = state.coef.cwiseQuotient(state.scale);
+    } else {
+        // Close to the optimum, the curvature pairs can degenerate in
+        // floating-point arithmetic. No further progress is possible, so we
+        // keep the coefficients that were just evaluated.
+        state.lbfgs_state(6) = 0;
+    }
+
+    state.iteration++;
+    return state;
+}
+
+/**
+ * @brief Return the difference in log-likelihood between two states
+ *
+ * Only accepted iterates are compared: Within a line search, the
+ * log-likelihood of a trial point says nothing about convergence, so the
+ * difference is infinite until the L-BFGS iteration counter advances. Then, the
+ * log-likelihood at the start of the new line search (-mcsrch_state(9)) is
+ * compared with the one at the start of the previous line search. Once L-BFGS
+ * has converged (the gradient is sufficiently small), the difference is 0.
+ */
+AnyType
+internal_logregr_lbfgs_step_distance::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > stateLeft = args[0];
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > stateRight = args[1];
+
+    if (stateLeft.iteration > 0 && stateLeft.lbfgs_state(6) == 0)
+        return 0.;
+    else if (stateLeft.lbfgs_state(7) == stateRight.lbfgs_state(7))
+        return std::numeric_limits<double>::infinity();
+
+    return std::abs(stateLeft.mcsrch_state(9) - stateRight.mcsrch_state(9));
+}
+
+/**
+ * @brief Return the number of completed L-BFGS iterations of a state
+ */
+AnyType
+internal_logregr_lbfgs_num_iterations::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > state = args[0];
+
+    return static_cast<int32_t>(state.numLBFGSIterations());
+}
+
+/**
+ * @brief Return the coefficients and diagnostic statistics of the state
+ *
+ * The state must have been computed with \c with_hessian set.
+ */
+AnyType
+internal_logregr_lbfgs_result::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > state = args[0];
+
+    if (!state.withHessian)
+        throw std::invalid_argument("Invalid argument: Transition state does "
+            "not contain X^T A X.");
+
+    SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
+        state.X_transp_AX.unpack(), EigenvaluesOnly, ComputePseudoInverse);
+
+    return stateToResult(*this, state.coef,
+        decomposition.pseudoInverse().diagonal(), state.logLikelihood,
+        decomposition.conditionNo());
+}
+
+/**
+ * @brief Return the probability \f$ \sigma(\boldsymbol c^T \boldsymbol x) \f$
+ *     that the dependent variable is true
+ */
+AnyType
+logregr_predict_prob::run(AnyType &args) {
+    MappedColumnVector coef = args[0].getAs<MappedColumnVector>();
+    MappedColumnVector x = args[1].getAs<MappedColumnVector>();
+
+    if (x.size() != coef.size())
+        throw std::invalid_argument("Invalid arguments: Coefficients and "
+            "independent variables must have the same number of elements.");
+
+    return sigma(coef.dot(x));
+}
+
+/**
+ * @brief Return the probabilities for all rows of a two-dimensional array
+ *
+ * @see linregr_predict_rows
+ */
+AnyType
+logregr_predict_prob_rows::run(AnyType &args) {
+    MappedColumnVector coef = args[0].getAs<MappedColumnVector>();
+    MappedMatrix X = args[1].getAs<MappedMatrix>();
+
+    if (X.rows() != coef.size())
+        throw std::invalid_argument("Invalid arguments: Coefficients and "
+            "independent variables must have the same number of elements.");
+
+    MutableNativeColumnVector prob(allocateArray<double>(X.cols()));
+    prob.noalias() = trans(X) * coef;
+    for (Index i = 0; i < prob.size(); ++i)
+        prob(i) = sigma(prob(i));
+    return prob;
+}
+
 /**
  * @brief Compute the diagnostic statistics
  *
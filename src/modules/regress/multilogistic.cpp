@@ -142,7 +142,8 @@ public:
 private:
     static inline uint32_t arraySize(const uint16_t inWidthOfX,
         const uint16_t inNumCategories) {
-        return 4 + inWidthOfX * inWidthOfX * inNumCategories * inNumCategories
+        return 4 + inWidthOfX * inNumCategories
+                       * (inWidthOfX * inNumCategories + 1) / 2
                                  + 2 * inWidthOfX * inNumCategories;
     }
 
@@ -162,8 +163,9 @@ private:
      * Intra-iteration components (updated in transition step):
      * - 2 + widthOfX*numCategories: numRows (number of rows already processed in this iteration)
      * - 3 + widthOfX*numCategories: gradient (X^T A z)
-     * - 3 + 2 * widthOfX * inNumCategories: X_transp_AX (X^T A X)
-     * - 3 + widthOfX^2*numCategories^2
+     * - 3 + 2 * widthOfX * inNumCategories: X_transp_AX (X^T A X, lower
+                         triangle packed)
+     * - 3 + widthOfX*numCategories * (widthOfX*numCategories + 1) / 2
                          + 2 * widthOfX*numCategories: logLikelihood ( ln(l(c)) )
      */
     void rebind(uint16_t inWidthOfX = 0, uint16_t inNumCategories = 0) {
@@ -176,9 +178,9 @@ private:
 
         gradient.rebind(&mStorage[3 + inWidthOfX*inNumCategories],inWidthOfX*inNumCategories);
         X_transp_AX.rebind(&mStorage[3 + 2 * inWidthOfX*inNumCategories],
-            inNumCategories*inWidthOfX, inWidthOfX*inNumCategories);
+            inNumCategories*inWidthOfX);
         logLikelihood.rebind(&mStorage[3 +
-             inNumCategories*inNumCategories*inWidthOfX*inWidthOfX
+             inNumCategories*inWidthOfX * (inNumCategories*inWidthOfX + 1) / 2
              + 2 * inWidthOfX*inNumCategories]);
     }
 
@@ -191,7 +193,7 @@ public:
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap coef;
     typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap gradient;
-    typename HandleTraits<Handle>::MatrixTransparentHandleMap X_transp_AX;
+    typename HandleTraits<Handle>::SymmetricMatrixTransparentHandleMap X_transp_AX;
     typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
 };
 
@@ -321,9 +323,10 @@ mlogregr_irls_step_transition::run(AnyType &args) {
     XXTrans = cv_x * XXTrans;
 
     //Eigen doesn't supported outer-products for matrices, so we have to do our own.
-    //This operation is also known as a tensor-product.
+    //This operation is also known as a tensor-product. Only the lower triangle
+    //is stored in the state, so we skip the blocks above the diagonal.
     for (int i1 = 0; i1 < state.widthOfX; i1++){
-         for (int i2 = 0; i2 <state.widthOfX; i2++){
+         for (int i2 = 0; i2 <= i1; i2++){
             int rowOffset = numCategories * i1;
             int colOffset = numCategories * i2;
 
@@ -331,7 +334,7 @@ mlogregr_irls_step_transition::run(AnyType &args) {
         }
     }
 
-    triangularView<Lower>(state.X_transp_AX) += X_transp_AX;
+    state.X_transp_AX.addLowerTriangle(X_transp_AX);
 
     state.logLikelihood +=  y.transpose()*t1 - log(t3);
 
@@ -381,7 +384,7 @@ mlogregr_irls_step_final::run(AnyType &args) {
             "calulation. Input data is likely of poor numerical condition.");
 
     SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
-        -1*state.X_transp_AX, EigenvaluesOnly, ComputePseudoInverse);
+        -1*state.X_transp_AX.unpack(), EigenvaluesOnly, ComputePseudoInverse);
 
 
     // Precompute (X^T * A * X)^-1
@@ -399,7 +402,7 @@ mlogregr_irls_step_final::run(AnyType &args) {
     // Likewise, we store the condition number.
     // FIXME: This feels a bit like a hack.
     state.gradient = -1*heissianInver.diagonal();
-    state.X_transp_AX(0,0) = decomposition.conditionNo();
+    state.X_transp_AX.coeffRef(0,0) = decomposition.conditionNo();
 
 
     return state;
@@ -428,6 +431,78 @@ internal_mlogregr_irls_result::run(AnyType &args) {
 }
 
 
+/**
+ * @brief Compute the probabilities of all categories
+ *
+ * @param inCoef Coefficients as returned by mlogregr(), i.e., a
+ *     (numCategories - 1) x widthOfX matrix in column-major order
+ * @param inX Matrix with one column per row of independent variables
+ * @param outProb Matrix with one column of numCategories probabilities per
+ *     column of inX
+ *
+ * The last category is the reference category, consistent with the IRLS
+ * transition function. The probabilities are computed as a softmax of the
+ * scores \f$ -\boldsymbol c_k^T \boldsymbol x \f$ (and 0 for the reference
+ * category), shifted by their maximum so that exp() cannot overflow.
+ */
+template <class Derived>
+void
+mlogregrProbabilities(const MappedColumnVector &inCoef,
+    const Eigen::MatrixBase<Derived> &inX, Matrix &outProb) {
+
+    Index widthOfX = inX.rows();
+    if (widthOfX == 0 || inCoef.size() % widthOfX != 0
+        || inCoef.size() / widthOfX < 1)
+        throw std::invalid_argument("Invalid arguments: The number of "
+            "coefficients must be a multiple of the number of independent "
+            "variables.");
+
+    Index numCategories = inCoef.size() / widthOfX;
+    Eigen::Map<const Matrix> coef(inCoef.data(), numCategories, widthOfX);
+
+    outProb.resize(numCategories + 1, inX.cols());
+    outProb.topRows(numCategories).noalias() = -coef * inX;
+    outProb.row(numCategories).setZero();
+    for (Index i = 0; i < outProb.cols(); ++i) {
+        outProb.col(i).array() -= outProb.col(i).maxCoeff();
+        outProb.col(i) = outProb.col(i).array().exp();
+        outProb.col(i) /= outProb.col(i).sum();
+    }
+}
+
+/**
+ * @brief Return the probabilities of all categories (0, ..., numCategories - 1)
+ */
+AnyType
+mlogregr_predict_prob::run(AnyType &args) {
+    MappedColumnVector coef = args[0].getAs<MappedColumnVector>();
+    MappedColumnVector x = args[1].getAs<MappedColumnVector>();
+
+    Matrix prob;
+    mlogregrProbabilities(coef, x, prob);
+
+    MutableNativeColumnVector result(allocateArray<double>(prob.rows()));
+    result = prob.col(0);
+    return result;
+}
+
+/**
+ * @brief Return the probabilities of all categories for all rows of a
+ *     two-dimensional array
+ *
+ * The result is a two-dimensional array with one element of the outer
+ * dimension per row.
+ */
+AnyType
+mlogregr_predict_prob_rows::run(AnyType &args) {
+    MappedColumnVector coef = args[0].getAs<MappedColumnVector>();
+    MappedMatrix X = args[1].getAs<MappedMatrix>();
+
+    Matrix prob;
+    mlogregrProbabilities(coef, X, prob);
+    return prob;
+}
+
 /**
  * @brief Compute the diagnostic statistics
  *
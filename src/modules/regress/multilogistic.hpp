@@ -35,3 +35,15 @@ DECLARE_UDF(regress, internal_mlogregr_irls_step_distance)
  */
 DECLARE_UDF(regress, internal_mlogregr_irls_result)
 
+
+/**
+ * @brief Multi Logistic regression: Probabilities of all categories for a
+ *     single row
+ */
+DECLARE_UDF(regress, mlogregr_predict_prob)
+
+/**
+ * @brief Multi Logistic regression: Probabilities of all categories for a
+ *     block of rows
+ */
+DECLARE_UDF(regress, mlogregr_predict_prob_rows)
@@ -6,6 +6,7 @@
  *
  * -------------------------------------------------------------------------- */
 
+#include "cross_validation.hpp"
 #include "linear.hpp"
 #include "logistic.hpp"
 #include "multilogistic.hpp"
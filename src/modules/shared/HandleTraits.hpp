@@ -47,6 +47,9 @@ struct HandleTraits<ArrayHandle<double> > {
         ColumnVectorTransparentHandleMap;
     typedef dbal::eigen_integration::HandleMap<const Matrix,
         TransparentHandle<double, dbal::Immutable> > MatrixTransparentHandleMap;
+    typedef dbal::eigen_integration::SymmetricPackedHandleMap<const Matrix,
+        TransparentHandle<double, dbal::Immutable> >
+            SymmetricMatrixTransparentHandleMap;
 };
 
 template <>
@@ -66,6 +69,9 @@ struct HandleTraits<MutableArrayHandle<double> > {
             ColumnVectorTransparentHandleMap;
     typedef dbal::eigen_integration::HandleMap<Matrix,
         TransparentHandle<double, dbal::Mutable> > MatrixTransparentHandleMap;
+    typedef dbal::eigen_integration::SymmetricPackedHandleMap<Matrix,
+        TransparentHandle<double, dbal::Mutable> >
+            SymmetricMatrixTransparentHandleMap;
 };
 
 } // namespace modules
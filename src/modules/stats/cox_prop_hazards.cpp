@@ -32,20 +32,6 @@ AnyType stateToResult(const Allocator &inAllocator,
     double logLikelihood,
     double conditionNo);
 
-// Internal functions
-AnyType intermediate_stateToResult(
-		const HandleMap<const ColumnVector, TransparentHandle<double> >
-												& x,
-		const double inTimeDeath,
-		const double inExp_coef_x,
-		const HandleMap<const ColumnVector, TransparentHandle<double> >
-												& inCoef,
-		const HandleMap<const ColumnVector, TransparentHandle<double> >
-												& inX_exp_coef_x,
-		const HandleMap<const Matrix, TransparentHandle<double> >
-												& inX_xTrans_exp_coef_x
-		);
-
 
 
 
@@ -154,7 +140,7 @@ public:
 
 private:
     static inline size_t arraySize(const uint16_t inWidthOfX) {
-        return 6 + 3*inWidthOfX + 2*inWidthOfX*inWidthOfX;
+        return 6 + 3*inWidthOfX + inWidthOfX*(inWidthOfX + 1);
     }
 
     /**
@@ -173,8 +159,10 @@ private:
      * - 3 + widthofX: Hi[j] (see design document for details)
      * - 3 + 2*widthofX: gradCoef (coefficients of the gradient)
      * - 3 + 3*widthofX: logLikelihood
-     * - 4 + 3*widthofX: V (Precomputations for the hessian)
-     * - 4 + 3*widthofX + widthofX^2: hessian
+     * - 4 + 3*widthofX: V (Precomputations for the hessian, lower triangle
+     *   packed)
+     * - 4 + 3*widthofX + widthofX*(widthofX + 1)/2: hessian (lower triangle
+     *   packed)
      *
      */
     void rebind(uint16_t inWidthOfX) {
@@ -191,10 +179,10 @@ private:
         H.rebind(&mStorage[5+inWidthOfX], inWidthOfX);
         grad.rebind(&mStorage[5+2*inWidthOfX],inWidthOfX);
 				logLikelihood.rebind(&mStorage[5+3*inWidthOfX]);
-				V.rebind(&mStorage[6+3*inWidthOfX],
-					inWidthOfX, inWidthOfX);
-				hessian.rebind(&mStorage[6+3*inWidthOfX+inWidthOfX*inWidthOfX],
-					inWidthOfX, inWidthOfX);
+				V.rebind(&mStorage[6+3*inWidthOfX], inWidthOfX);
+				hessian.rebind(
+					&mStorage[6+3*inWidthOfX+inWidthOfX*(inWidthOfX + 1)/2],
+					inWidthOfX);
 				
 
     }
@@ -212,8 +200,8 @@ public:
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap H;
 		typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap grad;		
     typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
-    typename HandleTraits<Handle>::MatrixTransparentHandleMap V;
-    typename HandleTraits<Handle>::MatrixTransparentHandleMap hessian;
+    typename HandleTraits<Handle>::SymmetricMatrixTransparentHandleMap V;
+    typename HandleTraits<Handle>::SymmetricMatrixTransparentHandleMap hessian;
 
 };
 
@@ -226,10 +214,14 @@ public:
  * Arguments (Matched with PSQL wrapped)
  * - 0: Current State
  * - 1: x
- * - 2: exp_coef_x
- * - 3: x_exp_coef_x value (Column Vector)
- * - 4: x_xTrans_exp_coef_x value (Matrix)
- * - 5: Previous State
+ * - 2: y (time of death)
+ * - 3: Previous State
+ *
+ * The coefficients of the previous iteration are part of the previous state,
+ * so \f$ e^{\boldsymbol c^T \boldsymbol x} \f$ and the outer product
+ * \f$ \boldsymbol x \boldsymbol x^T e^{\boldsymbol c^T \boldsymbol x} \f$ are
+ * computed here. This keeps the tuples that need to be sorted by time of death
+ * narrow.
 */
 
 AnyType cox_prop_hazards_step_transition::run(AnyType &args) {
@@ -238,26 +230,30 @@ AnyType cox_prop_hazards_step_transition::run(AnyType &args) {
 		CoxPropHazardsTransitionState<MutableArrayHandle<double> > state = args[0];
     MappedColumnVector x = args[1].getAs<MappedColumnVector>();
     double y = args[2].getAs<double>();
-		
-		/** Note: These precomputations come from "intermediate_cox_prop_hazards".
-			They are precomputed and stored in a temporary table.
-		*/
-    double exp_coef_x = args[3].getAs<double>();
-    MappedColumnVector x_exp_coef_x = args[4].getAs<MappedColumnVector>();
-    MappedMatrix x_xTrans_exp_coef_x = args[5].getAs<MappedMatrix>();
-		
+
+    // The following check was added with MADLIB-138.
+    if (!isfinite(x))
+        throw std::domain_error("Design matrix is not finite.");
+
     if (state.numRows == 0) {
+			if (x.size() > std::numeric_limits<uint16_t>::max())
+					throw std::domain_error("Number of independent variables cannot be "
+							"larger than 65535.");
+
 			state.initialize(*this, static_cast<uint16_t>(x.size()));
 			
-			if (!args[6].isNull()) {
+			if (!args[3].isNull()) {
 					CoxPropHazardsTransitionState<ArrayHandle<double> > previousState
-																																		= args[6];
+																																		= args[3];
 					state = previousState;
 					state.reset();
 					
 			}
 						
-		}
+		} else if (state.widthOfX != static_cast<uint16_t>(x.size())) {
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+    }
 
     state.numRows++;
 		
@@ -279,9 +275,9 @@ AnyType cox_prop_hazards_step_transition::run(AnyType &args) {
 				want it to stay PSD (makes it easier for inverse compuations)
 		*/
 			state.grad -= state.multiplier*state.H/state.S;
-			triangularView<Lower>(state.hessian) -=
-								((state.H*trans(state.H))/(state.S*state.S)
-												- state.V/state.S)*state.multiplier;
+			state.hessian.rankUpdate(state.H,
+								-state.multiplier/(state.S*state.S));
+			state.hessian.packed() += state.V.packed()*(state.multiplier/state.S);
 			state.logLikelihood -=  state.multiplier*std::log(state.S);
 			state.multiplier = 1;
 				
@@ -291,11 +287,14 @@ AnyType cox_prop_hazards_step_transition::run(AnyType &args) {
 				there are ties or not.
 				Note: See design documentation for details on the implementation.
 		*/
+		double coef_x = dot(state.coef, x);
+		double exp_coef_x = std::exp(coef_x);
+
 		state.S += exp_coef_x;
-		state.H += x_exp_coef_x;
-		state.V += x_xTrans_exp_coef_x;
+		state.H += exp_coef_x * x;
+		state.V.rankUpdate(x, exp_coef_x);
 		state.grad += x;
-		state.logLikelihood += std::log(exp_coef_x);
+		state.logLikelihood += coef_x;
 		state.y_previous = y;
 				
     return state;
@@ -320,19 +319,19 @@ AnyType cox_prop_hazards_step_final::run(AnyType &args) {
 
 		// First merge all tied times of death for the last column
 		state.grad -= state.multiplier*state.H/state.S;
-		triangularView<Lower>(state.hessian) -=
-						((state.H*trans(state.H))/(state.S*state.S)
-											- state.V/state.S)*state.multiplier;
+		state.hessian.rankUpdate(state.H, -state.multiplier/(state.S*state.S));
+		state.hessian.packed() += state.V.packed()*(state.multiplier/state.S);
 		state.logLikelihood -=  state.multiplier*std::log(state.S);
 
 
 		// Computing pseudo inverse of a PSD matrix
+    Matrix hessian = state.hessian.unpack();
     SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
-        state.hessian, EigenvaluesOnly, ComputePseudoInverse);
+        hessian, EigenvaluesOnly, ComputePseudoInverse);
     Matrix inverse_of_hessian = decomposition.pseudoInverse();
 
 		// Newton step 
-		state.coef += state.hessian.inverse()*state.grad;
+		state.coef += hessian.inverse()*state.grad;
 		
     // Return all coefficients etc. in a tuple
     return state;
@@ -357,7 +356,7 @@ AnyType internal_cox_prop_hazards_result::run(AnyType &args) {
     CoxPropHazardsTransitionState<ArrayHandle<double> > state = args[0];
 
     SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
-        state.hessian, EigenvaluesOnly, ComputePseudoInverse);
+        state.hessian.unpack(), EigenvaluesOnly, ComputePseudoInverse);
 
     return stateToResult(*this, state.coef,
 					 decomposition.pseudoInverse().diagonal(),
@@ -400,59 +399,6 @@ AnyType stateToResult(
 
 
 
-
-/**
- * @brief Newton method transition step for Cox Proportional Hazards
- *
- * @param args
- *
- * Arguments (Matched with PSQL wrapped)
- * - 1: X value (Column Vector)
- * - 2: coef value (Column Vector)
-*/
-
-AnyType intermediate_cox_prop_hazards::run(AnyType &args) {
-
-    MappedColumnVector x = args[0].getAs<MappedColumnVector>();
-    MutableNativeColumnVector coef(allocateArray<double>(x.size()));
-		
-    // The following check was added with MADLIB-138.
-    if (!isfinite(x))
-        throw std::domain_error("Design matrix is not finite.");
-
-		if (x.size() > std::numeric_limits<uint16_t>::max())
-				throw std::domain_error("Number of independent variables cannot be "
-						"larger than 65535.");
-
-		if (args[1].isNull()) {
-			for (int i=0; i<x.size() ; i++)
-				coef(i) = 0;
-		}
-		else {
-			coef = args[1].getAs<MappedColumnVector>();
-		}
-		
-		double exp_coef_x;
-		MutableNativeColumnVector
-			x_exp_coef_x(allocateArray<double>(x.size()));
-		MutableNativeMatrix
-			x_xTrans_exp_coef_x(allocateArray<double>(x.size(), x.size()));							
-
-		exp_coef_x = std::exp(trans(coef)*x);
-		x_exp_coef_x = exp_coef_x*x;
-		x_xTrans_exp_coef_x = x * trans(x) * exp_coef_x;
-		
-    AnyType tuple;
-		tuple << x
-					<< exp_coef_x
-					<< x_exp_coef_x
-					<< x_xTrans_exp_coef_x;
-		
-    return tuple;
-
-}
-
-
 } // namespace stats
 
 } // namespace modules
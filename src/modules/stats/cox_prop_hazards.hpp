@@ -24,7 +24,3 @@ DECLARE_UDF(stats, internal_cox_prop_hazards_result)
  */
 DECLARE_UDF(stats, internal_cox_prop_hazards_step_distance)
 
-/**
- * @brief Intermadiate Cox Proportional Hazard computation: Intermadiate Results
- */
-DECLARE_UDF(stats, intermediate_cox_prop_hazards)
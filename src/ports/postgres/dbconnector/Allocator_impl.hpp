@@ -47,6 +47,7 @@ Allocator::internalAllocateArray(
 
     std::size_t size = sizeof(T) * numElements
         + ARR_OVERHEAD_NONULLS(Dimensions);
+    checkVarlenaSize(size);
     ArrayType *array;
 
     // Note: Except for the allocate call, the following statements do not call
@@ -108,6 +109,11 @@ template <dbal::MemoryContext MC, dbal::ZeroMemory ZM,
 inline
 MutableByteString
 Allocator::allocateByteString(std::size_t inSize) const {
+    if (inSize > std::numeric_limits<std::size_t>::max()
+        - ByteString::kEffectiveHeaderSize)
+        throw std::bad_alloc();
+    checkVarlenaSize(ByteString::kEffectiveHeaderSize + inSize);
+
     bytea* byteString = static_cast<bytea*>(
         allocate<MC, dbal::DoZero, F>(ByteString::kEffectiveHeaderSize + inSize)
     );
@@ -193,6 +199,78 @@ Allocator::free(void *inPtr) const {
     RESUME_INTERRUPTS();
 }
 
+/**
+ * @brief Verify that a varlena value (array or byte string) of the given total
+ *     size can be represented by the backend
+ *
+ * Every array or byte string that is handed back to the backend cannot
+ * exceed \c MaxAllocSize (1 GB). This includes the transition states of all
+ * our aggregates, because they are declared with array or \c bytea8 state
+ * types. Transition states are always kept in memory; they are not spilled
+ * to disk. A state that would exceed the limit is therefore an error. We
+ * check the size before allocating, so that the user sees the actual limit
+ * instead of a generic out-of-memory error.
+ *
+ * @exception std::length_error if the size exceeds \c MaxAllocSize
+ */
+inline
+void
+Allocator::checkVarlenaSize(std::size_t inSize) const {
+    if (AllocSizeIsValid(inSize))
+        return;
+
+    std::stringstream errorMsg;
+    errorMsg << "Cannot create a database value of " << inSize << " bytes. "
+        "Arrays and byte strings (including aggregate transition states) are "
+        "limited to " << static_cast<std::size_t>(MaxAllocSize) << " bytes. "
+        "Typically, this indicates that the number of independent variables "
+        "is too large for this method.";
+    throw std::length_error(errorMsg.str());
+}
+
+/**
+ * @brief Call \c palloc() or \c palloc0(), falling back to a huge allocation
+ *     for blocks larger than \c MaxAllocSize
+ *
+ * Memory that never leaves the C++ layer is not subject to the varlena size
+ * limit. Final functions of wide models need such temporaries: e.g., the
+ * unpacked \f$ X^T X \f$ and its pseudo-inverse exceed 1 GB once there are
+ * more than about 11,500 independent variables. Huge allocations are
+ * available since PostgreSQL 9.4. On older versions, \c palloc() raises the
+ * usual error.
+ */
+template <dbal::ZeroMemory ZM>
+inline
+void *
+Allocator::hugePalloc(size_t inSize) const {
+#if PG_VERSION_NUM >= 90400
+    if (!AllocSizeIsValid(inSize)) {
+        // MemoryContextAllocHuge() does not return on failure
+        void *ptr = MemoryContextAllocHuge(CurrentMemoryContext, inSize);
+        if (ZM == dbal::DoZero)
+            std::memset(ptr, 0, inSize);
+        return ptr;
+    }
+#endif
+    return (ZM == dbal::DoZero) ? palloc0(inSize) : palloc(inSize);
+}
+
+/**
+ * @brief Call \c repalloc(), falling back to \c repalloc_huge() for blocks
+ *     larger than \c MaxAllocSize
+ *
+ * @see hugePalloc()
+ */
+inline
+void *
+Allocator::hugeRePalloc(void *inPtr, size_t inSize) const {
+#if PG_VERSION_NUM >= 90400
+    if (!AllocSizeIsValid(inSize))
+        return repalloc_huge(inPtr, inSize);
+#endif
+    return repalloc(inPtr, inSize);
+}
+
 /**
  * @brief Thin wrapper around \c palloc() that returns a 16-byte-aligned
  *     pointer.
@@ -212,14 +290,14 @@ inline
 void *
 Allocator::internalPalloc(size_t inSize) const {
 #if MAXIMUM_ALIGNOF >= 16
-    return (ZM == dbal::DoZero) ? palloc0(inSize) : palloc(inSize);
+    return hugePalloc<ZM>(inSize);
 #else
     if (inSize > std::numeric_limits<size_t>::max() - 16)
         return NULL;
 
     /* Precondition: inSize <= std::numeric_limits<size_t>::max() - 16 */
     const size_t size = inSize + 16;
-    void *raw = (ZM == dbal::DoZero) ? palloc0(size) : palloc(size);
+    void *raw = hugePalloc<ZM>(size);
     return makeAligned(raw);
 #endif
 }
@@ -244,7 +322,7 @@ inline
 void *
 Allocator::internalRePalloc(void *inPtr, size_t inSize) const {
 #if MAXIMUM_ALIGNOF >= 16
-    return repalloc(inPtr, inSize);
+    return hugeRePalloc(inPtr, inSize);
 #else
     if (inSize > std::numeric_limits<size_t>::max() - 16) {
         pfree(unaligned(inPtr));
@@ -253,7 +331,7 @@ Allocator::internalRePalloc(void *inPtr, size_t inSize) const {
 
     /* Precondition: inSize <= std::numeric_limits<size_t>::max() - 16 */
     const size_t size = inSize + 16;
-    void *raw = repalloc(unaligned(inPtr), size);
+    void *raw = hugeRePalloc(unaligned(inPtr), size);
 
     if (ZM == dbal::DoZero) {
         std::fill(
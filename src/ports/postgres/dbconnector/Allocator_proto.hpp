@@ -88,6 +88,13 @@ protected:
     MutableArrayHandle<T> internalAllocateArray(
         const std::array<std::size_t, Dimensions>& inNumElements) const;
 
+    void checkVarlenaSize(std::size_t inSize) const;
+
+    template <dbal::ZeroMemory ZM>
+    void *hugePalloc(size_t inSize) const;
+
+    void *hugeRePalloc(void *inPtr, size_t inSize) const;
+
     template <dbal::ZeroMemory ZM>
     void *internalPalloc(size_t inSize) const;
 
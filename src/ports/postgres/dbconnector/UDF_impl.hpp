@@ -175,6 +175,8 @@ UDF::call(FunctionCallInfo fcinfo) {
         MADLIB_HANDLE_STANDARD_EXCEPTION(ERRCODE_INVALID_PARAMETER_VALUE);
     } catch (std::domain_error& exc) {
         MADLIB_HANDLE_STANDARD_EXCEPTION(ERRCODE_INVALID_PARAMETER_VALUE);
+    } catch (std::length_error& exc) {
+        MADLIB_HANDLE_STANDARD_EXCEPTION(ERRCODE_PROGRAM_LIMIT_EXCEEDED);
     } catch (std::range_error& exc) {
         MADLIB_HANDLE_STANDARD_EXCEPTION(ERRCODE_DATA_EXCEPTION);
     } catch (std::overflow_error& exc) {